@@ -27,6 +27,10 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #include <math.h>
+#include <new>
+#if !WASM
+#include <atomic>
+#endif
 
 #if WASM
 #include "portableBuildingBlocks.h"
@@ -39,9 +43,21 @@
 
 FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
 
-static int g_NextFeatureID = 1;
+// Several images may be opened at once on different threads, and
+// every shape of every image needs its own ID.
+#if WASM
+static int32 g_NextFeatureID = 1;
+#else
+static std::atomic<int32> g_NextFeatureID(1);
+#endif
 
-static uint32 GetPixelLuminance(CImageFile *pSrcImage, int32 currentX, int32 currentY);
+static ErrVal GetRowLuminance(
+                    CImageFile *pImageFile, 
+                    int32 currentY, 
+                    int32 startX, 
+                    int32 stopX, 
+                    uint32 *pLuminanceList);
+static inline int32 GetOverlapLength(int32 startA, int32 stopA, int32 startB, int32 stopB);
 
 
 
@@ -106,8 +122,7 @@ GetDistanceBetweenPoints(CBioCADPoint *pPointA, CBioCADPoint *pPointB) {
 /////////////////////////////////////////////////////////////////////////////
 CBioCADShape::CBioCADShape() {    
     m_FeatureType = FEATURE_TYPE_REGION;
-    m_FeatureID = g_NextFeatureID;
-    g_NextFeatureID = g_NextFeatureID + 1;
+    m_FeatureID = g_NextFeatureID++;
     m_ShapeFlags = 0;
 
     m_BoundingBoxLeftX = 0;
@@ -117,9 +132,16 @@ CBioCADShape::CBioCADShape() {
 
     m_pPointList = NULL;
     m_NumPoints = 0;
+    m_pPointArena = NULL;
 
     m_pCrossSectionList = NULL;
     m_NumCrossSections = 0;
+    m_AreaInPixels = -1;
+
+    m_pLuminanceTable = NULL;
+    m_pLuminenceHistogram = NULL;
+    m_NumHistogramPixels = 0;
+    m_HistogramChangeNumber = 0;
 
     m_pOwnerImage = NULL;
     m_pNextShape = NULL;
@@ -139,10 +161,11 @@ CBioCADShape::~CBioCADShape() {
     if (m_pCrossSectionList) {
         memFree(m_pCrossSectionList);
     }
+    memFree(m_pLuminenceHistogram);
 
     while (m_pPointList) {
         CBioCADPoint *pNextPoint = m_pPointList->m_pNextPoint;
-        delete m_pPointList;
+        DiscardPoint(m_pPointList);
         m_pPointList = pNextPoint;
     }
 } // ~CBioCADShape
@@ -161,7 +184,11 @@ CBioCADPoint *
 CBioCADShape::AddPoint(int32 x, int32 y, int32 z) {    
     CBioCADPoint *pNewPoint = NULL;
 
-    pNewPoint = newex CBioCADPoint;
+    if (m_pPointArena) {
+        pNewPoint = m_pPointArena->NewPoint();
+    } else {
+        pNewPoint = newex CBioCADPoint;
+    }
     if (pNewPoint) {
         pNewPoint->m_X = x;
         pNewPoint->m_Y = y;
@@ -180,6 +207,25 @@ CBioCADShape::AddPoint(int32 x, int32 y, int32 z) {
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// [DiscardPoint]
+//
+// The caller has already removed the point from the list. A point from
+// the arena is not freed until the whole arena is.
+/////////////////////////////////////////////////////////////////////////////
+void
+CBioCADShape::DiscardPoint(CBioCADPoint *pPoint) {
+    if (NULL == m_pPointArena) {
+        delete pPoint;
+    }
+} // DiscardPoint
+
+
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // [DrawShape]
@@ -245,6 +291,8 @@ void
 CBioCADShape::FindBoundingBox() {
     CBioCADPoint *pPoint;  
 
+    DiscardLuminenceHistogram();
+
     m_BoundingBoxLeftX = 0;
     m_BoundingBoxRightX = 0;
     m_BoundingBoxTopY = 0;
@@ -330,6 +378,8 @@ abort:
 //
 // [GetPixelStats]
 //
+// If the shape has a luminance table, and the caller does not want the
+// min or max, then this does not read any pixels.
 /////////////////////////////////////////////////////////////////////////////
 ErrVal
 CBioCADShape::GetPixelStats(
@@ -345,9 +395,10 @@ CBioCADShape::GetPixelStats(
     int32 index;
     uint32 currentPixelLuminence;
     int32 numPixels;
-    uint32 totalLuminence;
+    uint64 totalLuminence;
     uint32 minLuminence;
     uint32 maxLuminence;
+    uint32 *pLuminanceList = NULL;
 
     if (NULL == m_pSourceFile) {
         gotoErr(EFail);
@@ -373,10 +424,26 @@ CBioCADShape::GetPixelStats(
     maxLuminence = 0;
 
     /////////////////////////////////////////////
-    if (FEATURE_TYPE_RECTANGLE == m_FeatureType) {
+    if ((NULL == pMinLuminence) && (NULL == pMaxLuminence) && (NULL != m_pLuminanceTable)) {
+        err = GetLuminenceTotals(&totalLuminence, NULL, &numPixels);
+        if (err) {
+            gotoErr(err);
+        }
+    /////////////////////////////////////////////
+    } else if (FEATURE_TYPE_RECTANGLE == m_FeatureType) {
+        // Every row we read is inside the bounding box.
+        pLuminanceList = (uint32 *) memAlloc(sizeof(uint32) * (m_BoundingBoxRightX - m_BoundingBoxLeftX + 2));
+        if (NULL == pLuminanceList) {
+            gotoErr(EFail);
+        }
+
         for (currentY = m_BoundingBoxTopY; currentY <= m_BoundingBoxBottomY; currentY++) {
+            err = GetRowLuminance(m_pSourceFile, currentY, m_BoundingBoxLeftX, m_BoundingBoxRightX + 1, pLuminanceList);
+            if (err) {
+                gotoErr(err);
+            }
             for (currentX = m_BoundingBoxLeftX; currentX <= m_BoundingBoxRightX; currentX++) {
-                currentPixelLuminence = GetPixelLuminance(m_pSourceFile, currentX, currentY);
+                currentPixelLuminence = pLuminanceList[currentX - m_BoundingBoxLeftX];
                 totalLuminence += currentPixelLuminence;
                 if (currentPixelLuminence < minLuminence) {
                     minLuminence = currentPixelLuminence;
@@ -389,11 +456,21 @@ CBioCADShape::GetPixelStats(
         }
     /////////////////////////////////////////////
     } else if (FEATURE_TYPE_REGION == m_FeatureType) {
+        // Every row we read is inside the bounding box.
+        pLuminanceList = (uint32 *) memAlloc(sizeof(uint32) * (m_BoundingBoxRightX - m_BoundingBoxLeftX + 2));
+        if (NULL == pLuminanceList) {
+            gotoErr(EFail);
+        }
+
         for (index = 0; index < m_NumCrossSections; index++) {
             pCrossSection = &(m_pCrossSectionList[index]);
             currentY = pCrossSection->m_Y;
+            err = GetRowLuminance(m_pSourceFile, currentY, pCrossSection->m_StartX, pCrossSection->m_StopX, pLuminanceList);
+            if (err) {
+                gotoErr(err);
+            }
             for (currentX = pCrossSection->m_StartX; currentX < pCrossSection->m_StopX; currentX++) {
-                currentPixelLuminence = GetPixelLuminance(m_pSourceFile, currentX, currentY);
+                currentPixelLuminence = pLuminanceList[currentX - pCrossSection->m_StartX];
                 totalLuminence += currentPixelLuminence;
                 if (currentPixelLuminence < minLuminence) {
                     minLuminence = currentPixelLuminence;
@@ -410,7 +487,7 @@ CBioCADShape::GetPixelStats(
         *pNumPixelsChecked = numPixels;
     }
     if (pTotalLuminence) {
-        *pTotalLuminence = totalLuminence;
+        *pTotalLuminence = (uint32) totalLuminence;
     }
     if (pAverageLuminence) {
         *pAverageLuminence = (float) (((float)totalLuminence) / ((float)numPixels));
@@ -423,6 +500,7 @@ CBioCADShape::GetPixelStats(
     }
 
 abort:
+    memFree(pLuminanceList);
     returnErr(err);
 } // GetPixelStats
 
@@ -431,10 +509,155 @@ abort:
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetLuminenceDeviation]
+//
+// This needs a luminance table, so it only works for shapes that belong
+// to an image.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBioCADShape::GetLuminenceDeviation(
+                    float *pAverageLuminence,
+                    float *pStandardDeviation,
+                    uint32 *pNumPixelsChecked) {
+    ErrVal err = ENoErr;
+    uint64 totalLuminence;
+    uint64 totalSquares;
+    int32 numPixels;
+    double average = 0.0;
+    double variance = 0.0;
+
+    if (pAverageLuminence) {
+        *pAverageLuminence = 0;
+    }
+    if (pStandardDeviation) {
+        *pStandardDeviation = 0;
+    }
+    if (pNumPixelsChecked) {
+        *pNumPixelsChecked = 0;
+    }
+
+    err = GetLuminenceTotals(&totalLuminence, &totalSquares, &numPixels);
+    if (err) {
+        gotoErr(err);
+    }
+
+    // The variance is the average of the squares minus the square of the
+    // average. Rounding can make that slightly negative when every pixel
+    // is the same.
+    if (numPixels > 0) {
+        average = ((double) totalLuminence) / ((double) numPixels);
+        variance = (((double) totalSquares) / ((double) numPixels)) - (average * average);
+        if (variance < 0.0) {
+            variance = 0.0;
+        }
+    }
+
+    if (pAverageLuminence) {
+        *pAverageLuminence = (float) average;
+    }
+    if (pStandardDeviation) {
+        *pStandardDeviation = (float) sqrt(variance);
+    }
+    if (pNumPixelsChecked) {
+        *pNumPixelsChecked = numPixels;
+    }
+
+abort:
+    returnErr(err);
+} // GetLuminenceDeviation
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetLuminenceTotals]
+//
+// Add up the luminance of the shape from its luminance table. A rectangle
+// is a single lookup, and a region is one lookup for each cross section.
+// pTotalSquares may be NULL.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBioCADShape::GetLuminenceTotals(uint64 *pTotal, uint64 *pTotalSquares, int32 *pNumPixels) {
+    ErrVal err = ENoErr;
+    CBioCADCrossSection *pCrossSection;
+    uint64 rowTotal;
+    uint64 rowSquares;
+    int32 width;
+    int32 height;
+    int32 index;
+
+    *pTotal = 0;
+    if (pTotalSquares) {
+        *pTotalSquares = 0;
+    }
+    *pNumPixels = 0;
+
+    if ((NULL == m_pSourceFile) || (NULL == m_pLuminanceTable)) {
+        gotoErr(EFail);
+    }
+    err = m_pLuminanceTable->Update(m_pSourceFile);
+    if (err) {
+        gotoErr(err);
+    }
+
+    /////////////////////////////////////////////
+    if (FEATURE_TYPE_RECTANGLE == m_FeatureType) {
+        m_pLuminanceTable->GetRectTotals(
+                                m_BoundingBoxLeftX,
+                                m_BoundingBoxTopY,
+                                m_BoundingBoxRightX + 1,
+                                m_BoundingBoxBottomY + 1,
+                                pTotal,
+                                pTotalSquares);
+
+        width = m_BoundingBoxRightX - m_BoundingBoxLeftX + 1;
+        height = m_BoundingBoxBottomY - m_BoundingBoxTopY + 1;
+        if ((width > 0) && (height > 0)) {
+            *pNumPixels = width * height;
+        }
+    /////////////////////////////////////////////
+    } else if (FEATURE_TYPE_REGION == m_FeatureType) {
+        for (index = 0; index < m_NumCrossSections; index++) {
+            pCrossSection = &(m_pCrossSectionList[index]);
+            if (pCrossSection->m_StopX <= pCrossSection->m_StartX) {
+                continue;
+            }
+
+            m_pLuminanceTable->GetRectTotals(
+                                    pCrossSection->m_StartX,
+                                    pCrossSection->m_Y,
+                                    pCrossSection->m_StopX,
+                                    pCrossSection->m_Y + 1,
+                                    &rowTotal,
+                                    &rowSquares);
+            *pTotal += rowTotal;
+            if (pTotalSquares) {
+                *pTotalSquares += rowSquares;
+            }
+            *pNumPixels += pCrossSection->m_StopX - pCrossSection->m_StartX;
+        }
+    }
+
+abort:
+    returnErr(err);
+} // GetLuminenceTotals
+
+
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // [CountPixelsInLuminenceRange]
 //
+// This only reads the pixels the first time it is called, or after they
+// change. After that, each range is two lookups in the histogram.
 /////////////////////////////////////////////////////////////////////////////
 ErrVal
 CBioCADShape::CountPixelsInLuminenceRange(
@@ -444,17 +667,9 @@ CBioCADShape::CountPixelsInLuminenceRange(
                     float *pFractionOfRegion,
                     uint32 *pNumPixelsChecked) {
     ErrVal err = ENoErr;
-    CBioCADCrossSection *pCrossSection;
-    int32 currentX;
-    int32 currentY;
-    int32 index;
-    uint32 currentPixelLuminence;
     int32 numPixels;
     int32 numPixelsChecked;
 
-    if (NULL == m_pSourceFile) {
-        gotoErr(EFail);
-    }
     if (pNumPixels) {
         *pNumPixels = 0;
     }
@@ -464,18 +679,99 @@ CBioCADShape::CountPixelsInLuminenceRange(
     if (pNumPixelsChecked) {
         *pNumPixelsChecked = 0;
     }
+
+    err = UpdateLuminenceHistogram();
+    if (err) {
+        gotoErr(err);
+    }
+
     numPixels = 0;
-    numPixelsChecked = 0;
+    numPixelsChecked = m_NumHistogramPixels;
+    if (maxLuminence > MAX_COLOR_SUM_LUMINANCE) {
+        maxLuminence = MAX_COLOR_SUM_LUMINANCE;
+    }
+    if (minLuminence <= maxLuminence) {
+        numPixels = m_pLuminenceHistogram[maxLuminence + 1] - m_pLuminenceHistogram[minLuminence];
+    }
 
+    if (pNumPixels) {
+        *pNumPixels = numPixels;
+    }
+    if (pFractionOfRegion) {
+        float totalPixelArea = (float) numPixelsChecked;
+        *pFractionOfRegion = (float) (((float) numPixels) / totalPixelArea);
+    }
+    if (pNumPixelsChecked) {
+        *pNumPixelsChecked = numPixelsChecked;
+    }
+
+abort:
+    returnErr(err);
+} // CountPixelsInLuminenceRange
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [UpdateLuminenceHistogram]
+//
+// Count the pixels of the shape at each luminance, unless that was already
+// done since the last time the pixels of the image changed.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBioCADShape::UpdateLuminenceHistogram() {
+    ErrVal err = ENoErr;
+    CBioCADCrossSection *pCrossSection;
+    int32 currentX;
+    int32 currentY;
+    int32 index;
+    uint32 currentPixelLuminence;
+    uint32 *pLuminanceList = NULL;
+
+    if (NULL == m_pSourceFile) {
+        gotoErr(EFail);
+    }
+    if ((NULL != m_pLuminenceHistogram)
+            && (m_pSourceFile->GetChangeNumber() == m_HistogramChangeNumber)) {
+        gotoErr(ENoErr);
+    }
+
+    if (NULL == m_pLuminenceHistogram) {
+        m_pLuminenceHistogram = (uint32 *) memAlloc(sizeof(uint32) * (MAX_COLOR_SUM_LUMINANCE + 2));
+        if (NULL == m_pLuminenceHistogram) {
+            gotoErr(EFail);
+        }
+    }
+    for (index = 0; index < (MAX_COLOR_SUM_LUMINANCE + 2); index++) {
+        m_pLuminenceHistogram[index] = 0;
+    }
+    m_NumHistogramPixels = 0;
+
+    // Every row we read is inside the bounding box.
+    pLuminanceList = (uint32 *) memAlloc(sizeof(uint32) * (m_BoundingBoxRightX - m_BoundingBoxLeftX + 2));
+    if (NULL == pLuminanceList) {
+        gotoErr(EFail);
+    }
+
+    // Count each pixel in the entry after its luminance, so the running
+    // totals below leave entry n with the pixels below n.
     /////////////////////////////////////////////
     if (FEATURE_TYPE_RECTANGLE == m_FeatureType) {
         for (currentY = m_BoundingBoxTopY; currentY <= m_BoundingBoxBottomY; currentY++) {
+            err = GetRowLuminance(m_pSourceFile, currentY, m_BoundingBoxLeftX, m_BoundingBoxRightX + 1, pLuminanceList);
+            if (err) {
+                gotoErr(err);
+            }
             for (currentX = m_BoundingBoxLeftX; currentX <= m_BoundingBoxRightX; currentX++) {
-                currentPixelLuminence = GetPixelLuminance(m_pSourceFile, currentX, currentY);
-                if ((currentPixelLuminence >= minLuminence) && (currentPixelLuminence <= maxLuminence)) {
-                    numPixels += 1;
+                currentPixelLuminence = pLuminanceList[currentX - m_BoundingBoxLeftX];
+                if (currentPixelLuminence > MAX_COLOR_SUM_LUMINANCE) {
+                    currentPixelLuminence = MAX_COLOR_SUM_LUMINANCE;
                 }
-                numPixelsChecked += 1;
+                m_pLuminenceHistogram[currentPixelLuminence + 1] += 1;
+                m_NumHistogramPixels += 1;
             }
         }
     /////////////////////////////////////////////
@@ -483,30 +779,50 @@ CBioCADShape::CountPixelsInLuminenceRange(
         for (index = 0; index < m_NumCrossSections; index++) {
             pCrossSection = &(m_pCrossSectionList[index]);
             currentY = pCrossSection->m_Y;
+            err = GetRowLuminance(m_pSourceFile, currentY, pCrossSection->m_StartX, pCrossSection->m_StopX, pLuminanceList);
+            if (err) {
+                gotoErr(err);
+            }
             for (currentX = pCrossSection->m_StartX; currentX < pCrossSection->m_StopX; currentX++) {
-                currentPixelLuminence = GetPixelLuminance(m_pSourceFile, currentX, currentY);
-                if ((currentPixelLuminence >= minLuminence) && (currentPixelLuminence <= maxLuminence)) {
-                    numPixels += 1;
+                currentPixelLuminence = pLuminanceList[currentX - pCrossSection->m_StartX];
+                if (currentPixelLuminence > MAX_COLOR_SUM_LUMINANCE) {
+                    currentPixelLuminence = MAX_COLOR_SUM_LUMINANCE;
                 }
-                numPixelsChecked += 1;
+                m_pLuminenceHistogram[currentPixelLuminence + 1] += 1;
+                m_NumHistogramPixels += 1;
             }
         }
     }
 
-    if (pNumPixels) {
-        *pNumPixels = numPixels;
-    }
-    if (pFractionOfRegion) {
-        float totalPixelArea = (float) numPixelsChecked;
-        *pFractionOfRegion = (float) (((float) numPixels) / totalPixelArea);
-    }
-    if (pNumPixelsChecked) {
-        *pNumPixelsChecked = numPixelsChecked;
+    for (index = 1; index < (MAX_COLOR_SUM_LUMINANCE + 2); index++) {
+        m_pLuminenceHistogram[index] += m_pLuminenceHistogram[index - 1];
     }
+    m_HistogramChangeNumber = m_pSourceFile->GetChangeNumber();
 
 abort:
+    memFree(pLuminanceList);
+    if (err) {
+        DiscardLuminenceHistogram();
+    }
     returnErr(err);
-} // CountPixelsInLuminenceRange
+} // UpdateLuminenceHistogram
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [DiscardLuminenceHistogram]
+//
+/////////////////////////////////////////////////////////////////////////////
+void
+CBioCADShape::DiscardLuminenceHistogram() {
+    memFree(m_pLuminenceHistogram);
+    m_pLuminenceHistogram = NULL;
+    m_NumHistogramPixels = 0;
+} // DiscardLuminenceHistogram
 
 
 
@@ -518,6 +834,9 @@ abort:
 //
 // [ComputeOverlap]
 //
+// Return the fraction of the shape that is inside the rectangle. All of
+// the edges are inclusive. This never looks at single pixels; it clips
+// each row of the shape to the rectangle.
 /////////////////////////////////////////////////////////////////////////////
 float
 CBioCADShape::ComputeOverlap(
@@ -527,49 +846,43 @@ CBioCADShape::ComputeOverlap(
                     int32 rightOffset) {
     ErrVal err = ENoErr;
     CBioCADCrossSection *pCrossSection;
-    int32 currentX;
-    int32 currentY;
     int32 index;
+    int32 startIndex;
+    int32 stopIndex;
     int32 totalNumPixels = 0;
     int32 numPixelsInOverlap = 0;
-    int32 rowWidth;
     float ratio = 0.0;
 
     if (NULL == m_pSourceFile) {
         gotoErr(EFail);
     }
-    totalNumPixels = 0;
+    totalNumPixels = GetAreaInPixels();
     numPixelsInOverlap = 0;
 
     /////////////////////////////////////////////
     if (FEATURE_TYPE_RECTANGLE == m_FeatureType) {
-        for (currentY = m_BoundingBoxTopY; currentY <= m_BoundingBoxBottomY; currentY++) {
-            if ((currentY >= topOffset) && (currentY <= bottomOffset)) {
-                for (currentX = m_BoundingBoxLeftX; currentX <= m_BoundingBoxRightX; currentX++) {
-                    if ((currentX >= leftOffset) && (currentX <= rightOffset)) {
-                        numPixelsInOverlap += 1;
-                    }
-                }
-            } // if ((currentY >= topOffset) && (currentY <= bottomOffset)
-
-            rowWidth = (m_BoundingBoxRightX - m_BoundingBoxLeftX) + 1;
-            totalNumPixels += rowWidth;
-        }
+        numPixelsInOverlap = GetOverlapLength(m_BoundingBoxTopY, m_BoundingBoxBottomY, topOffset, bottomOffset)
+                                * GetOverlapLength(m_BoundingBoxLeftX, m_BoundingBoxRightX, leftOffset, rightOffset);
     /////////////////////////////////////////////
-    } else if (FEATURE_TYPE_REGION == m_FeatureType) {
-        for (index = 0; index < m_NumCrossSections; index++) {
-            pCrossSection = &(m_pCrossSectionList[index]);
-            currentY = pCrossSection->m_Y;
-            if ((currentY >= topOffset) && (currentY <= bottomOffset)) {
-                for (currentX = pCrossSection->m_StartX; currentX <= pCrossSection->m_StopX; currentX++) {
-                    if ((currentX >= leftOffset) && (currentX <= rightOffset)) {
-                        numPixelsInOverlap += 1;
-                    }
-                }
-            } // if ((currentY >= topOffset) && (currentY <= bottomOffset)
+    } else if ((FEATURE_TYPE_REGION == m_FeatureType) && (m_NumCrossSections > 0)) {
+        // There is one cross section for each row, in order from the top,
+        // so only the rows inside the rectangle have to be checked.
+        startIndex = topOffset - m_pCrossSectionList[0].m_Y;
+        if (startIndex < 0) {
+            startIndex = 0;
+        }
+        stopIndex = (bottomOffset - m_pCrossSectionList[0].m_Y) + 1;
+        if (stopIndex > m_NumCrossSections) {
+            stopIndex = m_NumCrossSections;
+        }
 
-            rowWidth = (pCrossSection->m_StopX - pCrossSection->m_StartX) + 1;
-            totalNumPixels += rowWidth;
+        for (index = startIndex; index < stopIndex; index++) {
+            pCrossSection = &(m_pCrossSectionList[index]);
+            numPixelsInOverlap += GetOverlapLength(
+                                        pCrossSection->m_StartX,
+                                        pCrossSection->m_StopX,
+                                        leftOffset,
+                                        rightOffset);
         }
     }
 
@@ -593,6 +906,8 @@ abort:
 //
 // [GetAreaInPixels]
 //
+// The area of a region is only counted the first time this is called
+// after its cross sections are built.
 /////////////////////////////////////////////////////////////////////////////
 int32
 CBioCADShape::GetAreaInPixels() {
@@ -601,6 +916,10 @@ CBioCADShape::GetAreaInPixels() {
     int32 index;
     int32 deltaX;
 
+    if ((FEATURE_TYPE_REGION == m_FeatureType) && (m_AreaInPixels >= 0)) {
+        return(m_AreaInPixels);
+    }
+
     /////////////////////////////////////////////
     if (FEATURE_TYPE_RECTANGLE == m_FeatureType) {
         // This includes the right and bottom pixel, not stopping before the 
@@ -620,6 +939,7 @@ CBioCADShape::GetAreaInPixels() {
                 result += deltaX;
             }
         }
+        m_AreaInPixels = result;
     } else {
         result = 0;
     }
@@ -649,7 +969,7 @@ CBioCADLine::CBioCADLine() {
     m_AngleWithHorizontal = 0.0L;
 
     m_NumPixels = 0;
-    m_PixelList = NULL;
+    m_pPixels = NULL;
 
     m_pNextLine = NULL;
 } // CBioCADLine
@@ -684,7 +1004,7 @@ CBioCADLine::GetLength() {
 ErrVal 
 CBioCADLine::DrawLineToImage(CImageFile *pDestImage, int32 color, int32 options) {
     ErrVal err = ENoErr;
-    CBioCADPoint *pPixel;
+    int32 pixelNum;
     int32 maxXPos;
     int32 maxYPos;
     uint32 blackPixel;
@@ -701,15 +1021,12 @@ CBioCADLine::DrawLineToImage(CImageFile *pDestImage, int32 color, int32 options)
     blackPixel = pDestImage->ConvertGrayScaleToPixel(color);
 
 
-    pPixel = m_PixelList;
-    while (pPixel) {
-        err = pDestImage->SetPixel(pPixel->m_X, pPixel->m_Y, blackPixel);
+    for (pixelNum = 0; pixelNum < m_NumPixels; pixelNum++) {
+        err = pDestImage->SetPixel(m_pPixels[pixelNum].m_X, m_pPixels[pixelNum].m_Y, blackPixel);
         if (err) {
             gotoErr(err);
         }
-
-        pPixel = pPixel->m_pNextPoint;
-    } // while (pPixel)
+    } // for (pixelNum = 0; pixelNum < m_NumPixels; pixelNum++)
     
 abort:
     returnErr(err);
@@ -717,6 +1034,219 @@ abort:
 
 
 
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [CBioCADArenaBlock]
+//
+// One allocation of the arena. The objects follow the header.
+/////////////////////////////////////////////////////////////////////////////
+
+// Every object starts on a multiple of 8 bytes, so doubles are aligned.
+#define ARENA_ALIGN(numBytes)       (((numBytes) + 7) & ~7)
+
+// Most objects fit many times in one block. A bigger one gets its own block.
+#define ARENA_BLOCK_SIZE            (64 * 1024)
+
+class CBioCADArenaBlock {
+public:
+    CBioCADArenaBlock   *m_pNextBlock;
+    int32               m_MaxBytes;
+    int32               m_NumBytes;
+
+    char *GetBytes() { return(((char *) this) + ARENA_ALIGN(sizeof(CBioCADArenaBlock))); }
+}; // CBioCADArenaBlock
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [CBioCADArena]
+//
+/////////////////////////////////////////////////////////////////////////////
+CBioCADArena::CBioCADArena() {
+    m_pBlockList = NULL;
+} // CBioCADArena
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [~CBioCADArena]
+//
+/////////////////////////////////////////////////////////////////////////////
+CBioCADArena::~CBioCADArena() {
+    DiscardAll();
+} // ~CBioCADArena
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Alloc]
+//
+// Memory is only ever taken from the end of the first block, so the
+// caller can give back whatever it did not use.
+/////////////////////////////////////////////////////////////////////////////
+void *
+CBioCADArena::Alloc(int32 numBytes) {
+    CBioCADArenaBlock *pBlock;
+    char *pBuffer;
+    int32 maxBytes;
+
+    if (numBytes <= 0) {
+        return(NULL);
+    }
+    numBytes = ARENA_ALIGN(numBytes);
+
+    pBlock = m_pBlockList;
+    if ((NULL == pBlock) || ((pBlock->m_MaxBytes - pBlock->m_NumBytes) < numBytes)) {
+        maxBytes = ARENA_BLOCK_SIZE;
+        if (numBytes > maxBytes) {
+            maxBytes = numBytes;
+        }
+
+        pBlock = (CBioCADArenaBlock *) memAlloc(ARENA_ALIGN(sizeof(CBioCADArenaBlock)) + maxBytes);
+        if (NULL == pBlock) {
+            return(NULL);
+        }
+        pBlock->m_MaxBytes = maxBytes;
+        pBlock->m_NumBytes = 0;
+        pBlock->m_pNextBlock = m_pBlockList;
+        m_pBlockList = pBlock;
+    }
+
+    pBuffer = pBlock->GetBytes() + pBlock->m_NumBytes;
+    pBlock->m_NumBytes += numBytes;
+
+    return(pBuffer);
+} // Alloc
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [ReleaseUnused]
+//
+// Give back the end of the most recent allocation.
+/////////////////////////////////////////////////////////////////////////////
+void
+CBioCADArena::ReleaseUnused(void *pBuffer, int32 numAllocatedBytes, int32 numUsedBytes) {
+    CBioCADArenaBlock *pBlock = m_pBlockList;
+
+    numAllocatedBytes = ARENA_ALIGN(numAllocatedBytes);
+    numUsedBytes = ARENA_ALIGN(numUsedBytes);
+    if ((NULL == pBlock) || (NULL == pBuffer) || (numUsedBytes >= numAllocatedBytes)) {
+        return;
+    }
+
+    // Only the last allocation can shrink.
+    if ((((char *) pBuffer) + numAllocatedBytes) != (pBlock->GetBytes() + pBlock->m_NumBytes)) {
+        return;
+    }
+    pBlock->m_NumBytes -= (numAllocatedBytes - numUsedBytes);
+} // ReleaseUnused
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [NewPoint]
+//
+/////////////////////////////////////////////////////////////////////////////
+CBioCADPoint *
+CBioCADArena::NewPoint() {
+    void *pBuffer;
+
+    pBuffer = Alloc(sizeof(CBioCADPoint));
+    if (NULL == pBuffer) {
+        return(NULL);
+    }
+
+    return(::new (pBuffer) CBioCADPoint);
+} // NewPoint
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [NewLine]
+//
+/////////////////////////////////////////////////////////////////////////////
+CBioCADLine *
+CBioCADArena::NewLine() {
+    CBioCADLine *pLine;
+    void *pBuffer;
+
+    pBuffer = Alloc(sizeof(CBioCADLine));
+    if (NULL == pBuffer) {
+        return(NULL);
+    }
+
+    pLine = ::new (pBuffer) CBioCADLine;
+    pLine->m_LineFlags |= CBioCADLine::LINE_IN_ARENA;
+
+    return(pLine);
+} // NewLine
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [TakeAll]
+//
+// Move everything in another arena into this one. Nothing moves in
+// memory, so pointers to the objects are still valid.
+/////////////////////////////////////////////////////////////////////////////
+void
+CBioCADArena::TakeAll(CBioCADArena *pSrcArena) {
+    CBioCADArenaBlock *pLastBlock;
+
+    if ((NULL == pSrcArena) || (NULL == pSrcArena->m_pBlockList)) {
+        return;
+    }
+
+    pLastBlock = pSrcArena->m_pBlockList;
+    while (pLastBlock->m_pNextBlock) {
+        pLastBlock = pLastBlock->m_pNextBlock;
+    }
+    pLastBlock->m_pNextBlock = m_pBlockList;
+    m_pBlockList = pSrcArena->m_pBlockList;
+    pSrcArena->m_pBlockList = NULL;
+} // TakeAll
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [DiscardAll]
+//
+// None of the objects in an arena have destructors that do anything, so
+// this just frees the blocks.
+/////////////////////////////////////////////////////////////////////////////
+void
+CBioCADArena::DiscardAll() {
+    CBioCADArenaBlock *pBlock;
+
+    while (m_pBlockList) {
+        pBlock = m_pBlockList;
+        m_pBlockList = pBlock->m_pNextBlock;
+        memFree(pBlock);
+    }
+} // DiscardAll
+
+
+
     
 
 
@@ -767,7 +1297,9 @@ CBioCADLineSet::DiscardLines() {
         if (m_fAllocatedLines) {
             for (index = 0; index < m_NumLines; index++) {
                 pLine = m_pLineList[index];
-                delete pLine;
+                if (!(pLine->m_LineFlags & CBioCADLine::LINE_IN_ARENA)) {
+                    delete pLine;
+                }
             }
         }
 
@@ -782,12 +1314,16 @@ CBioCADLineSet::DiscardLines() {
     if (m_pRemovedLines) {
         while (m_pRemovedLines) {
             pNextLine = m_pRemovedLines->m_pNextLine;
-            delete m_pRemovedLines;
+            if (!(m_pRemovedLines->m_LineFlags & CBioCADLine::LINE_IN_ARENA)) {
+                delete m_pRemovedLines;
+            }
             m_pRemovedLines = pNextLine;
         }
 
         m_pRemovedLines = NULL;
     }
+
+    m_Arena.DiscardAll();
 } // DiscardLines
 
 
@@ -929,9 +1465,9 @@ CBioCADLineSet::FilterLines(int32 criteria, int32 value) {
     for (srcIndex = 0; srcIndex < m_NumLines; srcIndex++) {
         pLine = m_pLineList[srcIndex];
         if (pLine->m_LineFlags & CBioCADLine::LINE_TEMP_PRUNED) {
-            if (m_fAllocatedLines) {
+            if ((m_fAllocatedLines) && (!(pLine->m_LineFlags & CBioCADLine::LINE_IN_ARENA))) {
                 delete pLine;
-            }  
+            }
         } else {
             m_pLineList[destIndex] = pLine;
             destIndex += 1;          
@@ -952,57 +1488,88 @@ abort:
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// [GetPixelLuminance]
+// [GetRowLuminance]
 //
-// Get the intensity values for red, blue, and green. 
-//
-//          grayscale luminance = (0.30 * red) + (0.59 * green) + (0.11 * blue)
-//
-// Note, together these add up to 1.0, so we are just weighting red, green, and blue
-// and then summing them. 
+// Get the luminance of the pixels from (startX, currentY) up to but not
+// including (stopX, currentY). This reads the whole span at once with
+// ReadColorSumRow instead of one GetPixel per pixel. A pixel outside the
+// image has a luminance of 0.
 //
+// Here, luminance is just (red + green + blue), not the weighted grayscale
+// used for edge detection, so it ranges 0-765.
 /////////////////////////////////////////////////////////////////////////////
-uint32
-GetPixelLuminance(CImageFile *pImageFile, int32 currentX, int32 currentY) {
+ErrVal
+GetRowLuminance(
+            CImageFile *pImageFile, 
+            int32 currentY, 
+            int32 startX, 
+            int32 stopX, 
+            uint32 *pLuminanceList) {
     ErrVal err = ENoErr;
-    uint32 pixelValue;
-    uint32 red = 0;
-    uint32 green = 0;
-    uint32 blue = 0;
-    float redFloat;
-    float greenFloat;
-    float blueFloat;
-    float totalFloat;
-    uint32 luminance = 0;
-
-    if (NULL == pImageFile) {
+    int32 imageWidth;
+    int32 imageHeight;
+    int32 firstX;
+    int32 lastX;
+    int32 index;
+
+    if ((NULL == pImageFile) || (NULL == pLuminanceList)) {
         gotoErr(EFail);
     }
+    for (index = 0; index < (stopX - startX); index++) {
+        pLuminanceList[index] = 0;
+    }
 
-    err = pImageFile->GetPixel(currentX, currentY, &pixelValue);
+    err = pImageFile->GetImageInfo(&imageWidth, &imageHeight);
     if (err) {
         gotoErr(err);
     }
-    pImageFile->ParsePixel(pixelValue, &blue, &green, &red);
-
-    if (1) {
-        luminance = red + green + blue;
-    } else {
-        redFloat = (float) red;
-        greenFloat = (float) green;
-        blueFloat = (float) blue;
+    if ((currentY < 0) || (currentY >= imageHeight)) {
+        gotoErr(ENoErr);
+    }
 
-        redFloat = redFloat * (float) 0.30;
-        greenFloat = greenFloat * (float) 0.59;
-        blueFloat = blueFloat * (float) 0.11;
+    // Only read the part of the row that is inside the image.
+    firstX = startX;
+    if (firstX < 0) {
+        firstX = 0;
+    }
+    lastX = stopX;
+    if (lastX > imageWidth) {
+        lastX = imageWidth;
+    }
+    if (firstX >= lastX) {
+        gotoErr(ENoErr);
+    }
 
-        totalFloat = redFloat + greenFloat + blueFloat;
-        luminance = (uint32) totalFloat;
+    err = ReadColorSumRow(pImageFile, currentY, firstX, lastX - firstX, &(pLuminanceList[firstX - startX]));
+    if (err) {
+        gotoErr(err);
     }
 
 abort:
-    return(luminance);
-} // GetPixelLuminance
+    returnErr(err);
+} // GetRowLuminance
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetOverlapLength]
+//
+// Return how many integers are in both [startA, stopA] and [startB, stopB].
+/////////////////////////////////////////////////////////////////////////////
+static inline int32
+GetOverlapLength(int32 startA, int32 stopA, int32 startB, int32 stopB) {
+    int32 start = (startA > startB) ? startA : startB;
+    int32 stop = (stopA < stopB) ? stopA : stopB;
+
+    if (stop < start) {
+        return(0);
+    }
+    return((stop - start) + 1);
+} // GetOverlapLength
 
 
 
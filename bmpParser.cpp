@@ -36,13 +36,18 @@
 #include "buildingBlocks.h"
 #endif
 
+#if LINUX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "imageLib.h"
 #include "imageLibInternal.h"
 
 FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
 
-#define LITTLE_ENDIAN_NUMBERS 1
-
 typedef struct {
   unsigned char magic[2];
 } CBMPImageFileSignature;
@@ -71,6 +76,20 @@ typedef struct {
 } CBMPBitMapHeader;
 
 
+// This is one slot in the hash table that maps a color back to its
+// index in the color table. An empty slot has a negative colorIndex.
+typedef struct {
+  uint32    color;
+  int32     colorIndex;
+} CColorIndexMapEntry;
+
+// The map is twice the size of the largest color table it will index,
+// so a lookup never has to probe far.
+#define MAX_INDEXED_COLORS          256
+#define COLOR_INDEX_MAP_BITS        9
+#define COLOR_INDEX_MAP_SIZE        (1 << COLOR_INDEX_MAP_BITS)
+
+
 
 
 ///////////////////////////////////////////////////////
@@ -81,6 +100,7 @@ public:
     CBMPImageFile();
     virtual ~CBMPImageFile();
     ErrVal InitializeForNewFile(const char *pFilePath);
+    ErrVal MapImageFile(const char *pFilePath);
 
     /////////////////////////////
     // class CImageFile
@@ -107,7 +127,13 @@ public:
     virtual void ParsePixel(uint32 value, uint32 *pBlue, uint32 *pGreen, uint32 *pRed);
     virtual uint32 ConvertGrayScaleToPixel(uint32 grayScaleValue);
 
+    virtual ErrVal GetRowPointer(int32 yPos, const char **ppPixelRow, int32 *pBitsPerPixel);
+    virtual ErrVal ReadRow(int32 yPos, int32 startX, int32 numPixels, uint32 *pPixels);
+    virtual ErrVal WriteRow(int32 yPos, int32 startX, int32 numPixels, const uint32 *pPixels);
+
     virtual bool RowOperationsAreFast() { return(true); }
+    virtual bool HasColorTable() { return(NULL != m_pColorTable); }
+    virtual uint32 GetChangeNumber() { return(m_ChangeNumber); }
     virtual ErrVal CopyPixelRow(int32 srcX, int32 srcY, int32 destX, int32 destY, int32 numPixels);
     virtual ErrVal CropImage(int32 newWidth, int32 newHeight);
 
@@ -121,6 +147,36 @@ private:
     };
 
     ErrVal Parse();
+    void FreeBuffer();
+
+    // These convert between a pixel value and its bytes in one row.
+    // There is one of each for every bit depth, see SelectPixelKernels().
+    typedef uint32 (*PixelDecoderProc)(const uchar *pPixelRow, int32 xPos);
+    typedef void (*PixelEncoderProc)(uchar *pPixelRow, int32 xPos, uint32 value);
+    typedef void (CBMPImageFile::*ReadRowProc)(const uchar *pPixelRow, int32 startX, int32 numPixels, uint32 *pPixels);
+    typedef void (CBMPImageFile::*WriteRowProc)(uchar *pPixelRow, int32 startX, int32 numPixels, const uint32 *pPixels);
+
+    ErrVal SelectPixelKernels();
+    template <int32 BITS_PER_PIXEL> void SelectKernelsForDepth();
+    template <int32 BITS_PER_PIXEL, bool HAS_COLOR_TABLE>
+    void ReadRowKernel(const uchar *pPixelRow, int32 startX, int32 numPixels, uint32 *pPixels);
+    template <int32 BITS_PER_PIXEL, bool HAS_COLOR_TABLE>
+    void WriteRowKernel(uchar *pPixelRow, int32 startX, int32 numPixels, const uint32 *pPixels);
+
+    uchar *GetPixelRow(int32 yPos);
+    uint32 GetColorTableIndex(uint32 value);
+    void BuildColorIndexMap();
+    int32 LookupColorIndex(uint32 color);
+
+    // Each entry in the color table is usually 4 bytes, with the format
+    // "blue, green, red, 0x00". An index past the end of the table is
+    // returned unchanged.
+    uint32 TranslateColorIndex(uint32 colorNumber) {
+        if (colorNumber < m_NumColorsInColorTable) {
+            return(m_pColorTable[colorNumber] & 0x00FFFFFF);
+        }
+        return(colorNumber);
+    }
 
     // The file. This is optional, and may be NULL if this is a 
     // memory-only object.
@@ -132,6 +188,18 @@ private:
     char                    *m_pBuffer;
     uint64                  m_FileLength;
 
+    // If m_pBuffer is a private mapping of the file rather than a heap
+    // copy, then it has to be unmapped instead of freed. m_fBufferMatchesFile
+    // is only true until the first time we change the mapped pixels, and
+    // lets Save() skip rewriting a file that was only read.
+    bool                    m_fBufferIsMapped;
+    uint64                  m_MappedLength;
+    bool                    m_fBufferMatchesFile;
+
+    // This goes up whenever the pixels may have changed, including when
+    // a new image is loaded.
+    uint32                  m_ChangeNumber;
+
     // Pointers int m_pBuffer with the parsed sections.
     CBMPImageFileSignature  *m_pFileSignature;
     CBMPImageFileHeader     *m_pFileHeader;
@@ -141,13 +209,23 @@ private:
     char                    *m_pPixelTable;
     uint32                  m_NumColorTableEntriesWritten;
 
+    // This maps each color in m_pColorTable back to its index, so writing
+    // a pixel does not search the whole table. It is only used when the
+    // table has at most MAX_INDEXED_COLORS entries.
+    CColorIndexMapEntry     m_ColorIndexMap[COLOR_INDEX_MAP_SIZE];
+    bool                    m_fUseColorIndexMap;
+
     int32                   m_BytesPerRowInPixelTable;
     int32                   m_BytesInColorTable;
     int32                   m_BytesInPixelArray;
     bool                    m_fRowsAreUpsideDown;
     int32                   m_BytesToReadPerPixel;
 
-    uint32                  m_MaskPreservingLowerBits[8];
+    // The pixel kernels for the current bit depth and color table.
+    PixelDecoderProc        m_pDecodePixel;
+    PixelEncoderProc        m_pEncodePixel;
+    ReadRowProc             m_pReadRow;
+    WriteRowProc            m_pWriteRow;
 }; // CBMPImageFile
 
 
@@ -193,6 +271,44 @@ abort:
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// [OpenMappedBMPFile]
+//
+// This is the same as OpenBMPFile, except the file is mapped into memory
+// rather than read into a heap buffer, so the cost of opening a file does
+// not grow with the size of the file. See MapImageFile.
+/////////////////////////////////////////////////////////////////////////////
+CImageFile *
+OpenMappedBMPFile(const char *pFilePath) {
+    ErrVal err = ENoErr;
+    CBMPImageFile *pParser = NULL;
+
+    if (NULL == pFilePath) {
+        gotoErr(EFail);
+    }
+
+    pParser = newex CBMPImageFile;
+    if (NULL == pParser) {
+        gotoErr(EFail);
+    }
+
+    err = pParser->MapImageFile(pFilePath);
+    if (err) {
+        gotoErr(err);
+    }
+
+    return(pParser);
+
+abort:
+    delete pParser;
+    return(NULL);
+} // OpenMappedBMPFile
+
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // [OpenBitmapImage]
@@ -289,13 +405,15 @@ DeleteImageObject(CImageFile *pParserInterface) {
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 CBMPImageFile::CBMPImageFile() {
-    int32 bitNum;
-
     m_pFilePathName = NULL;
     m_fReadFromBitMap = false;
 
     m_pBuffer = NULL;
     m_FileLength = 0;
+    m_fBufferIsMapped = false;
+    m_MappedLength = 0;
+    m_fBufferMatchesFile = false;
+    m_ChangeNumber = 0;
 
     m_pFileSignature = NULL;
     m_pFileHeader = NULL;
@@ -305,6 +423,7 @@ CBMPImageFile::CBMPImageFile() {
     m_pPixelTable = NULL;
     m_NumColorsInColorTable = 0;
     m_NumColorTableEntriesWritten = 0;
+    m_fUseColorIndexMap = false;
 
     m_BytesPerRowInPixelTable = 0;
     m_BytesInColorTable = 0;
@@ -312,9 +431,10 @@ CBMPImageFile::CBMPImageFile() {
     m_fRowsAreUpsideDown = false;
     m_BytesToReadPerPixel = 0;
 
-    for (bitNum = 0; bitNum < 8; bitNum++) {
-        m_MaskPreservingLowerBits[bitNum] = (1 << bitNum) - 1;
-    }
+    m_pDecodePixel = NULL;
+    m_pEncodePixel = NULL;
+    m_pReadRow = NULL;
+    m_pWriteRow = NULL;
 } // CBMPImageFile
 
 
@@ -386,6 +506,116 @@ abort:
 
 
 
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [MapImageFile]
+//
+// Map the file into memory instead of copying it into a heap buffer.
+// Parse() and GetPixel() then work directly on the mapped pages, so only
+// the pages we actually touch are ever read from disk.
+//
+// The mapping is MAP_PRIVATE, so it is copy-on-write. The first SetPixel,
+// CropImage or other change to a page makes a private copy of just that
+// page, and the file on disk is never changed until we Save().
+//
+// This is only implemented on Linux. Everywhere else, it falls back to
+// reading the file.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBMPImageFile::MapImageFile(const char *pFilePath) {
+#if LINUX
+    ErrVal err = ENoErr;
+    int fileHandle = -1;
+    struct stat fileInfo;
+    void *pMapping;
+
+    if (NULL == pFilePath) {
+        gotoErr(EFail);
+    }
+    Close();
+    m_fReadFromBitMap = false;
+
+    // We still open the file normally, since that is what Save() writes to.
+    err = m_File.OpenExistingFile(pFilePath, 0);
+    if (err) {
+        gotoErr(err);
+    }
+
+    m_pFilePathName = strdupex(pFilePath);
+    if (NULL == m_pFilePathName) {
+        gotoErr(EFail);
+    }
+
+    fileHandle = open(pFilePath, O_RDONLY);
+    if (fileHandle < 0) {
+        gotoErr(EFail);
+    }
+    if ((fstat(fileHandle, &fileInfo) < 0) || (fileInfo.st_size <= 0)) {
+        gotoErr(EFail);
+    }
+
+    // A private mapping may be writable even though the file is opened read-only.
+    // Writes go to private copies of the pages, never to the file.
+    pMapping = mmap(NULL, fileInfo.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileHandle, 0);
+    if (MAP_FAILED == pMapping) {
+        gotoErr(EFail);
+    }
+    m_pBuffer = (char *) pMapping;
+    m_FileLength = fileInfo.st_size;
+    m_fBufferIsMapped = true;
+    m_MappedLength = fileInfo.st_size;
+    m_fBufferMatchesFile = true;
+
+    err = Parse();
+    if (err) {
+        gotoErr(err);
+    }
+
+abort:
+    // The mapping stays valid after the file handle is closed.
+    if (fileHandle >= 0) {
+        close(fileHandle);
+    }
+    returnErr(err);
+#else
+    return(ReadImageFile(pFilePath));
+#endif
+} // MapImageFile
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FreeBuffer]
+//
+/////////////////////////////////////////////////////////////////////////////
+void
+CBMPImageFile::FreeBuffer() {
+#if LINUX
+    if (m_fBufferIsMapped) {
+        if (m_pBuffer) {
+            munmap(m_pBuffer, m_MappedLength);
+        }
+        m_pBuffer = NULL;
+    }
+#endif
+    memFree(m_pBuffer);
+    m_pBuffer = NULL;
+    m_FileLength = 0;
+
+    m_fBufferIsMapped = false;
+    m_MappedLength = 0;
+    m_fBufferMatchesFile = false;
+    m_ChangeNumber += 1;
+} // FreeBuffer
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // [InitializeFromBitMap]
@@ -471,6 +701,7 @@ CBMPImageFile::InitializeFromBitMap(
     m_pColorTable = NULL;
     m_NumColorsInColorTable = 0;
     m_BytesInColorTable = 0;
+    m_fUseColorIndexMap = false;
 
     m_pPixelTable = m_pBuffer;
     m_fRowsAreUpsideDown = false;
@@ -481,6 +712,11 @@ CBMPImageFile::InitializeFromBitMap(
     m_BytesInPixelArray = m_BytesPerRowInPixelTable * m_pBitMapHeader->imageHeightInPixels;
     m_BytesToReadPerPixel = bytesPerPixel;
 
+    err = SelectPixelKernels();
+    if (err) {
+        gotoErr(err);
+    }
+
 abort:
     returnErr(err);
 } // InitializeFromBitMap
@@ -536,9 +772,7 @@ CBMPImageFile::Close() {
     memFree(m_pFilePathName);
     m_pFilePathName = NULL;
 
-    memFree(m_pBuffer);
-    m_pBuffer = NULL;
-    m_FileLength = 0;
+    FreeBuffer();
 
     m_pFileSignature = NULL;
     m_pFileHeader = NULL;
@@ -548,6 +782,7 @@ CBMPImageFile::Close() {
     m_pPixelTable = NULL;
     m_NumColorsInColorTable = 0;
     m_NumColorTableEntriesWritten = 0;
+    m_fUseColorIndexMap = false;
 
     m_BytesPerRowInPixelTable = 0;
     m_BytesInColorTable = 0;
@@ -555,6 +790,11 @@ CBMPImageFile::Close() {
     m_fRowsAreUpsideDown = false;
     m_BytesToReadPerPixel = 0;
 
+    m_pDecodePixel = NULL;
+    m_pEncodePixel = NULL;
+    m_pReadRow = NULL;
+    m_pWriteRow = NULL;
+
     m_File.Close();
 } // Close
 
@@ -591,6 +831,9 @@ CBMPImageFile::SaveAs(const char *pNewPathName, int32 options) {
     }
 
     CloseOnDiskOnly();
+    // The new file is empty, so it has to be written even if we never
+    // changed a mapped buffer.
+    m_fBufferMatchesFile = false;
 
     if (pNewPathName) {
         CSimpleFile::DeleteFile(pNewPathName);
@@ -629,6 +872,9 @@ abort:
 // Any changes we make to the file are done directly to the memory-resident
 // image, so we don't have to translate between memory-resident data structures
 // and the file image.
+//
+// If the buffer is still an unchanged mapping of the file, then the file
+// already holds exactly what we would write.
 /////////////////////////////////////////////////////////////////////////////
 ErrVal
 CBMPImageFile::Save(int32 options) {
@@ -639,6 +885,13 @@ CBMPImageFile::Save(int32 options) {
         gotoErr(ENoErr);
     }
 
+    if ((m_fBufferMatchesFile) && !(options & BIOCAD_FILE_MAY_CREATE_FILE)) {
+        if (options & BIOCAD_FILE_CLOSE_AFTER_SAVE) {
+            m_File.Close();
+        }
+        gotoErr(ENoErr);
+    }
+
     if (options & BIOCAD_FILE_MAY_CREATE_FILE) { // (m_File.IsOpen()))
         if (!(options & BIOCAD_FILE_CLOSE_AFTER_SAVE)) {
             gotoErr(ENoErr);
@@ -761,6 +1014,7 @@ CBMPImageFile::Parse() {
     if (m_pBitMapHeader->imageHeightInPixels < 0) {
         m_fRowsAreUpsideDown = true;
         m_pBitMapHeader->imageHeightInPixels = -(m_pBitMapHeader->imageHeightInPixels);
+        m_fBufferMatchesFile = false;
     }
 
     // Pixels are packed in rows. Rows are then stored sequentially.
@@ -785,6 +1039,7 @@ CBMPImageFile::Parse() {
         && ((((char *) m_pColorTable) + m_BytesInColorTable) > m_pPixelTable)) {
         gotoErr(EFail);
     }
+    BuildColorIndexMap();
 
     m_BytesToReadPerPixel = m_pBitMapHeader->bitsPerPixel / 8;
     // Round up, since part of a byte will still need a full byte.
@@ -792,6 +1047,12 @@ CBMPImageFile::Parse() {
         m_BytesToReadPerPixel += 1;
     }
 
+    // Now that we know the bit depth, pick the code that reads and writes pixels.
+    err = SelectPixelKernels();
+    if (err) {
+        gotoErr(err);
+    }
+
 abort:
     returnErr(err);
 } // Parse
@@ -844,6 +1105,9 @@ CBMPImageFile::GetBitMap(char **ppBitMap, int32 *pBitmapLength) {
     }
 
     if (ppBitMap) {
+        // The caller may write through this pointer.
+        m_fBufferMatchesFile = false;
+        m_ChangeNumber += 1;
         *ppBitMap = m_pBuffer;
     }
     if (pBitmapLength) {
@@ -876,13 +1140,6 @@ abort:
 ErrVal
 CBMPImageFile::GetPixel(int32 xPos, int32 yPos, uint32 *pResult) {
     ErrVal err = ENoErr;
-    uchar *pPixelRow;
-    uchar *pPixelBytes;
-    int32 firstBitNumber;
-    int32 firstByteNumber;
-    uint32 tempPixel;
-    uchar byteValue;
-    int32 byteNum;
 
     if (NULL == pResult) {
         gotoErr(EFail);
@@ -892,93 +1149,18 @@ CBMPImageFile::GetPixel(int32 xPos, int32 yPos, uint32 *pResult) {
     // Validate the parameters.
     if ((xPos < 0) 
         || (yPos < 0)
-        || (xPos > m_pBitMapHeader->imageWidthInPixels)
-        || (yPos > m_pBitMapHeader->imageHeightInPixels)) {
+        || (xPos >= m_pBitMapHeader->imageWidthInPixels)
+        || (yPos >= m_pBitMapHeader->imageHeightInPixels)) {
         gotoErr(EFail);
     }
 
-    // By default, pixel rows are stored so row (Height-1) comes first
-    // in the Pixel array, and row 0 comes last.
-    pPixelRow = (uchar *) m_pPixelTable + m_BytesInPixelArray;
-    pPixelRow = pPixelRow - ((yPos + 1) * m_BytesPerRowInPixelTable);
-    // Optionally, BMP-files can arrange rows in the opposite order.
-    if (m_fRowsAreUpsideDown) {
-        pPixelRow = (uchar *) m_pPixelTable + (yPos * m_BytesPerRowInPixelTable);
-    }
-
-    // Pixels are arranged in a row from left to right.
-    firstBitNumber = xPos * m_pBitMapHeader->bitsPerPixel;
-    firstByteNumber = firstBitNumber / 8;
-    pPixelBytes = pPixelRow + firstByteNumber;
-
-    // Read each byte in the word.
-    tempPixel = 0;
-    for (byteNum = 0; byteNum < m_BytesToReadPerPixel; byteNum++) {
-        uint32 byteInShiftedPosition;
-
-        // Shift up any bits we collected from the previous loop iterations.
-#if !LITTLE_ENDIAN_NUMBERS
-        tempPixel = tempPixel << 8;
-#endif
-
-        // Get the next byte of data.
-        byteValue = *pPixelBytes;
-        pPixelBytes += 1;
-
-        byteInShiftedPosition = (uint32) byteValue;
-
-        // The values are stored in Little-Endian order. This means the first
-        // byte address in memory will hold the least significant byte.
-        // Each subsequent byte we read as we go from lower to higher
-        // memory addresses is a more significant byte.
-#if LITTLE_ENDIAN_NUMBERS
-        for (int32 index = 0; index < byteNum; index++) {
-            byteInShiftedPosition = byteInShiftedPosition << 8;
-        }
-#endif // LITTLE_ENDIAN_NUMBERS
-
-        // Add it into the total we are accumulating.
-        tempPixel = tempPixel | byteInShiftedPosition;
-    }
-
-    // If the pixel is less than a complete byte, then we have to throw out
-    // any extra data we collected.
-    if (m_pBitMapHeader->bitsPerPixel < 8) {
-        ASSERT_UNTESTED();
-        
-        int32 numPixelsPerByte = 8 / m_pBitMapHeader->bitsPerPixel;
-        int32 firstPixelRead = firstByteNumber * numPixelsPerByte;
-        int32 lastPixelRead = firstPixelRead + (numPixelsPerByte - 1);
+    *pResult = m_pDecodePixel(GetPixelRow(yPos), xPos);
 
-        //int32 numExtraPixelsLeftOfTarget = xPos - firstPixelRead;
-        int32 numExtraPixelsRightOfTarget = lastPixelRead - xPos;
-
-        // Discard pixels after the one we want.
-        for (int32 pixelNum = 0; pixelNum < numExtraPixelsRightOfTarget; pixelNum++) {
-            tempPixel = tempPixel >> m_pBitMapHeader->bitsPerPixel;
-        }
-
-        // Discard any pixels before the ones we one.
-        tempPixel = tempPixel & m_MaskPreservingLowerBits[m_pBitMapHeader->bitsPerPixel];
-    } // if (m_pBitMapHeader->bitsPerPixel < 8)
-
-
-    // If there is a color table, then the pixel is actually just an index into that 
+    // If there is a color table, then the pixel is actually just an index into that
     // table.
     if (m_pColorTable) {
-        uint32 colorNumber = tempPixel;
-        uint32 colorTableValue;
-
-        // colorNumber is a uint, so it cannot be negative.
-        if (colorNumber < m_NumColorsInColorTable) {
-            // Each entry in the table is usually 4 bytes, with the format: "blue, green, red, 0x00"
-            // But, in Intel Format (which is little endian) reverse the bytes.
-            colorTableValue = m_pColorTable[colorNumber];
-            tempPixel = colorTableValue & 0x00FFFFFF;
-        }
-    } // if (m_pColorTable)
-
-    *pResult = tempPixel;
+        *pResult = TranslateColorIndex(*pResult);
+    }
 
 abort:
     returnErr(err);
@@ -1002,62 +1184,147 @@ abort:
 ErrVal
 CBMPImageFile::SetPixel(int32 xPos, int32 yPos, uint32 value) {
     ErrVal err = ENoErr;
-    uchar *pPixelRow;
-    uchar *pPixelBytes;
-    int32 firstBitNumber;
-    int32 firstByteNumber;
-    uint32 tempPixel;
-    int32 byteNum;
 
     // Validate the parameters.
     if ((xPos < 0) 
         || (yPos < 0)
-        || (xPos > m_pBitMapHeader->imageWidthInPixels)
-        || (yPos > m_pBitMapHeader->imageHeightInPixels)) {
+        || (xPos >= m_pBitMapHeader->imageWidthInPixels)
+        || (yPos >= m_pBitMapHeader->imageHeightInPixels)) {
         gotoErr(EFail);
     }
+    m_fBufferMatchesFile = false;
+    m_ChangeNumber += 1;
 
-    // If there is a color table, then the pixel we will store is actually 
-    // just an index into that table. Find the color that corresponds
-    // to what we want to store.
+    // If there is a color table, then the pixel we will store is actually
+    // just an index into that table.
     if (m_pColorTable) {
-        uint32 colorNum;
-        uint32 colorTableValue;
+        value = GetColorTableIndex(value);
+    }
 
-        for (colorNum = 0; colorNum < m_NumColorsInColorTable; colorNum++) {
-            // Each entry in the color table is 4 bytes (in typical file formats)
-            colorTableValue = m_pColorTable[colorNum];
+    m_pEncodePixel(GetPixelRow(yPos), xPos, value);
 
-            // Each entry in the table is usually 4 bytes, with the format: "blue, green, red, 0x00"
-            // But, in Intel Format (which is little endian) reverse the bytes.
-            colorTableValue = colorTableValue & 0x00FFFFFF;
+abort:
+    returnErr(err);
+} // SetPixel
 
-            if (colorTableValue == value) {
-                value = colorNum;
-                break;
-            }
-        }
 
-        // If this is an invalid color, then define it.
-        // A typical color table will be gray scale, which is a bit inconvenient.
-        // So, just STEP on a color in the middle.
-        // Overwrite colors in the middle, since the extremes tend to be black and
-        // white, and we need those.
-        if (colorNum >= m_NumColorsInColorTable) {
-            if (m_NumColorTableEntriesWritten < MAX_OVERWRITTEN_COLORS) {
-                colorNum = FIRST_OVERWRITTEN_COLOR + m_NumColorTableEntriesWritten;
-                m_NumColorTableEntriesWritten += 1;
-            
-                // Each entry in the table is usually 4 bytes, with the format: "blue, green, red, 0x00"
-                colorTableValue = value | 0xFF000000;
-
-                m_pColorTable[colorNum] = colorTableValue;
-                value = colorNum;
-            }
-        }
-    } // if (m_pColorTable)
 
 
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetRowPointer]
+//
+// This returns the raw bytes of one row, in the file's own pixel format.
+// The row is read-only; use WriteRow to change pixels, so a mapped file
+// knows it has been changed.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBMPImageFile::GetRowPointer(int32 yPos, const char **ppPixelRow, int32 *pBitsPerPixel) {
+    ErrVal err = ENoErr;
+
+    if (NULL == ppPixelRow) {
+        gotoErr(EFail);
+    }
+    *ppPixelRow = NULL;
+
+    if ((NULL == m_pBitMapHeader)
+            || (yPos < 0)
+            || (yPos >= m_pBitMapHeader->imageHeightInPixels)) {
+        gotoErr(EFail);
+    }
+
+    *ppPixelRow = (const char *) GetPixelRow(yPos);
+    if (pBitsPerPixel) {
+        *pBitsPerPixel = m_pBitMapHeader->bitsPerPixel;
+    }
+
+abort:
+    returnErr(err);
+} // GetRowPointer
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [ReadRow]
+//
+// Read numPixels pixels, starting at (startX, yPos), into pPixels. Each
+// pixel is returned exactly as GetPixel would return it.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBMPImageFile::ReadRow(int32 yPos, int32 startX, int32 numPixels, uint32 *pPixels) {
+    ErrVal err = ENoErr;
+
+    if ((NULL == pPixels)
+            || (NULL == m_pBitMapHeader)
+            || (yPos < 0)
+            || (yPos >= m_pBitMapHeader->imageHeightInPixels)
+            || (startX < 0)
+            || (numPixels < 0)
+            || ((startX + numPixels) > m_pBitMapHeader->imageWidthInPixels)) {
+        gotoErr(EFail);
+    }
+
+    (this->*m_pReadRow)(GetPixelRow(yPos), startX, numPixels, pPixels);
+
+abort:
+    returnErr(err);
+} // ReadRow
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [WriteRow]
+//
+// Write numPixels pixels from pPixels, starting at (startX, yPos). This
+// has the same effect as calling SetPixel on each of them.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBMPImageFile::WriteRow(int32 yPos, int32 startX, int32 numPixels, const uint32 *pPixels) {
+    ErrVal err = ENoErr;
+
+    if ((NULL == pPixels)
+            || (NULL == m_pBitMapHeader)
+            || (yPos < 0)
+            || (yPos >= m_pBitMapHeader->imageHeightInPixels)
+            || (startX < 0)
+            || (numPixels < 0)
+            || ((startX + numPixels) > m_pBitMapHeader->imageWidthInPixels)) {
+        gotoErr(EFail);
+    }
+    m_fBufferMatchesFile = false;
+    m_ChangeNumber += 1;
+
+    (this->*m_pWriteRow)(GetPixelRow(yPos), startX, numPixels, pPixels);
+
+abort:
+    returnErr(err);
+} // WriteRow
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetPixelRow]
+//
+// The caller has already checked that yPos is a valid row.
+/////////////////////////////////////////////////////////////////////////////
+uchar *
+CBMPImageFile::GetPixelRow(int32 yPos) {
+    uchar *pPixelRow;
+
     // By default, pixel rows are stored so row (Height-1) comes first
     // in the Pixel array, and row 0 comes last.
     pPixelRow = (uchar *) m_pPixelTable + m_BytesInPixelArray;
@@ -1067,91 +1334,405 @@ CBMPImageFile::SetPixel(int32 xPos, int32 yPos, uint32 value) {
         pPixelRow = (uchar *) m_pPixelTable + (yPos * m_BytesPerRowInPixelTable);
     }
 
-    // Pixels are arranged in a row from left to right.
-    firstBitNumber = xPos * m_pBitMapHeader->bitsPerPixel;
-    firstByteNumber = firstBitNumber / 8;
-    pPixelBytes = pPixelRow + firstByteNumber;
+    return(pPixelRow);
+} // GetPixelRow
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Pixel Kernels
+//
+// There is one decoder and one encoder for each bit depth. Parse() picks
+// the ones that match the file, so reading or writing a pixel never has to
+// loop over bytes or check the bit depth again.
+//
+// Pixels are little-endian, so the first byte in memory is the least
+// significant byte. For 1, 2 and 4 bits per pixel, several pixels share
+// a byte, and the leftmost pixel is in the most significant bits.
+// If there is a color table, then these read and write the index into
+// the table, not the color.
+/////////////////////////////////////////////////////////////////////////////
+template <int32 BITS_PER_PIXEL>
+static inline uint32
+DecodePixel(const uchar *pPixelRow, int32 xPos) {
+    int32 firstBitNumber = xPos * BITS_PER_PIXEL;
+    uint32 byteValue = pPixelRow[firstBitNumber >> 3];
+    int32 shift = 8 - BITS_PER_PIXEL - (firstBitNumber & 7);
 
-    tempPixel = value;
-#if !LITTLE_ENDIAN_NUMBERS
-    // Shift all of the pixel data so it is left-aligned.
-    for (byteNum = m_BytesToReadPerPixel; byteNum < 4; byteNum++) {
-        tempPixel = tempPixel << 8;
+    return((byteValue >> shift) & ((1 << BITS_PER_PIXEL) - 1));
+} // DecodePixel
+
+template <>
+inline uint32
+DecodePixel<8>(const uchar *pPixelRow, int32 xPos) {
+    return(pPixelRow[xPos]);
+} // DecodePixel<8>
+
+template <>
+inline uint32
+DecodePixel<16>(const uchar *pPixelRow, int32 xPos) {
+    const uchar *pPixelBytes = pPixelRow + (xPos * 2);
+
+    return(((uint32) pPixelBytes[0]) | (((uint32) pPixelBytes[1]) << 8));
+} // DecodePixel<16>
+
+template <>
+inline uint32
+DecodePixel<24>(const uchar *pPixelRow, int32 xPos) {
+    const uchar *pPixelBytes = pPixelRow + (xPos * 3);
+
+    return(((uint32) pPixelBytes[0])
+            | (((uint32) pPixelBytes[1]) << 8)
+            | (((uint32) pPixelBytes[2]) << 16));
+} // DecodePixel<24>
+
+template <>
+inline uint32
+DecodePixel<32>(const uchar *pPixelRow, int32 xPos) {
+    const uchar *pPixelBytes = pPixelRow + (xPos * 4);
+
+    return(((uint32) pPixelBytes[0])
+            | (((uint32) pPixelBytes[1]) << 8)
+            | (((uint32) pPixelBytes[2]) << 16)
+            | (((uint32) pPixelBytes[3]) << 24));
+} // DecodePixel<32>
+
+
+
+template <int32 BITS_PER_PIXEL>
+static inline void
+EncodePixel(uchar *pPixelRow, int32 xPos, uint32 value) {
+    int32 firstBitNumber = xPos * BITS_PER_PIXEL;
+    uchar *pPixelByte = pPixelRow + (firstBitNumber >> 3);
+    int32 shift = 8 - BITS_PER_PIXEL - (firstBitNumber & 7);
+    uint32 mask = ((1 << BITS_PER_PIXEL) - 1) << shift;
+
+    // Only replace the bits of this pixel, and leave its neighbors alone.
+    *pPixelByte = (uchar) ((*pPixelByte & ~mask) | ((value << shift) & mask));
+} // EncodePixel
+
+template <>
+inline void
+EncodePixel<8>(uchar *pPixelRow, int32 xPos, uint32 value) {
+    pPixelRow[xPos] = (uchar) value;
+} // EncodePixel<8>
+
+template <>
+inline void
+EncodePixel<16>(uchar *pPixelRow, int32 xPos, uint32 value) {
+    uchar *pPixelBytes = pPixelRow + (xPos * 2);
+
+    pPixelBytes[0] = (uchar) value;
+    pPixelBytes[1] = (uchar) (value >> 8);
+} // EncodePixel<16>
+
+template <>
+inline void
+EncodePixel<24>(uchar *pPixelRow, int32 xPos, uint32 value) {
+    uchar *pPixelBytes = pPixelRow + (xPos * 3);
+
+    pPixelBytes[0] = (uchar) value;
+    pPixelBytes[1] = (uchar) (value >> 8);
+    pPixelBytes[2] = (uchar) (value >> 16);
+} // EncodePixel<24>
+
+template <>
+inline void
+EncodePixel<32>(uchar *pPixelRow, int32 xPos, uint32 value) {
+    uchar *pPixelBytes = pPixelRow + (xPos * 4);
+
+    pPixelBytes[0] = (uchar) value;
+    pPixelBytes[1] = (uchar) (value >> 8);
+    pPixelBytes[2] = (uchar) (value >> 16);
+    pPixelBytes[3] = (uchar) (value >> 24);
+} // EncodePixel<32>
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [ReadRowKernel]
+//
+// The bit depth and the color table are both compile-time constants,
+// so the compiler can inline the decoder and drop the unused branch.
+/////////////////////////////////////////////////////////////////////////////
+template <int32 BITS_PER_PIXEL, bool HAS_COLOR_TABLE>
+void
+CBMPImageFile::ReadRowKernel(const uchar *pPixelRow, int32 startX, int32 numPixels, uint32 *pPixels) {
+    int32 x;
+    int32 stopX;
+    uint32 value;
+
+    stopX = startX + numPixels;
+    for (x = startX; x < stopX; x++) {
+        value = DecodePixel<BITS_PER_PIXEL>(pPixelRow, x);
+        if (HAS_COLOR_TABLE) {
+            value = TranslateColorIndex(value);
+        }
+        *(pPixels++) = value;
     }
-#endif
+} // ReadRowKernel
+
 
-    // If the pixel is less than a complete byte, then we have to throw out
-    // any extra data we collected.
-    if (m_pBitMapHeader->bitsPerPixel < 8) {
-        ASSERT_UNTESTED();
 
-        int32 numPixelsPerByte = 8 / m_pBitMapHeader->bitsPerPixel;
 
-        int32 firstPixelRead = firstByteNumber * numPixelsPerByte;
-        int32 lastPixelRead = firstPixelRead + (numPixelsPerByte - 1);
 
-        int32 numExtraPixelsLeftOfTarget = xPos - firstPixelRead;
-        int32 numExtraPixelsRightOfTarget = lastPixelRead - xPos;
 
-        uint8 numBitsLeftOfTarget = numExtraPixelsLeftOfTarget * m_pBitMapHeader->bitsPerPixel;
-        uint8 numBitsRightOfTarget = numExtraPixelsRightOfTarget * m_pBitMapHeader->bitsPerPixel;
+/////////////////////////////////////////////////////////////////////////////
+//
+// [WriteRowKernel]
+//
+/////////////////////////////////////////////////////////////////////////////
+template <int32 BITS_PER_PIXEL, bool HAS_COLOR_TABLE>
+void
+CBMPImageFile::WriteRowKernel(uchar *pPixelRow, int32 startX, int32 numPixels, const uint32 *pPixels) {
+    int32 x;
+    int32 stopX;
+    uint32 value;
+    uint32 lastValue = 0;
+    uint32 lastColorIndex = 0;
+    bool fHaveLastValue = false;
+
+    stopX = startX + numPixels;
+    for (x = startX; x < stopX; x++) {
+        value = *(pPixels++);
+
+        // Rows tend to have long runs of the same color, so only search
+        // the color table when the color changes.
+        if (HAS_COLOR_TABLE) {
+            if ((!fHaveLastValue) || (value != lastValue)) {
+                lastValue = value;
+                lastColorIndex = GetColorTableIndex(value);
+                fHaveLastValue = true;
+            }
+            value = lastColorIndex;
+        }
 
-        uint8 leftPixelsMask = (1 << numBitsLeftOfTarget) - 1;
-        leftPixelsMask = leftPixelsMask << (numBitsRightOfTarget + m_pBitMapHeader->bitsPerPixel);
+        EncodePixel<BITS_PER_PIXEL>(pPixelRow, x, value);
+    }
+} // WriteRowKernel
 
-        uint8 rightPixelsMask = (1 << numBitsRightOfTarget) - 1;
 
-        // We will trim both down. First, read the complete byte.
-        uint8 extraPixelsToLeft = *pPixelBytes;
-        extraPixelsToLeft = extraPixelsToLeft & leftPixelsMask;
 
-        uint8 extraPixelsToRight = *pPixelBytes;
-        extraPixelsToRight = extraPixelsToRight & rightPixelsMask;
-        
-        uchar byteToWrite = *pPixelBytes;
-        // Discard the stuff to the left and the right.
-        byteToWrite = byteToWrite & ~(leftPixelsMask);
-        byteToWrite = byteToWrite & ~(rightPixelsMask);
-    
-        // Combine all of the values that we *DO* want.
-        byteToWrite = extraPixelsToLeft | byteToWrite | extraPixelsToRight;
 
-        // Now, put the assembled byte in the pixel code that is read byte-at-a-time
-        tempPixel = byteToWrite;
-    } // if (m_pBitMapHeader->bitsPerPixel < 8)
 
 
-    // Copy each byte of the pixel value into the memory array.
-    // This uses little-endian order - so the lowest memory address is the least
-    // significant byte in the value.
-    for (byteNum = 0; byteNum < m_BytesToReadPerPixel; byteNum++) {
-        uint32 byteToWriteInInt32;
-        uchar byteToWrite;
+/////////////////////////////////////////////////////////////////////////////
+//
+// [SelectKernelsForDepth]
+//
+/////////////////////////////////////////////////////////////////////////////
+template <int32 BITS_PER_PIXEL>
+void
+CBMPImageFile::SelectKernelsForDepth() {
+    m_pDecodePixel = DecodePixel<BITS_PER_PIXEL>;
+    m_pEncodePixel = EncodePixel<BITS_PER_PIXEL>;
+    if (m_pColorTable) {
+        m_pReadRow = &CBMPImageFile::ReadRowKernel<BITS_PER_PIXEL, true>;
+        m_pWriteRow = &CBMPImageFile::WriteRowKernel<BITS_PER_PIXEL, true>;
+    } else {
+        m_pReadRow = &CBMPImageFile::ReadRowKernel<BITS_PER_PIXEL, false>;
+        m_pWriteRow = &CBMPImageFile::WriteRowKernel<BITS_PER_PIXEL, false>;
+    }
+} // SelectKernelsForDepth
 
-        // Get the least significant byte.
-#if LITTLE_ENDIAN_NUMBERS
-        byteToWriteInInt32 = tempPixel & 0x000000FF;
-#else
-        byteToWriteInInt32 = tempPixel >> 24;
-#endif
-        byteToWrite = (uchar) byteToWriteInInt32;
 
-        *pPixelBytes = byteToWrite;
-        pPixelBytes += 1;
 
-        // Shift so the next byte to write will be in the least significant position.
-        // This uses little-endian order - so the lowest memory address is the least
-        // significant byte in the value.
-#if LITTLE_ENDIAN_NUMBERS
-        tempPixel = tempPixel >> 8;
-#else
-        tempPixel = tempPixel << 8;
-#endif
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [SelectPixelKernels]
+//
+// This is called whenever the bit depth or color table may have changed.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CBMPImageFile::SelectPixelKernels() {
+    ErrVal err = ENoErr;
+
+    // This is called whenever a new image is loaded.
+    m_ChangeNumber += 1;
+
+    m_pDecodePixel = NULL;
+    m_pEncodePixel = NULL;
+    m_pReadRow = NULL;
+    m_pWriteRow = NULL;
+
+    if (NULL == m_pBitMapHeader) {
+        gotoErr(EFail);
+    }
+
+    switch (m_pBitMapHeader->bitsPerPixel) {
+    case 1:
+        SelectKernelsForDepth<1>();
+        break;
+    case 2:
+        SelectKernelsForDepth<2>();
+        break;
+    case 4:
+        SelectKernelsForDepth<4>();
+        break;
+    case 8:
+        SelectKernelsForDepth<8>();
+        break;
+    case 16:
+        SelectKernelsForDepth<16>();
+        break;
+    case 24:
+        SelectKernelsForDepth<24>();
+        break;
+    case 32:
+        SelectKernelsForDepth<32>();
+        break;
+    default:
+        gotoErr(EFail);
     }
 
 abort:
     returnErr(err);
-} // SetPixel
+} // SelectPixelKernels
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetColorTableIndex]
+//
+// Find the color table entry that corresponds to a pixel value.
+/////////////////////////////////////////////////////////////////////////////
+uint32
+CBMPImageFile::GetColorTableIndex(uint32 value) {
+    uint32 colorNum;
+    uint32 colorTableValue;
+    int32 colorIndex;
+
+    if (m_fUseColorIndexMap) {
+        colorIndex = LookupColorIndex(value);
+        if (colorIndex >= 0) {
+            return((uint32) colorIndex);
+        }
+    } else {
+        for (colorNum = 0; colorNum < m_NumColorsInColorTable; colorNum++) {
+            // Each entry in the table is usually 4 bytes, with the format: "blue, green, red, 0x00"
+            // But, in Intel Format (which is little endian) reverse the bytes.
+            colorTableValue = m_pColorTable[colorNum] & 0x00FFFFFF;
+            if (colorTableValue == value) {
+                return(colorNum);
+            }
+        }
+    }
+
+    // If this is an invalid color, then define it.
+    // A typical color table will be gray scale, which is a bit inconvenient.
+    // So, just STEP on a color in the middle.
+    // Overwrite colors in the middle, since the extremes tend to be black and
+    // white, and we need those. Small tables, like 1 or 4 bits per pixel, do
+    // not have a middle that far out, so they are left alone.
+    colorNum = FIRST_OVERWRITTEN_COLOR + m_NumColorTableEntriesWritten;
+    if ((m_NumColorTableEntriesWritten < MAX_OVERWRITTEN_COLORS)
+            && (colorNum < m_NumColorsInColorTable)) {
+        m_NumColorTableEntriesWritten += 1;
+
+        // Each entry in the table is usually 4 bytes, with the format: "blue, green, red, 0x00"
+        colorTableValue = value | 0xFF000000;
+
+        m_pColorTable[colorNum] = colorTableValue;
+        value = colorNum;
+
+        // The entry we stepped on may have been the first one with its old
+        // color, so the map has to be rebuilt. This happens at most
+        // MAX_OVERWRITTEN_COLORS times.
+        if (m_fUseColorIndexMap) {
+            BuildColorIndexMap();
+        }
+    }
+
+    return(value);
+} // GetColorTableIndex
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [BuildColorIndexMap]
+//
+// Fill in the map from each color to its index in the color table.
+// If a color appears more than once, then the map holds the lowest index,
+// which is the same one a linear search would find.
+/////////////////////////////////////////////////////////////////////////////
+void
+CBMPImageFile::BuildColorIndexMap() {
+    uint32 colorNum;
+    uint32 color;
+    uint32 slot;
+
+    m_fUseColorIndexMap = false;
+    if ((NULL == m_pColorTable) || (m_NumColorsInColorTable > MAX_INDEXED_COLORS)) {
+        return;
+    }
+
+    for (slot = 0; slot < COLOR_INDEX_MAP_SIZE; slot++) {
+        m_ColorIndexMap[slot].colorIndex = -1;
+    }
+
+    for (colorNum = 0; colorNum < m_NumColorsInColorTable; colorNum++) {
+        color = m_pColorTable[colorNum] & 0x00FFFFFF;
+
+        // Probe until we find either an empty slot or an earlier entry for
+        // the same color. The map is never more than half full.
+        slot = (color * 2654435761U) >> (32 - COLOR_INDEX_MAP_BITS);
+        while ((m_ColorIndexMap[slot].colorIndex >= 0)
+                && (m_ColorIndexMap[slot].color != color)) {
+            slot = (slot + 1) & (COLOR_INDEX_MAP_SIZE - 1);
+        }
+        if (m_ColorIndexMap[slot].colorIndex < 0) {
+            m_ColorIndexMap[slot].color = color;
+            m_ColorIndexMap[slot].colorIndex = (int32) colorNum;
+        }
+    }
+
+    m_fUseColorIndexMap = true;
+} // BuildColorIndexMap
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [LookupColorIndex]
+//
+// This returns -1 if the color is not in the color table.
+/////////////////////////////////////////////////////////////////////////////
+int32
+CBMPImageFile::LookupColorIndex(uint32 color) {
+    uint32 slot;
+
+    slot = (color * 2654435761U) >> (32 - COLOR_INDEX_MAP_BITS);
+    while (m_ColorIndexMap[slot].colorIndex >= 0) {
+        if (m_ColorIndexMap[slot].color == color) {
+            return(m_ColorIndexMap[slot].colorIndex);
+        }
+        slot = (slot + 1) & (COLOR_INDEX_MAP_SIZE - 1);
+    }
+
+    return(-1);
+} // LookupColorIndex
 
 
 
@@ -1187,6 +1768,8 @@ CBMPImageFile::CopyPixelRow(int32 srcX, int32 srcY, int32 destX, int32 destY, in
         || (numPixels >= m_pBitMapHeader->imageWidthInPixels)) {
         gotoErr(EFail);
     }
+    m_fBufferMatchesFile = false;
+    m_ChangeNumber += 1;
 
     // Clip the copy to the size of the image.
     if ((srcX + numPixels) >= m_pBitMapHeader->imageWidthInPixels) {
@@ -1252,6 +1835,8 @@ CBMPImageFile::CropImage(int32 newWidth, int32 newHeight) {
             || (newHeight >= m_pBitMapHeader->imageHeightInPixels)) {
         gotoErr(EFail);
     }
+    m_fBufferMatchesFile = false;
+    m_ChangeNumber += 1;
 
     // Pixels are packed in rows. Rows are then stored sequentially.
     // Each row is rounded up to a multiple of 4 bytes. This is the number of pixels.
@@ -1331,10 +1916,9 @@ ErrVal
 CBMPImageFile::InitializeFromSource(CImageFile *pSourceAPI, uint32 value) {
     ErrVal err = ENoErr;
     uchar *pPixelRow;
-    uchar *pDestPixel;
     uchar *pFirstPixelRow;
     int32 rowNum;
-    int32 byteNum;
+    int32 x;
     CBMPImageFile *pSource;
 
     if (NULL == pSourceAPI) {
@@ -1342,11 +1926,7 @@ CBMPImageFile::InitializeFromSource(CImageFile *pSourceAPI, uint32 value) {
     }
     pSource = (CBMPImageFile *) pSourceAPI;
 
-
-    memFree(m_pBuffer);
-    m_pBuffer = NULL;
-    m_FileLength = 0;
-
+    FreeBuffer();
 
     m_FileLength = pSource->m_FileLength;
     m_pBuffer = (char *) memAlloc((int32) (m_FileLength));
@@ -1379,42 +1959,13 @@ CBMPImageFile::InitializeFromSource(CImageFile *pSourceAPI, uint32 value) {
     // just an index into that table. Find the color that corresponds
     // to what we want to store.
     if (m_pColorTable) {
-        uint32 colorNum;
-
-        for (colorNum = 0; colorNum < m_NumColorsInColorTable; colorNum++) {
-            if (m_pColorTable[colorNum] == value) {
-                value = colorNum;
-                break;
-            }
-        }
-
-        // If this is an invalid color, then define it.
-        // A typical color table will be gray scale, which is a bit inconvenient.
-        // So, just STEP on a color in the middle.
-        // Overwrite colors in the middle, since the extremes tend to be black and
-        // white, and we need those.
-        if (colorNum >= m_NumColorsInColorTable) {
-            if (m_NumColorTableEntriesWritten < MAX_OVERWRITTEN_COLORS) {
-                int32 colorTableValue;
-
-                colorNum = FIRST_OVERWRITTEN_COLOR + m_NumColorTableEntriesWritten;
-                m_NumColorTableEntriesWritten += 1;
-            
-                // Each entry in the table is usually 4 bytes, with the format: "blue, green, red, 0x00"
-                colorTableValue = value | 0xFF000000;
-
-                m_pColorTable[colorNum] = colorTableValue;
-                value = colorNum;
-            }
-        }
-    } // if (m_pColorTable)
+        value = GetColorTableIndex(value);
+    }
 
-    // Fill out the first row. This may be a bit slow.
+    // Fill out the first row.
     pFirstPixelRow = (uchar *) m_pPixelTable;
-    pDestPixel = pFirstPixelRow;
-    for (byteNum = 0; byteNum < m_BytesPerRowInPixelTable; byteNum++) {
-        *pDestPixel = value;
-        pDestPixel += 1;
+    for (x = 0; x < m_pBitMapHeader->imageWidthInPixels; x++) {
+        m_pEncodePixel(pFirstPixelRow, x, value);
     }
 
     // Make every subsequent row a copy of the first.
@@ -0,0 +1,512 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2010-2018 Dawson Dean
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Connected Components
+// ====================
+//
+// This groups the edge pixels of an image into 8-connected components.
+// It makes two passes over the edge mask, and each pass is split into
+// horizontal bands that run in parallel.
+//
+// The first pass gives each edge pixel a provisional label. A pixel only
+// looks at its neighbors that were already visited, which are the one to
+// the west and the three in the row above. If none of those are edges,
+// then the pixel starts a new provisional label. If it touches more than
+// one label, then those labels are joined with a union-find table. Each
+// band has its own range of labels, so the bands never write the same
+// part of the table. After all bands finish, the pixels along each border
+// between two bands are joined with the row above them.
+//
+// The second pass replaces each provisional label with the final label
+// of its set. Then, the size and bounding box of each component are
+// collected.
+//
+// The union-find table always links the larger root to the smaller one,
+// and the labels of later bands are always larger, so the root of a set
+// is its first label in raster order. That means the final labels are
+// numbered in the raster order of the first pixel of each component, no
+// matter how many bands there are or how the threads are scheduled.
+/////////////////////////////////////////////////////////////////////////////
+
+#if WASM
+#include "portableBuildingBlocks.h"
+#else
+#include "buildingBlocks.h"
+#endif
+
+#include "imageLib.h"
+#include "imageLibInternal.h"
+
+FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
+
+// Small images are not worth the cost of starting a thread.
+#define COMPONENT_LABELING_MIN_ROWS_PER_BAND    64
+
+// This is the state shared by all bands of one labeling.
+class CComponentLabelingPass {
+public:
+    CEdgeComponentTable     *m_pTable;
+    CEdgeDetectionTable     *m_pEdgeTable;
+    int32                   m_NumBands;
+
+    // The union-find table of the provisional labels. Band n may use
+    // labels m_FirstLabel[n] and up, and it records how many it used.
+    int32                   *m_pParentList;
+    int32                   m_FirstLabel[MAX_ROW_BANDS];
+    int32                   m_NumLabels[MAX_ROW_BANDS];
+}; // CComponentLabelingPass
+
+static inline bool IsEdgeInMaskRow(const uint32 *pMaskRow, int32 x);
+static inline int32 FindLabelRoot(int32 *pParentList, int32 label);
+static inline void JoinLabels(int32 *pParentList, int32 labelA, int32 labelB);
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [CEdgeComponentTable]
+//
+/////////////////////////////////////////////////////////////////////////////
+CEdgeComponentTable::CEdgeComponentTable() {
+    m_MaxXPos = 0;
+    m_MaxYPos = 0;
+    m_pLabelPlane = NULL;
+    m_NumComponents = 0;
+    m_pComponentList = NULL;
+} // CEdgeComponentTable
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////
+CEdgeComponentTable::~CEdgeComponentTable() {
+    memFree(m_pLabelPlane);
+    memFree(m_pComponentList);
+} // ~CEdgeComponentTable
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Initialize]
+//
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CEdgeComponentTable::Initialize(CEdgeDetectionTable *pEdgeTable) {
+    ErrVal err = ENoErr;
+    CComponentLabelingPass pass;
+    int32 numProvisionalLabels;
+    int32 maxLabelsInBand;
+    int32 bandNum;
+    int32 startRow;
+    int32 stopRow;
+    int32 label;
+    int32 stopLabel;
+    int32 *pLabelRow;
+    int32 *pAboveLabelRow;
+    CEdgeComponent *pComponent;
+    int32 x;
+    int32 y;
+
+    pass.m_pParentList = NULL;
+
+    if (NULL == pEdgeTable) {
+        gotoErr(EFail);
+    }
+
+    memFree(m_pLabelPlane);
+    m_pLabelPlane = NULL;
+    memFree(m_pComponentList);
+    m_pComponentList = NULL;
+    m_NumComponents = 0;
+
+    m_MaxXPos = pEdgeTable->m_MaxXPos;
+    m_MaxYPos = pEdgeTable->m_MaxYPos;
+    if ((m_MaxXPos <= 0) || (m_MaxYPos <= 0)) {
+        gotoErr(ENoErr);
+    }
+
+    pass.m_pTable = this;
+    pass.m_pEdgeTable = pEdgeTable;
+    pass.m_NumBands = GetNumRowBands(m_MaxYPos, COMPONENT_LABELING_MIN_ROWS_PER_BAND);
+
+    // Each band has its own range of provisional labels, so the bands
+    // never touch the same entries of the parent list. Two pixels in the
+    // same 2x2 block can never both start a new label, because the later
+    // one always has the earlier one as a neighbor it already visited.
+    // Entry 0 of the parent list is unused.
+    numProvisionalLabels = 0;
+    for (bandNum = 0; bandNum < pass.m_NumBands; bandNum++) {
+        GetRowBandRange(m_MaxYPos, pass.m_NumBands, bandNum, &startRow, &stopRow);
+        maxLabelsInBand = ((m_MaxXPos + 1) / 2) * ((stopRow - startRow + 1) / 2);
+
+        pass.m_FirstLabel[bandNum] = numProvisionalLabels + 1;
+        pass.m_NumLabels[bandNum] = 0;
+        numProvisionalLabels += maxLabelsInBand;
+    }
+
+    m_pLabelPlane = (int32 *) memAlloc(sizeof(int32) * m_MaxXPos * m_MaxYPos);
+    pass.m_pParentList = (int32 *) memAlloc(sizeof(int32) * (numProvisionalLabels + 1));
+    if ((NULL == m_pLabelPlane) || (NULL == pass.m_pParentList)) {
+        gotoErr(EFail);
+    }
+
+    err = RunRowBands(m_MaxYPos, pass.m_NumBands, LabelBand, &pass);
+    if (err) {
+        gotoErr(err);
+    }
+
+
+    ///////////////////////////////////////
+    // Join the components that cross the border between two bands. A pixel
+    // in the first row of a band did not look at the row above it.
+    for (bandNum = 1; bandNum < pass.m_NumBands; bandNum++) {
+        GetRowBandRange(m_MaxYPos, pass.m_NumBands, bandNum, &startRow, &stopRow);
+        pLabelRow = m_pLabelPlane + (startRow * m_MaxXPos);
+        pAboveLabelRow = pLabelRow - m_MaxXPos;
+
+        for (x = 0; x < m_MaxXPos; x++) {
+            if (0 == pLabelRow[x]) {
+                continue;
+            }
+
+            if ((x > 0) && (pAboveLabelRow[x - 1])) {
+                JoinLabels(pass.m_pParentList, pLabelRow[x], pAboveLabelRow[x - 1]);
+            }
+            if (pAboveLabelRow[x]) {
+                JoinLabels(pass.m_pParentList, pLabelRow[x], pAboveLabelRow[x]);
+            }
+            if ((x < (m_MaxXPos - 1)) && (pAboveLabelRow[x + 1])) {
+                JoinLabels(pass.m_pParentList, pLabelRow[x], pAboveLabelRow[x + 1]);
+            }
+        } // for (x = 0; x < m_MaxXPos; x++)
+    } // for (bandNum = 1; bandNum < pass.m_NumBands; bandNum++)
+
+
+    ///////////////////////////////////////
+    // Number the sets. A label that is not a root always has a smaller
+    // parent, and that parent was already given its final label, so this
+    // can reuse the parent list to hold the final labels.
+    for (bandNum = 0; bandNum < pass.m_NumBands; bandNum++) {
+        stopLabel = pass.m_FirstLabel[bandNum] + pass.m_NumLabels[bandNum];
+        for (label = pass.m_FirstLabel[bandNum]; label < stopLabel; label++) {
+            if (pass.m_pParentList[label] == label) {
+                m_NumComponents += 1;
+                pass.m_pParentList[label] = m_NumComponents;
+            } else {
+                pass.m_pParentList[label] = pass.m_pParentList[pass.m_pParentList[label]];
+            }
+        }
+    }
+
+    err = RunRowBands(m_MaxYPos, pass.m_NumBands, RelabelBand, &pass);
+    if (err) {
+        gotoErr(err);
+    }
+
+
+    ///////////////////////////////////////
+    // Collect the stats of each component.
+    if (m_NumComponents > 0) {
+        m_pComponentList = (CEdgeComponent *) memAlloc(sizeof(CEdgeComponent) * m_NumComponents);
+        if (NULL == m_pComponentList) {
+            gotoErr(EFail);
+        }
+    }
+    for (label = 0; label < m_NumComponents; label++) {
+        pComponent = &(m_pComponentList[label]);
+        pComponent->m_NumPixels = 0;
+        pComponent->m_LeftX = m_MaxXPos;
+        pComponent->m_RightX = -1;
+        pComponent->m_TopY = m_MaxYPos;
+        pComponent->m_BottomY = -1;
+    }
+
+    for (y = 0; y < m_MaxYPos; y++) {
+        pLabelRow = m_pLabelPlane + (y * m_MaxXPos);
+        for (x = 0; x < m_MaxXPos; x++) {
+            if (0 == pLabelRow[x]) {
+                continue;
+            }
+
+            pComponent = &(m_pComponentList[pLabelRow[x] - 1]);
+            pComponent->m_NumPixels += 1;
+            if (x < pComponent->m_LeftX) {
+                pComponent->m_LeftX = x;
+            }
+            if (x > pComponent->m_RightX) {
+                pComponent->m_RightX = x;
+            }
+            if (y < pComponent->m_TopY) {
+                pComponent->m_TopY = y;
+            }
+            pComponent->m_BottomY = y;
+        } // for (x = 0; x < m_MaxXPos; x++)
+    } // for (y = 0; y < m_MaxYPos; y++)
+
+abort:
+    memFree(pass.m_pParentList);
+    returnErr(err);
+} // Initialize
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [LabelBand]
+//
+// Give every edge pixel in one band a provisional label.
+//
+// The neighbors in the row above are all next to each other, and the
+// west and north-west neighbors are next to each other, so any of them
+// that are edges were already joined when they were visited. So, if the
+// north pixel is an edge, it is the only label we need. Otherwise, only
+// the west (or north-west) and north-east labels may need to be joined.
+//
+// The first row of the band does not look at the row above it, which
+// belongs to another band. Initialize joins those afterward.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CEdgeComponentTable::LabelBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow) {
+    CComponentLabelingPass *pPass = (CComponentLabelingPass *) pContext;
+    CEdgeComponentTable *pTable = pPass->m_pTable;
+    CEdgeDetectionTable *pEdgeTable = pPass->m_pEdgeTable;
+    int32 *pParentList = pPass->m_pParentList;
+    int32 width = pTable->m_MaxXPos;
+    int32 nextLabel = pPass->m_FirstLabel[bandNum];
+    const uint32 *pMaskRow;
+    int32 *pLabelRow;
+    int32 *pAboveLabelRow;
+    int32 westLabel;
+    int32 northEastLabel;
+    int32 label;
+    int32 x;
+    int32 y;
+
+    pAboveLabelRow = NULL;
+    for (y = startRow; y < stopRow; y++) {
+        pMaskRow = pEdgeTable->m_pEdgeMask + (y * pEdgeTable->m_EdgeMaskWordsPerRow);
+        pLabelRow = pTable->m_pLabelPlane + (y * width);
+
+        for (x = 0; x < width; x++) {
+            if (!IsEdgeInMaskRow(pMaskRow, x)) {
+                pLabelRow[x] = 0;
+                continue;
+            }
+
+            if ((pAboveLabelRow) && (pAboveLabelRow[x])) {
+                pLabelRow[x] = pAboveLabelRow[x];
+                continue;
+            }
+
+            westLabel = 0;
+            if (x > 0) {
+                westLabel = pLabelRow[x - 1];
+                if ((0 == westLabel) && (pAboveLabelRow)) {
+                    westLabel = pAboveLabelRow[x - 1];
+                }
+            }
+            northEastLabel = 0;
+            if ((pAboveLabelRow) && (x < (width - 1))) {
+                northEastLabel = pAboveLabelRow[x + 1];
+            }
+
+            if ((westLabel) && (northEastLabel)) {
+                JoinLabels(pParentList, westLabel, northEastLabel);
+                label = westLabel;
+            } else if (westLabel) {
+                label = westLabel;
+            } else if (northEastLabel) {
+                label = northEastLabel;
+            } else {
+                label = nextLabel;
+                nextLabel += 1;
+                pParentList[label] = label;
+            }
+            pLabelRow[x] = label;
+        } // for (x = 0; x < width; x++)
+
+        pAboveLabelRow = pLabelRow;
+    } // for (y = startRow; y < stopRow; y++)
+
+    pPass->m_NumLabels[bandNum] = nextLabel - pPass->m_FirstLabel[bandNum];
+    return(ENoErr);
+} // LabelBand
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RelabelBand]
+//
+// Replace the provisional labels in one band with the final labels.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CEdgeComponentTable::RelabelBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow) {
+    CComponentLabelingPass *pPass = (CComponentLabelingPass *) pContext;
+    CEdgeComponentTable *pTable = pPass->m_pTable;
+    const int32 *pFinalLabelList = pPass->m_pParentList;
+    int32 *pLabel;
+    int32 *pStopLabel;
+    UNUSED_PARAM(bandNum);
+
+    pLabel = pTable->m_pLabelPlane + (startRow * pTable->m_MaxXPos);
+    pStopLabel = pTable->m_pLabelPlane + (stopRow * pTable->m_MaxXPos);
+    while (pLabel < pStopLabel) {
+        if (*pLabel) {
+            *pLabel = pFinalLabelList[*pLabel];
+        }
+        pLabel++;
+    }
+
+    return(ENoErr);
+} // RelabelBand
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetLabel]
+//
+// This returns 0 for a pixel that is not an edge, or is outside the image.
+/////////////////////////////////////////////////////////////////////////////
+int32
+CEdgeComponentTable::GetLabel(int32 x, int32 y) {
+    if ((NULL == m_pLabelPlane)
+            || (x < 0)
+            || (y < 0)
+            || (x >= m_MaxXPos)
+            || (y >= m_MaxYPos)) {
+        return(0);
+    }
+
+    return(m_pLabelPlane[(y * m_MaxXPos) + x]);
+} // GetLabel
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetComponent]
+//
+/////////////////////////////////////////////////////////////////////////////
+CEdgeComponent *
+CEdgeComponentTable::GetComponent(int32 label) {
+    if ((label < 1) || (label > m_NumComponents)) {
+        return(NULL);
+    }
+
+    return(&(m_pComponentList[label - 1]));
+} // GetComponent
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [CountEdgeNeighbors]
+//
+// Count how many of the 8 pixels around (x, y) are edges.
+/////////////////////////////////////////////////////////////////////////////
+int32
+CEdgeComponentTable::CountEdgeNeighbors(int32 x, int32 y) {
+    int32 numNeighbors = 0;
+    int32 neighborX;
+    int32 neighborY;
+
+    for (neighborY = y - 1; neighborY <= y + 1; neighborY++) {
+        for (neighborX = x - 1; neighborX <= x + 1; neighborX++) {
+            if (((neighborX != x) || (neighborY != y))
+                    && (GetLabel(neighborX, neighborY))) {
+                numNeighbors += 1;
+            }
+        }
+    }
+
+    return(numNeighbors);
+} // CountEdgeNeighbors
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// The edge flags are packed 32 to a word, starting with the low bit.
+/////////////////////////////////////////////////////////////////////////////
+static inline bool
+IsEdgeInMaskRow(const uint32 *pMaskRow, int32 x) {
+    return((pMaskRow[x >> 5] & (((uint32) 1) << (x & 31))) != 0);
+} // IsEdgeInMaskRow
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Find the root of a set, and halve the path to it along the way.
+/////////////////////////////////////////////////////////////////////////////
+static inline int32
+FindLabelRoot(int32 *pParentList, int32 label) {
+    while (pParentList[label] != label) {
+        pParentList[label] = pParentList[pParentList[label]];
+        label = pParentList[label];
+    }
+    return(label);
+} // FindLabelRoot
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Join two sets. The larger root always points to the smaller one.
+/////////////////////////////////////////////////////////////////////////////
+static inline void
+JoinLabels(int32 *pParentList, int32 labelA, int32 labelB) {
+    labelA = FindLabelRoot(pParentList, labelA);
+    labelB = FindLabelRoot(pParentList, labelB);
+    if (labelA < labelB) {
+        pParentList[labelB] = labelA;
+    } else if (labelB < labelA) {
+        pParentList[labelA] = labelB;
+    }
+} // JoinLabels
@@ -0,0 +1,233 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2010-2018 Dawson Dean
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Image Batches
+// =============
+//
+// This opens a list of image files, and runs the whole pipeline for each
+// one (load, edge detection, labeling, cross sections and redraw). Each
+// file is done on one thread, and several files are done at once.
+//
+// There is a fixed number of worker threads. Each one takes the next file
+// from the list, opens it, and hands the result to the callback before it
+// takes another file. So there are never more open images than workers,
+// unless the callback keeps them.
+//
+// The steps of each pipeline still split their rows into bands, so a
+// small number of workers is usually enough to keep every processor busy.
+//
+// The calling thread is one of the workers. If the system will not give
+// us more threads, then the workers we do have just take more files.
+// WASM builds do not have threads, so they open every file in order on the
+// calling thread.
+/////////////////////////////////////////////////////////////////////////////
+
+#if !WASM
+#include <thread>
+#include <atomic>
+#endif
+
+#if WASM
+#include "portableBuildingBlocks.h"
+#else
+#include "buildingBlocks.h"
+#endif
+
+#include "imageLib.h"
+#include "imageLibInternal.h"
+
+FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
+
+#define MAX_IMAGE_BATCH_WORKERS     32
+
+
+// This is the state shared by all workers of one batch.
+class CImageBatch {
+public:
+    const char          **m_pImageFileNameList;
+    int32               m_NumFiles;
+    int32               m_Options;
+    C2DImageBatchProc   m_pProc;
+    void                *m_pContext;
+
+#if WASM
+    int32               m_NextFileNum;
+    bool                m_fStop;
+#else
+    std::atomic<int32>  m_NextFileNum;
+    std::atomic<bool>   m_fStop;
+#endif
+}; // CImageBatch
+
+
+// This is one worker, and everything its thread needs.
+class CImageBatchWorker {
+public:
+    CImageBatch         *m_pBatch;
+    ErrVal              m_Err;
+}; // CImageBatchWorker
+
+static void RunImageBatchWorker(CImageBatchWorker *pWorker);
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Open2DImagesFromFiles]
+//
+// Open every file in the list, using numWorkers threads, and pass each
+// result to pProc. If numWorkers is 0, then there is one worker for each
+// processor. This returns the error from the lowest numbered worker whose
+// callback failed. Files that cannot be opened are passed to pProc with
+// their error, and they do not stop the batch.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+Open2DImagesFromFiles(
+                const char **pImageFileNameList,
+                int32 numFiles,
+                int32 numWorkers,
+                int32 options,
+                C2DImageBatchProc pProc,
+                void *pContext) {
+    ErrVal err = ENoErr;
+    CImageBatch batch;
+    CImageBatchWorker workerList[MAX_IMAGE_BATCH_WORKERS];
+#if !WASM
+    std::thread threadList[MAX_IMAGE_BATCH_WORKERS];
+#endif
+    int32 workerNum;
+
+    if ((NULL == pImageFileNameList) || (numFiles < 0) || (numWorkers < 0) || (NULL == pProc)) {
+        gotoErr(EFail);
+    }
+    if (0 == numFiles) {
+        gotoErr(ENoErr);
+    }
+
+    if (0 == numWorkers) {
+        numWorkers = 1;
+#if !WASM
+        numWorkers = (int32) std::thread::hardware_concurrency();
+#endif
+    }
+    if (numWorkers > MAX_IMAGE_BATCH_WORKERS) {
+        numWorkers = MAX_IMAGE_BATCH_WORKERS;
+    }
+    if (numWorkers > numFiles) {
+        numWorkers = numFiles;
+    }
+    if (numWorkers < 1) {
+        numWorkers = 1;
+    }
+
+    batch.m_pImageFileNameList = pImageFileNameList;
+    batch.m_NumFiles = numFiles;
+    batch.m_Options = options;
+    batch.m_pProc = pProc;
+    batch.m_pContext = pContext;
+    batch.m_NextFileNum = 0;
+    batch.m_fStop = false;
+
+    for (workerNum = 0; workerNum < numWorkers; workerNum++) {
+        workerList[workerNum].m_pBatch = &batch;
+        workerList[workerNum].m_Err = ENoErr;
+    }
+
+#if WASM
+    RunImageBatchWorker(&(workerList[0]));
+#else
+    // Start every worker except the first on a new thread. If the system
+    // will not give us another thread, then the other workers take its files.
+    for (workerNum = 1; workerNum < numWorkers; workerNum++) {
+        try {
+            threadList[workerNum] = std::thread(RunImageBatchWorker, &(workerList[workerNum]));
+        } catch (...) {
+        }
+    }
+
+    // The calling thread is the first worker.
+    RunImageBatchWorker(&(workerList[0]));
+
+    for (workerNum = 1; workerNum < numWorkers; workerNum++) {
+        if (threadList[workerNum].joinable()) {
+            threadList[workerNum].join();
+        }
+    }
+#endif
+
+    for (workerNum = 0; workerNum < numWorkers; workerNum++) {
+        if (workerList[workerNum].m_Err) {
+            gotoErr(workerList[workerNum].m_Err);
+        }
+    }
+
+abort:
+    returnErr(err);
+} // Open2DImagesFromFiles
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RunImageBatchWorker]
+//
+// Open files until there are none left, or until some callback fails.
+/////////////////////////////////////////////////////////////////////////////
+static void
+RunImageBatchWorker(CImageBatchWorker *pWorker) {
+    CImageBatch *pBatch = pWorker->m_pBatch;
+    C2DImage *pImage;
+    ErrVal openErr;
+    ErrVal err;
+    int32 fileNum;
+
+    while (!(pBatch->m_fStop)) {
+        fileNum = pBatch->m_NextFileNum++;
+        if (fileNum >= pBatch->m_NumFiles) {
+            break;
+        }
+
+        pImage = NULL;
+        openErr = Open2DImageFromFile(
+                        pBatch->m_pImageFileNameList[fileNum],
+                        pBatch->m_Options,
+                        NULL,
+                        &pImage);
+
+        // The callback owns the image now, even if it fails.
+        err = pBatch->m_pProc(pBatch->m_pContext, fileNum, openErr, pImage);
+        if (err) {
+            pWorker->m_Err = err;
+            pBatch->m_fStop = true;
+            break;
+        }
+    } // while (!(pBatch->m_fStop))
+} // RunImageBatchWorker
+
@@ -37,7 +37,6 @@
 FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
 
 #define HIGHLIGHT_PIXEL_VALUE   YELLOW_PIXEL
-#define BLOCKED_PIXEL_VALUE     RED_PIXEL
 
 // LIST_END_PIXEL marks the end of the list.
 static int32 g_ColoredShapeColorList[] = { BLUE_PIXEL, GREEN_PIXEL, PURPLE_PIXEL, YELLOW_PIXEL, ORANGE_PIXEL, BLUEGREEN_PIXEL, CAMAUGREEN_PIXEL, COLOR1_PIXEL, COLOR2_PIXEL, COLOR3_PIXEL, LIST_END_PIXEL };
@@ -55,29 +54,13 @@ static int32 g_GrayShapeColorList[] = { BLACK_PIXEL, LIST_END_PIXEL };
 #define MIN_PIXELS_IN_USEFUL_SHAPE                      30
 #define MAX_SLOPE_FOR_PATH_WALKING                      5.0
 
-static bool g_DrawStopPixels                    = false;
 static bool g_EraseBorderArtifacts              = false;
-static int32 g_BackGroundPixelColor             = BLACK_PIXEL;
-static int32 g_ShapeInteriorColor               = GREEN_PIXEL;
 
 
 
 ////////////////////////////////////////////////
-// This is the state of each pixel.
-class CPixelInfo {
-public:  
-    int32               m_Flags;
-    int32               m_X;
-    int32               m_Y;
-
-    CBioCADShape        *m_pShape;
-    //<>CMarkerPixelInfo    *m_pMarker;
-    //<>CBioCADSpine        *m_pEdge;
-
-    CPixelInfo          *m_pNextPixel;
-}; // CPixelInfo
-
-// These are values for CPixelInfo::m_Flags
+// These are the flags of each pixel. They are one byte per pixel, in
+// C2DImageImpl::m_pPixelFlagPlane.
 #define SHAPE_INTERIOR_PIXEL        0x0001
 #define SHAPE_EXTERIOR_PIXEL        0x0002
 #define SHAPE_BOUNDARY_PIXEL        0x0004
@@ -139,16 +122,13 @@ public:
                     CBioCADShape **ppResult);
 
 private:
-    virtual CPixelInfo *GetPixelState(int32 x, int32 y);
+    int32 GetPixelIndex(int32 x, int32 y);
+    uint8 *GetPixelState(int32 x, int32 y);
     int32 GetPixelFlags(int32 x, int32 y);
     void SetPixelFlag(int32 x, int32 y, int32 newFlag);
     void ClearPixelFlag(int32 x, int32 y, int32 newFlag);
-    
-    ErrVal FindEdgePointsOnSameShape(CBioCADShape *pShape);
-    int32 CheckPossibleAdjacentEdgePixel(
-                    CBioCADShape *pShape,  
-                    int32 x, 
-                    int32 y);
+    ErrVal SetPixelShape(int32 x, int32 y, CBioCADShape *pShape);
+    bool PixelIsOnShapeBoundary(CBioCADShape *pShape, int32 x, int32 y);
 
     void DrawEdges(int32 options);
     void DrawLine(
@@ -169,11 +149,12 @@ private:
                     CBioCADShape *pShape, 
                     int32 x, 
                     int32 y, 
-                    CPixelInfo *pPixelState);
+                    uint8 *pPixelState);
     void DeleteShape(CBioCADShape *pShape);
     
     ErrVal BuildCrossSections();
     ErrVal RedrawProcessedImage(int32 options);
+    ErrVal FillImage(CImageFile *pImage, uint32 color);
 
 
     char                *m_pImageFileName;
@@ -183,11 +164,30 @@ private:
     int32               m_ImageWidth;
     int32               m_ImageHeight;
 
+    // These are set by DrawFeatures.
+    int32               m_BackGroundPixelColor;
+    int32               m_ShapeInteriorColor;
+
+    // There is one flags byte for every pixel, stored a row at a time.
+    // The shape of a pixel is only needed when the border of a shape is
+    // extrapolated, so that plane is not allocated until it is first used.
+    // It holds the m_FeatureID of the shape, or 0 for no shape.
     int32               m_NumPixelsInImage;
-    CPixelInfo          *m_pPixelFlagsTable;
+    uint8               *m_pPixelFlagPlane;
+    int32               *m_pPixelShapeIDPlane;
 
     CBioCADShape        *m_pShapeList;
     CBioCADShape        *m_pInspectRegionList;
+
+    // This holds the points of every shape in the image, so they are all
+    // freed together when the image is deleted.
+    CBioCADArena        m_Arena;
+
+    // The shapes share this, so it is only built once for all of them.
+    CLuminanceTable     m_LuminanceTable;
+
+    // This finds the shapes in m_pShapeList by feature ID or by position.
+    CShapeIndex         m_ShapeIndex;
 }; // C2DImageImpl
 
 
@@ -221,8 +221,9 @@ Open2DImageFromFile(
         gotoErr(EFail);
     }
 
-    // Open the cell image file.
-    pImageSource = OpenBMPFile(pImageFileName);
+    // Open the cell image file. This maps the file, so we only pay for
+    // the pages we read, and the pages we draw on are copied on demand.
+    pImageSource = OpenMappedBMPFile(pImageFileName);
     if (NULL == pImageSource) {
         gotoErr(EFail);
     }
@@ -332,7 +333,11 @@ C2DImageImpl::C2DImageImpl() {
     m_pSourceFile = NULL;
     m_pEdgeDetectionTable = NULL;
 
-    m_pPixelFlagsTable = NULL;
+    m_pPixelFlagPlane = NULL;
+    m_pPixelShapeIDPlane = NULL;
+
+    m_BackGroundPixelColor = BLACK_PIXEL;
+    m_ShapeInteriorColor = GREEN_PIXEL;
 
     m_pShapeList = NULL;
     m_pInspectRegionList = NULL;
@@ -352,13 +357,15 @@ C2DImageImpl::C2DImageImpl() {
 /////////////////////////////////////////////////////////////////////////////
 C2DImageImpl::~C2DImageImpl() {
     memFree(m_pImageFileName);
-    memFree(m_pPixelFlagsTable);
+    memFree(m_pPixelFlagPlane);
+    memFree(m_pPixelShapeIDPlane);
 
     while (m_pShapeList) {
         CBioCADShape *pTargetShape = m_pShapeList;
         m_pShapeList = pTargetShape->m_pNextShape;
         delete pTargetShape;
     } // if (m_pShapeList)
+    m_ShapeIndex.Discard();
 
     while (m_pInspectRegionList) {
         CBioCADShape *pTargetShape = m_pInspectRegionList;
@@ -366,6 +373,9 @@ C2DImageImpl::~C2DImageImpl() {
         delete pTargetShape;
     } // if (m_pInspectRegionList)
 
+    // Do this after every shape that uses it is gone.
+    m_Arena.DiscardAll();
+
     if (m_pEdgeDetectionTable) {
         delete m_pEdgeDetectionTable;
     }
@@ -395,9 +405,11 @@ C2DImageImpl::Initialize(
     int32 edgeDetectionThreshold = EDGE_DETECTION_THRESHOLD;
     int32 x;
     int32 y;
-    CPixelInfo *pPixelInfo;
+    uint8 *pPixelFlags;
     CBioCADPoint *pPoint;
-    bool isEdge;
+    CEdgeComponentTable *pComponentTable = NULL;
+    CBioCADShape **pShapeForLabel = NULL;
+    int32 label;
     CBioCADShape *pShape = NULL;
 
 
@@ -420,6 +432,10 @@ C2DImageImpl::Initialize(
     if (err) {
         gotoErr(err);
     }
+    err = m_ShapeIndex.Initialize(m_ImageWidth, m_ImageHeight);
+    if (err) {
+        gotoErr(err);
+    }
 
     /////////////////////////////////////////
     // Some images may have an artifact of light along the edges.
@@ -433,8 +449,8 @@ C2DImageImpl::Initialize(
     }
 
     m_NumPixelsInImage = m_ImageWidth * m_ImageHeight;
-    m_pPixelFlagsTable = (CPixelInfo *) memCalloc(sizeof(CPixelInfo) * m_NumPixelsInImage);
-    if (NULL == m_pPixelFlagsTable) {
+    m_pPixelFlagPlane = (uint8 *) memCalloc(m_NumPixelsInImage);
+    if (NULL == m_pPixelFlagPlane) {
         gotoErr(EFail);
     }
 
@@ -469,69 +485,71 @@ C2DImageImpl::Initialize(
 
 
     ///////////////////////////////////////
-    // Look at every pixel and create shape objects for each separate edge.
+    // Label every separate group of connected edge pixels. This also counts
+    // the pixels in each group, so we only make shape objects for the groups
+    // that are big enough to be interesting.
+    pComponentTable = newex CEdgeComponentTable;
+    if (NULL == pComponentTable) {
+        gotoErr(EFail);
+    }
+    err = pComponentTable->Initialize(m_pEdgeDetectionTable);
+    if (err) {
+        gotoErr(err);
+    }
+    pShapeForLabel = (CBioCADShape **) memCalloc(sizeof(CBioCADShape *) * (pComponentTable->m_NumComponents + 1));
+    if (NULL == pShapeForLabel) {
+        gotoErr(EFail);
+    }
+
+    ///////////////////////////////////////
+    // Look at every pixel and add each edge pixel to the shape for its group.
+    // This visits the pixels column by column, which is the order the shapes
+    // have always been found in, so the shape list keeps the same order.
     for (x = 0; x < m_ImageWidth; x++) {
         for (y = 0; y < m_ImageHeight; y++) {
-            pPixelInfo = GetPixelState(x, y);
-            if (NULL == pPixelInfo) {
-                continue;
-            }
-
-            // Set the X and Y coordinate in every pixel entry.
-            // This lets me know where a pixel came from when I am passed just the pixelInfo.
-            pPixelInfo->m_X = x;
-            pPixelInfo->m_Y = y;
-            //pPixelInfo->m_pMarker = NULL;
-            //pPixelInfo->m_pEdge = NULL;
-
-            // Ignore any pixel that is already part of another shape.
-            // This loop walks through the pixels in raster scan. But, we may 
-            // follow a shape to pixels out of order, so we may have already seen a 
-            // pixel by the time this loop gets to it.
-            if (pPixelInfo->m_Flags & SHAPE_INTERIOR_PIXEL) {
-                continue;
-            }
-
-            isEdge = m_pEdgeDetectionTable->IsEdge(x, y);
             // Edges are black in the EdgeDetection bitmap, even though it may the color 
             // of the background in some original images. So even if the original images have white
             // lines on a black background (or any other color combination), the edgeDetection is 
             // always black lines on a white background.
-            if (!isEdge) {
+            label = pComponentTable->GetLabel(x, y);
+            if (0 == label) {
                 continue;
             }
 
-            // We found an edge pixel that is not in a shape. So, start a new shape for
-            // this pixel and all (directly or indirectly) adjacent pixels.
-            pShape = newex CBioCADShape;
-            if (NULL == pShape) {
-                gotoErr(EFail);
+            pPixelFlags = &(m_pPixelFlagPlane[(y * m_ImageWidth) + x]);
+            *pPixelFlags |= SHAPE_INTERIOR_PIXEL;
+            if (pComponentTable->CountEdgeNeighbors(x, y) <= 1) {
+                *pPixelFlags |= DANGLING_BORDER_PIXEL;
             }
-            pShape->m_pSourceFile = m_pSourceFile;
-            pShape->m_FeatureType = CBioCADShape::FEATURE_TYPE_REGION;
-            pShape->m_ShapeFlags = pShape->m_ShapeFlags | CBioCADShape::SOFTWARE_DISCOVERED;
 
-            SetPixelFlag(x, y, SHAPE_INTERIOR_PIXEL);
-            pPoint = pShape->AddPoint(x, y, m_ZPlane);
-            if (NULL == pPoint) {
-                gotoErr(EFail);
+            if (pComponentTable->GetComponent(label)->m_NumPixels < MIN_PIXELS_IN_USEFUL_SHAPE) {
+                continue;
             }
 
-            // Spread out from these initial points, and find all connected
-            // points on a shared edge or points with the same color. This 
-            // should find all points in the current shape
-            FindEdgePointsOnSameShape(pShape);
-            if (pShape->m_NumPoints < MIN_PIXELS_IN_USEFUL_SHAPE) {
-                delete pShape;
-            } else {
+            // The first pixel of a group starts a new shape.
+            pShape = pShapeForLabel[label];
+            if (NULL == pShape) {
+                pShape = newex CBioCADShape;
+                if (NULL == pShape) {
+                    gotoErr(EFail);
+                }
+                pShape->m_pSourceFile = m_pSourceFile;
+                pShape->m_pPointArena = &m_Arena;
+                pShape->m_pLuminanceTable = &m_LuminanceTable;
+                pShape->m_FeatureType = CBioCADShape::FEATURE_TYPE_REGION;
+                pShape->m_ShapeFlags = pShape->m_ShapeFlags | CBioCADShape::SOFTWARE_DISCOVERED;
                 pShape->m_pOwnerImage = this;
                 pShape->m_pNextShape = m_pShapeList;
                 m_pShapeList = pShape;
+                pShapeForLabel[label] = pShape;
             }
 
-            pShape = NULL;
-        } // for (y = 0; y < pMap->m_MaxYPos; y++)
-    } // for (x = 0; x < maxXPos; x++)
+            pPoint = pShape->AddPoint(x, y, m_ZPlane);
+            if (NULL == pPoint) {
+                gotoErr(EFail);
+            }
+        } // for (y = 0; y < m_ImageHeight; y++)
+    } // for (x = 0; x < m_ImageWidth; x++)
 
 
 
@@ -585,6 +603,16 @@ C2DImageImpl::Initialize(
         pShape = pNextShape;
     } // while (pShape)
 
+    // Index the shapes that are left. Their bounding boxes do not change after this.
+    pShape = m_pShapeList;
+    while (pShape) {
+        err = m_ShapeIndex.AddShape(pShape, false);
+        if (err) {
+            gotoErr(err);
+        }
+        pShape = pShape->m_pNextShape;
+    } // while (pShape)
+
 
 
     ///////////////////////////////////////
@@ -602,6 +630,8 @@ abort:
     if (pEdgeImageFileName) {
         memFree(pEdgeImageFileName);
     }
+    memFree(pShapeForLabel);
+    delete pComponentTable;
 
     return(err);
 } // Initialize
@@ -610,145 +640,6 @@ abort:
 
 
 
-/////////////////////////////////////////////////////////////////////////////
-//
-// [FindEdgePointsOnSameShape]
-//
-// This will find all points on the border, but it will also find a lot of
-// points inside the shape as well. Find everythng for now, and the redundant
-// points will be filtered out later.
-/////////////////////////////////////////////////////////////////////////////
-ErrVal
-C2DImageImpl::FindEdgePointsOnSameShape(CBioCADShape *pShape) {
-    ErrVal err = ENoErr;
-    CBioCADPoint *pCurrentPoint = NULL;
-    CBioCADPoint *pProcessedPoints = NULL;
-    int32 numNeighborsFound;
-
-    if (NULL == pShape) {
-        gotoErr(EFail);
-    }    
-
-    // Look for every neighboring pixel to find any other pixels that also
-    // form the shape boundary. These may not have had enough contrast to show up in the edge
-    // map, but they are similar and adjacent to the pixel that did.
-    //
-    // This will iterate on the point list so
-    // a pixel found on one iterations may cause us to look for more neighbors of this new pixel
-    // on future iterations.
-    pProcessedPoints = NULL;
-    while (pShape->m_pPointList) {
-        // Take the current point off the pending list
-        pCurrentPoint = pShape->m_pPointList;
-        pShape->m_pPointList = pCurrentPoint->m_pNextPoint;
-
-        // Put it on the completed list.
-        pCurrentPoint->m_pNextPoint = pProcessedPoints;
-        pProcessedPoints = pCurrentPoint;
-    
-        // Look for neighbors of this point.
-        numNeighborsFound = 0;
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X - 1, pCurrentPoint->m_Y - 1);
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X - 1, pCurrentPoint->m_Y);
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X - 1, pCurrentPoint->m_Y + 1);
-
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X, pCurrentPoint->m_Y - 1);
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X, pCurrentPoint->m_Y + 1);
-
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X + 1, pCurrentPoint->m_Y - 1);
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X + 1, pCurrentPoint->m_Y);
-        numNeighborsFound += CheckPossibleAdjacentEdgePixel(pShape, pCurrentPoint->m_X + 1, pCurrentPoint->m_Y + 1);
-
-        if (numNeighborsFound <= 1) {
-            CPixelInfo *pPixelState;
-            pPixelState = GetPixelState(pCurrentPoint->m_X, pCurrentPoint->m_Y);
-            if (pPixelState) {
-                pPixelState->m_Flags |= DANGLING_BORDER_PIXEL;
-            }
-        }
-    } // while (pShape->m_pPointList)
-
-    // Put all processed points back on the past.
-    pShape->m_pPointList = pProcessedPoints;
-
-abort:
-    returnErr(err);
-} // FindEdgePointsOnSameShape
-
-
-
-
-
-
-
-/////////////////////////////////////////////////////////////////////////////
-//
-// [CheckPossibleAdjacentEdgePixel]
-//
-/////////////////////////////////////////////////////////////////////////////
-int32
-C2DImageImpl::CheckPossibleAdjacentEdgePixel(
-                            CBioCADShape *pShape, 
-                            int32 x, 
-                            int32 y) {
-    ErrVal err = ENoErr;
-    bool fPixelIsPossibleBorder = true;
-    CBioCADPoint *pPoint;
-    int32 pixelFlags;
-    int32 numNeighborsFound = 0;
-    bool isEdge;
-
-    if (NULL == pShape) {
-        gotoErr(EFail);
-    }
-    
-    // Do not freak out if the coordinates are not value. The caller may be a bit sloppy
-    // to simplify his loops.
-    if ((x < 0) || (y < 0) || (x >= m_ImageWidth) || (y >= m_ImageHeight)) {
-        gotoErr(ENoErr);
-    }
-
-    // Ignore any pixel that is already part of a shape.
-    pixelFlags = GetPixelFlags(x, y);
-    if (pixelFlags & SHAPE_INTERIOR_PIXEL) {
-        numNeighborsFound = 1;
-        goto abort;
-    }
-
-    // Get the pixel we are considering.
-    isEdge = m_pEdgeDetectionTable->IsEdge(x, y);
-    fPixelIsPossibleBorder = false;
-
-    // If it is an edge, and even slightly bright, then include it.
-    // Be careful! Edges are black, even though in the original image, an "edge" may be bright (like white). 
-    if (isEdge) {
-        fPixelIsPossibleBorder = true;
-    }
-
-    // If a pixel is a border pixel, then add it to the shape.
-    if (fPixelIsPossibleBorder) {
-        SetPixelFlag(x, y, SHAPE_INTERIOR_PIXEL);
-        pPoint = pShape->AddPoint(x, y, m_ZPlane);
-        if (NULL == pPoint) {
-            gotoErr(EFail);
-        }
-        numNeighborsFound = 1;
-    } else if (g_DrawStopPixels) {
-        err = m_pSourceFile->SetPixel(x, y, BLOCKED_PIXEL_VALUE);
-        if (err) {
-            gotoErr(err);
-        }
-    }
-    
-abort:
-    return(numNeighborsFound);
-} // CheckPossibleAdjacentEdgePixel
-
-
-
-
-
-
 /////////////////////////////////////////////////////////////////////////////
 //
 // [Save]
@@ -813,8 +704,8 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
     CBioCADPoint *pCurrentPoint;
     CBioCADPoint *pPeerPoint;
     CBioCADPoint *pNextPoint;
-    CPixelInfo *pPixelState;
-    CPixelInfo *pPeerPixelState;
+    uint8 *pPixelState;
+    uint8 *pPeerPixelState;
     int32 numNeighbors;
     double distanceToPoint;
     double closestDistance;
@@ -845,8 +736,8 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
         }
 
         if (1 == numNeighbors) {
-            pPixelState->m_Flags |= DANGLING_BORDER_PIXEL;
-            //pPixelState->m_Flags |= DEBUG_HIGHLIGHT_PIXEL;
+            *pPixelState |= DANGLING_BORDER_PIXEL;
+            //*pPixelState |= DEBUG_HIGHLIGHT_PIXEL;
         }
 
         pCurrentPoint = pCurrentPoint->m_pNextPoint;
@@ -860,7 +751,7 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
         pNextPoint = pCurrentPoint->m_pNextPoint;
 
         pPixelState = GetPixelState(pCurrentPoint->m_X, pCurrentPoint->m_Y);
-        if ((pPixelState) && (pPixelState->m_Flags & DANGLING_BORDER_PIXEL)) {
+        if ((pPixelState) && (*pPixelState & DANGLING_BORDER_PIXEL)) {
             pClosestDanglingPoint = NULL;
 
             // For each dangling endpoint, look for the closest other dangling endpoint.
@@ -868,7 +759,7 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
             while (pPeerPoint) {
                 if (pPeerPoint != pCurrentPoint) {
                     pPeerPixelState = GetPixelState(pPeerPoint->m_X, pPeerPoint->m_Y);
-                    if ((pPeerPixelState) && (pPeerPixelState->m_Flags & DANGLING_BORDER_PIXEL)) {
+                    if ((pPeerPixelState) && (*pPeerPixelState & DANGLING_BORDER_PIXEL)) {
                         distanceToPoint = GetDistanceBetweenPoints(pCurrentPoint, pPeerPoint);
                         if ((distanceToPoint < MAX_DISTANCE_BETWEEN_DANGLING_PEERS)
                                 && (PixelsAppearOnSimilarPaths(pCurrentPoint, pPeerPoint))) {
@@ -890,7 +781,7 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
             else {
                 //pCurrentPoint->m_PointFlags |= CBioCADPoint::DELETE_POINT;
             }
-        } // if ((pPixelState) && (pPixelState->m_Flags & DANGLING_BORDER_PIXEL))
+        } // if ((pPixelState) && (*pPixelState & DANGLING_BORDER_PIXEL))
 
         pCurrentPoint = pCurrentPoint->m_pNextPoint;
     } // while (pCurrentPoint)
@@ -914,16 +805,16 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
         if (0) { // (pCurrentPoint->m_PointFlags & CBioCADPoint::DELETE_POINT) {
             pPixelState = GetPixelState(pCurrentPoint->m_X, pCurrentPoint->m_Y);
             if (pPixelState) {
-                pPixelState->m_Flags &= ~SHAPE_INTERIOR_PIXEL;
-                pPixelState->m_Flags &= ~SHAPE_BOUNDARY_PIXEL;
-                pPixelState->m_Flags &= ~DANGLING_BORDER_PIXEL;
-                pPixelState->m_Flags &= ~EXTRAPOLATED_PIXEL;
-                pPixelState->m_Flags &= ~DEBUG_HIGHLIGHT_PIXEL;
-
-                pPixelState->m_Flags |= SHAPE_EXTERIOR_PIXEL;
-                pPixelState->m_pShape = NULL;
+                *pPixelState &= ~SHAPE_INTERIOR_PIXEL;
+                *pPixelState &= ~SHAPE_BOUNDARY_PIXEL;
+                *pPixelState &= ~DANGLING_BORDER_PIXEL;
+                *pPixelState &= ~EXTRAPOLATED_PIXEL;
+                *pPixelState &= ~DEBUG_HIGHLIGHT_PIXEL;
+
+                *pPixelState |= SHAPE_EXTERIOR_PIXEL;
+                (void) SetPixelShape(pCurrentPoint->m_X, pCurrentPoint->m_Y, NULL);
             }
-            delete pCurrentPoint;
+            pShape->DiscardPoint(pCurrentPoint);
         } else {
             // Put the point back on the final list.
             pCurrentPoint->m_pNextPoint = pShape->m_pPointList;
@@ -942,23 +833,43 @@ C2DImageImpl::ConnectDanglingEnds(CBioCADShape *pShape) {
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// [GetPixelFlags]
+// [GetPixelIndex]
 //
+// This returns the index of a pixel in the pixel planes, or -1 if the
+// pixel is outside the image.
 /////////////////////////////////////////////////////////////////////////////
 int32
-C2DImageImpl::GetPixelFlags(int32 x, int32 y) { 
-    CPixelInfo *pPixelInfo;
-
-    if ((NULL == m_pPixelFlagsTable) 
+C2DImageImpl::GetPixelIndex(int32 x, int32 y) { 
+    if ((NULL == m_pPixelFlagPlane) 
             || (x < 0) 
             || (y < 0) 
             || (x >= m_ImageWidth) 
             || (y >= m_ImageHeight)) { 
+        return(-1); 
+    } 
+
+    return((y * m_ImageWidth) + x);
+}  // GetPixelIndex  
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetPixelFlags]
+//
+/////////////////////////////////////////////////////////////////////////////
+int32
+C2DImageImpl::GetPixelFlags(int32 x, int32 y) { 
+    int32 pixelIndex = GetPixelIndex(x, y);
+
+    if (pixelIndex < 0) { 
         return(0); 
     } 
 
-    pPixelInfo = &(m_pPixelFlagsTable[(y * m_ImageWidth) + x]);
-    return(pPixelInfo->m_Flags); 
+    return(m_pPixelFlagPlane[pixelIndex]); 
 }  // GetPixelFlags  
 
 
@@ -973,18 +884,13 @@ C2DImageImpl::GetPixelFlags(int32 x, int32 y) {
 /////////////////////////////////////////////////////////////////////////////
 void
 C2DImageImpl::SetPixelFlag(int32 x, int32 y, int32 newFlag) { 
-    CPixelInfo *pPixelInfo;
+    int32 pixelIndex = GetPixelIndex(x, y);
 
-    if ((NULL == m_pPixelFlagsTable)
-            || (x < 0)
-            || (y < 0)
-            || (x >= m_ImageWidth) 
-            || (y >= m_ImageHeight)) { 
+    if (pixelIndex < 0) { 
         return; 
     } 
 
-    pPixelInfo = &(m_pPixelFlagsTable[(y * m_ImageWidth) + x]);
-    pPixelInfo->m_Flags |= newFlag;
+    m_pPixelFlagPlane[pixelIndex] |= (uint8) newFlag;
 } // SetPixelFlag
 
 
@@ -995,21 +901,18 @@ C2DImageImpl::SetPixelFlag(int32 x, int32 y, int32 newFlag) {
 //
 // [GetPixelState]
 //
+// This returns the flags byte of a pixel, or NULL if the pixel is outside
+// the image.
 /////////////////////////////////////////////////////////////////////////////
-CPixelInfo *
+uint8 *
 C2DImageImpl::GetPixelState(int32 x, int32 y) { 
-    CPixelInfo *pPixelInfo;
+    int32 pixelIndex = GetPixelIndex(x, y);
 
-    if ((NULL == m_pPixelFlagsTable) 
-            || (x < 0) 
-            || (y < 0) 
-            || (x >= m_ImageWidth) 
-            || (y >= m_ImageHeight)) { 
+    if (pixelIndex < 0) { 
         return(NULL); 
     } 
 
-    pPixelInfo = &(m_pPixelFlagsTable[(y * m_ImageWidth) + x]);
-    return(pPixelInfo);
+    return(&(m_pPixelFlagPlane[pixelIndex]));
 } // GetPixelState
 
 
@@ -1024,23 +927,82 @@ C2DImageImpl::GetPixelState(int32 x, int32 y) {
 /////////////////////////////////////////////////////////////////////////////
 void 
 C2DImageImpl::ClearPixelFlag(int32 x, int32 y, int32 newFlag) { 
-    CPixelInfo *pPixelInfo;
+    int32 pixelIndex = GetPixelIndex(x, y);
 
-    if ((NULL == m_pPixelFlagsTable)
-            || (x < 0) 
-            || (y < 0)
-            || (x >= m_ImageWidth) 
-            || (y >= m_ImageHeight)) { 
+    if (pixelIndex < 0) { 
         return; 
     } 
 
-    pPixelInfo = &(m_pPixelFlagsTable[(y * m_ImageWidth) + x]);
-    pPixelInfo->m_Flags &= ~newFlag;
+    m_pPixelFlagPlane[pixelIndex] &= (uint8) ~newFlag;
 } // ClearPixelFlag
 
 
 
 
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [SetPixelShape]
+//
+// Record which shape a pixel belongs to. pShape may be NULL to clear it.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+C2DImageImpl::SetPixelShape(int32 x, int32 y, CBioCADShape *pShape) { 
+    ErrVal err = ENoErr;
+    int32 pixelIndex = GetPixelIndex(x, y);
+
+    if (pixelIndex < 0) { 
+        gotoErr(ENoErr);
+    } 
+
+    if (NULL == m_pPixelShapeIDPlane) {
+        if (NULL == pShape) {
+            gotoErr(ENoErr);
+        }
+        m_pPixelShapeIDPlane = (int32 *) memCalloc(sizeof(int32) * m_NumPixelsInImage);
+        if (NULL == m_pPixelShapeIDPlane) {
+            gotoErr(EFail);
+        }
+    }
+
+    if (pShape) {
+        m_pPixelShapeIDPlane[pixelIndex] = pShape->m_FeatureID;
+    } else {
+        m_pPixelShapeIDPlane[pixelIndex] = 0;
+    }
+
+abort:
+    returnErr(err);
+} // SetPixelShape
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [PixelIsOnShapeBoundary]
+//
+/////////////////////////////////////////////////////////////////////////////
+bool
+C2DImageImpl::PixelIsOnShapeBoundary(CBioCADShape *pShape, int32 x, int32 y) { 
+    int32 pixelIndex = GetPixelIndex(x, y);
+
+    if ((pixelIndex < 0) 
+            || (NULL == pShape)
+            || (NULL == m_pPixelShapeIDPlane)
+            || !(m_pPixelFlagPlane[pixelIndex] & SHAPE_BOUNDARY_PIXEL)) { 
+        return(false); 
+    } 
+
+    return(m_pPixelShapeIDPlane[pixelIndex] == pShape->m_FeatureID);
+} // PixelIsOnShapeBoundary
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // [Close]
@@ -1048,22 +1010,28 @@ C2DImageImpl::ClearPixelFlag(int32 x, int32 y, int32 newFlag) {
 /////////////////////////////////////////////////////////////////////////////
 void
 C2DImageImpl::Close() {
-    memFree(m_pPixelFlagsTable);
-    m_pPixelFlagsTable = NULL;
+    memFree(m_pPixelFlagPlane);
+    m_pPixelFlagPlane = NULL;
+    memFree(m_pPixelShapeIDPlane);
+    m_pPixelShapeIDPlane = NULL;
 
     memFree(m_pImageFileName);
     m_pImageFileName = NULL;
 
+    // The points of these shapes stay in the arena until the image is
+    // deleted, since the inspect regions are not discarded here.
     while (m_pShapeList) {
         CBioCADShape *pTargetShape = m_pShapeList;
         m_pShapeList = pTargetShape->m_pNextShape;
         delete pTargetShape;
     } // if (m_pShapeList)
+    m_ShapeIndex.Discard();
 
     if (m_pEdgeDetectionTable) {
         delete m_pEdgeDetectionTable;
         m_pEdgeDetectionTable = NULL;
     }
+    m_LuminanceTable.Discard();
 
     if (m_pSourceFile) {
         m_pSourceFile->Save(0);
@@ -1107,23 +1075,21 @@ C2DImageImpl::CloseOnDiskOnly() {
 void
 C2DImageImpl::DeleteShape(CBioCADShape *pShape) {
     CBioCADPoint *pCurrentPoint = NULL;
-    CBioCADPoint *pNextPoint = NULL;
 
     if (NULL == pShape) {
         return;
     }
 
     pCurrentPoint = pShape->m_pPointList;
-    pShape->m_pPointList = NULL;
-    while (pCurrentPoint) {        
+    while (pCurrentPoint) {
         ClearPixelFlag(pCurrentPoint->m_X, pCurrentPoint->m_Y, SHAPE_INTERIOR_PIXEL);
         ClearPixelFlag(pCurrentPoint->m_X, pCurrentPoint->m_Y, SHAPE_BOUNDARY_PIXEL);
-
-        pNextPoint = pCurrentPoint->m_pNextPoint;
-        delete pCurrentPoint;
-        pCurrentPoint = pNextPoint;
+        pCurrentPoint = pCurrentPoint->m_pNextPoint;
     } // while (pCurrentPoint)
 
+    m_ShapeIndex.RemoveShape(pShape);
+
+    // This also discards the points.
     delete pShape;
 } // DeleteShape
 
@@ -1185,13 +1151,7 @@ C2DImageImpl::GetFeatureProperty(
     }
 
     // Look for the shape.
-    pShape = m_pShapeList;
-    while (pShape) {
-        if (featureID == pShape->m_FeatureID) {
-            break;
-        }
-        pShape = pShape->m_pNextShape;
-    } // while (pShape)
+    pShape = m_ShapeIndex.FindShape(featureID);
 
     // If we cannot find the shape, then quit.
     if (NULL == pShape) {
@@ -1247,8 +1207,14 @@ C2DImageImpl::AddFeature(
         gotoErr(EFail);
     }
     pShape->m_pSourceFile = m_pSourceFile;
+    pShape->m_pPointArena = &m_Arena;
+    pShape->m_pLuminanceTable = &m_LuminanceTable;
     pShape->m_FeatureType = featureType;
 
+    err = m_ShapeIndex.AddShape(pShape, true);
+    if (err) {
+        gotoErr(err);
+    }
     pShape->m_pOwnerImage = this;
     pShape->m_pNextShape = m_pShapeList;
     m_pShapeList = pShape;
@@ -1276,48 +1242,32 @@ abort:
 /////////////////////////////////////////////////////////////////////////////
 int32
 C2DImageImpl::CountNeighborPixels(CBioCADShape *pShape, int32 x, int32 y) {
-    CPixelInfo *pNWPixelState;
-    CPixelInfo *pNPixelState;
-    CPixelInfo *pNEPixelState;
-    CPixelInfo *pWPixelState;
-    CPixelInfo *pEPixelState;
-    CPixelInfo *pSWPixelState;
-    CPixelInfo *pSPixelState;
-    CPixelInfo *pSEPixelState;
     int32 numNeighbors = 0;
 
-    pNWPixelState = GetPixelState(x - 1, y - 1);
-    if ((pNWPixelState) && (pNWPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pNWPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x - 1, y - 1)) {
         numNeighbors += 1;
     }
-    pNPixelState = GetPixelState(x, y - 1);
-    if ((pNPixelState) && (pNPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pNPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x, y - 1)) {
         numNeighbors += 1;        
     }   
-    pNEPixelState = GetPixelState(x + 1, y - 1);
-    if ((pNEPixelState) && (pNEPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pNEPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x + 1, y - 1)) {
         numNeighbors += 1;        
     }
 
-    pWPixelState = GetPixelState(x - 1, y);
-    if ((pWPixelState) && (pWPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pWPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x - 1, y)) {
         numNeighbors += 1;        
     }
-    pEPixelState = GetPixelState(x + 1, y);
-    if ((pEPixelState) && (pEPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pEPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x + 1, y)) {
         numNeighbors += 1;        
     }    
 
-    pSWPixelState = GetPixelState(x - 1, y + 1); 
-    if ((pSWPixelState) && (pSWPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pSWPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x - 1, y + 1)) {
         numNeighbors += 1;
     }
-    pSPixelState = GetPixelState(x, y + 1);
-    if ((pSPixelState) && (pSPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pSPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x, y + 1)) {
         numNeighbors += 1;
     }
-    pSEPixelState = GetPixelState(x + 1, y + 1);
-    if ((pSEPixelState) && (pSEPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) && (pShape == pSEPixelState->m_pShape)) {
+    if (PixelIsOnShapeBoundary(pShape, x + 1, y + 1)) {
         numNeighbors += 1;
     }
 
@@ -1349,7 +1299,7 @@ C2DImageImpl::PixelsAppearOnSimilarPaths(CBioCADPoint *pPoint1, CBioCADPoint *pP
     int32 startY;
     int32 endX;
     int32 endY;
-    CPixelInfo *pPixelState;
+    uint8 *pPixelState;
 
     if ((NULL == pPoint1) || (NULL == pPoint2)) {
         return(false);
@@ -1384,8 +1334,8 @@ C2DImageImpl::PixelsAppearOnSimilarPaths(CBioCADPoint *pPoint1, CBioCADPoint *pP
         
             pPixelState = GetPixelState(x, y);
             if ((pPixelState) 
-                && !(pPixelState->m_Flags & SHAPE_EXTERIOR_PIXEL)
-                && !(pPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL)) {
+                && !(*pPixelState & SHAPE_EXTERIOR_PIXEL)
+                && !(*pPixelState & SHAPE_BOUNDARY_PIXEL)) {
                 return(false);
             }
 
@@ -1424,8 +1374,8 @@ C2DImageImpl::PixelsAppearOnSimilarPaths(CBioCADPoint *pPoint1, CBioCADPoint *pP
 
             pPixelState = GetPixelState(x, y);
             if ((pPixelState) 
-                   && !(pPixelState->m_Flags & SHAPE_EXTERIOR_PIXEL)
-                   && !(pPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL)) {
+                   && !(*pPixelState & SHAPE_EXTERIOR_PIXEL)
+                   && !(*pPixelState & SHAPE_BOUNDARY_PIXEL)) {
                 return(false);
             }
 
@@ -1468,7 +1418,7 @@ C2DImageImpl::AddExtrapolatedBorderPoints(
     int32 startY;
     int32 endX;
     int32 endY;
-    CPixelInfo *pPixelState;
+    uint8 *pPixelState;
 
 
     if ((NULL == pShape) || (NULL == pPoint1) || (NULL == pPoint2)) {
@@ -1504,8 +1454,8 @@ C2DImageImpl::AddExtrapolatedBorderPoints(
         
             pPixelState = GetPixelState(x, y);
             if (pPixelState) {
-                if (pPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) {
-                    pPixelState->m_Flags &= ~DANGLING_BORDER_PIXEL;
+                if (*pPixelState & SHAPE_BOUNDARY_PIXEL) {
+                    *pPixelState &= ~DANGLING_BORDER_PIXEL;
                 } else {
                     err = AddOneExtrapolatedPixel(pShape, x, y, pPixelState);
                     if (err) {
@@ -1549,8 +1499,8 @@ C2DImageImpl::AddExtrapolatedBorderPoints(
 
             pPixelState = GetPixelState(x, y);
             if (pPixelState) {
-                if (pPixelState->m_Flags & SHAPE_BOUNDARY_PIXEL) {
-                    pPixelState->m_Flags &= ~DANGLING_BORDER_PIXEL;
+                if (*pPixelState & SHAPE_BOUNDARY_PIXEL) {
+                    *pPixelState &= ~DANGLING_BORDER_PIXEL;
                 } else {
                     err = AddOneExtrapolatedPixel(pShape, x, y, pPixelState);
                     if (err) {
@@ -1584,7 +1534,7 @@ abort:
 //
 /////////////////////////////////////////////////////////////////////////////
 ErrVal
-C2DImageImpl::AddOneExtrapolatedPixel(CBioCADShape *pShape, int32 x, int32 y, CPixelInfo *pPixelState) {
+C2DImageImpl::AddOneExtrapolatedPixel(CBioCADShape *pShape, int32 x, int32 y, uint8 *pPixelState) {
     ErrVal err = ENoErr;
     CBioCADPoint *pPoint;
 
@@ -1597,11 +1547,15 @@ C2DImageImpl::AddOneExtrapolatedPixel(CBioCADShape *pShape, int32 x, int32 y, CP
         gotoErr(EFail);
     }
     
-    pPixelState->m_Flags &= ~SHAPE_EXTERIOR_PIXEL;
-    pPixelState->m_Flags |= SHAPE_BOUNDARY_PIXEL;
-    pPixelState->m_Flags |= EXTRAPOLATED_PIXEL;
-    //<>pPixelState->m_Flags |= DEBUG_HIGHLIGHT_PIXEL;
-    pPixelState->m_pShape = pShape;
+    *pPixelState &= ~SHAPE_EXTERIOR_PIXEL;
+    *pPixelState |= SHAPE_BOUNDARY_PIXEL;
+    *pPixelState |= EXTRAPOLATED_PIXEL;
+    //<>*pPixelState |= DEBUG_HIGHLIGHT_PIXEL;
+
+    err = SetPixelShape(x, y, pShape);
+    if (err) {
+        gotoErr(err);
+    }
 
 abort:
     returnErr(err);
@@ -1634,6 +1588,9 @@ C2DImageImpl::BuildCrossSections() {
     // structure that is used a lot in later steps of the shape analysis.
     pShape = m_pShapeList;
     while (pShape) {
+        pShape->DiscardLuminenceHistogram();
+        pShape->m_AreaInPixels = -1;
+
         // Allocate the cross-sections.
         pShape->m_NumCrossSections = (pShape->m_BoundingBoxBottomY - pShape->m_BoundingBoxTopY) + 1;
         pShape->m_pCrossSectionList = (CBioCADCrossSection *) (memAlloc(sizeof(CBioCADCrossSection) * pShape->m_NumCrossSections));
@@ -1758,15 +1715,17 @@ C2DImageImpl::BuildCrossSections() {
             // Record the shape in EVERY pixel in the cross sections.
             // This is useful when we look at marker pixels.
             for (int32 x = pCrossSection->m_StartX; x <= pCrossSection->m_StopX; x++) {
-                CPixelInfo *pPixelInfo = GetPixelState(x, pCrossSection->m_Y);
-                if (pPixelInfo) {
-                    pPixelInfo->m_pShape = pShape;
+                err = SetPixelShape(x, pCrossSection->m_Y, pShape);
+                if (err) {
+                    gotoErr(err);
                 }
             }
         }
 //<><><><><><><><><>
 #endif
 
+        // Count the area once here, so later lookups do not walk the rows.
+        (void) pShape->GetAreaInPixels();
 
         pShape = pShape->m_pNextShape;
     } // while (pShape)
@@ -1790,19 +1749,13 @@ abort:
 ErrVal
 C2DImageImpl::RedrawProcessedImage(int32 options) {
     ErrVal err = ENoErr;
-    int32 x;
-    int32 y;
 
     // Optionally, erase the image, so we only draw pixels we consider to be part of shapes,
     // and not random background luminence or image noise.
     if (options & CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES) {
-        for (x = 0; x < m_ImageWidth; x++) {
-            for (y = 0; y < m_ImageHeight; y++) {
-                err = m_pSourceFile->SetPixel(x, y, g_BackGroundPixelColor);
-                if (err) {
-                    gotoErr(err);
-                }
-            }
+        err = FillImage(m_pSourceFile, m_BackGroundPixelColor);
+        if (err) {
+            gotoErr(err);
         }
     } // if (options & CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES)
 
@@ -1815,6 +1768,44 @@ abort:
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FillImage]
+//
+// Set every pixel in an image to one color, a row at a time.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+C2DImageImpl::FillImage(CImageFile *pImage, uint32 color) {
+    ErrVal err = ENoErr;
+    uint32 *pPixelRow = NULL;
+    int32 x;
+    int32 y;
+
+    pPixelRow = (uint32 *) memAlloc(sizeof(uint32) * m_ImageWidth);
+    if (NULL == pPixelRow) {
+        gotoErr(EFail);
+    }
+    for (x = 0; x < m_ImageWidth; x++) {
+        pPixelRow[x] = color;
+    }
+
+    for (y = 0; y < m_ImageHeight; y++) {
+        err = pImage->WriteRow(y, 0, m_ImageWidth, pPixelRow);
+        if (err) {
+            gotoErr(err);
+        }
+    }
+
+abort:
+    memFree(pPixelRow);
+    returnErr(err);
+} // FillImage
+
+
+
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // [DrawFeatures]
@@ -1829,14 +1820,16 @@ C2DImageImpl::DrawFeatures(int32 options) {
     CBioCADShape *pShape = NULL;
     int32 colorIndex;
     int32 *pShapeColorList;
+    uint32 *pPixelRow = NULL;
+    int32 runStartX;
 
     pShapeColorList = g_ColoredShapeColorList;
-    g_BackGroundPixelColor = BLACK_PIXEL;
-    g_ShapeInteriorColor = GREEN_PIXEL;
+    m_BackGroundPixelColor = BLACK_PIXEL;
+    m_ShapeInteriorColor = GREEN_PIXEL;
 
     if (options & CELL_GEOMETRY_DRAW_INTERIOR_AS_GRAY) {
-        g_BackGroundPixelColor = WHITE_PIXEL;
-        g_ShapeInteriorColor = LIGHT_GRAY_PIXEL;
+        m_BackGroundPixelColor = WHITE_PIXEL;
+        m_ShapeInteriorColor = LIGHT_GRAY_PIXEL;
         pShapeColorList = g_GrayShapeColorList;
         options |= CELL_GEOMETRY_DRAW_SHAPE_INTERIORS;
     }
@@ -1845,13 +1838,9 @@ C2DImageImpl::DrawFeatures(int32 options) {
     // Optionally, erase the image, so we only draw pixels we consider to be part of shapes,
     // and not random background luminence or image noise.
     if (options & CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES) {
-        for (x = 0; x < m_ImageWidth; x++) {
-            for (y = 0; y < m_ImageHeight; y++) {
-                err = m_pSourceFile->SetPixel(x, y, g_BackGroundPixelColor);
-                if (err) {
-                    gotoErr(err);
-                }
-            }
+        err = FillImage(m_pSourceFile, m_BackGroundPixelColor);
+        if (err) {
+            gotoErr(err);
         }
     } // if (options & CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES)
 
@@ -1877,20 +1866,41 @@ C2DImageImpl::DrawFeatures(int32 options) {
 
     
     // Draw any special pixels.
-    for (x = 0; x < m_ImageWidth; x++) {
-        for (y = 0; y < m_ImageHeight; y++) {
-            int32 pixelFlags = GetPixelFlags(x, y);
+    // Collect each run of changed pixels in a row, and write the run all at once.
+    pPixelRow = (uint32 *) memAlloc(sizeof(uint32) * m_ImageWidth);
+    if (NULL == pPixelRow) {
+        gotoErr(EFail);
+    }
+    for (y = 0; y < m_ImageHeight; y++) {
+        runStartX = -1;
+        for (x = 0; x <= m_ImageWidth; x++) {
+            bool fChangePixel = false;
 
-            if (pixelFlags & DEBUG_HIGHLIGHT_PIXEL) {
-                (void) m_pSourceFile->SetPixel(x, y, RED_PIXEL);
+            if (x < m_ImageWidth) {
+                int32 pixelFlags = GetPixelFlags(x, y);
+
+                if (pixelFlags & DEBUG_HIGHLIGHT_PIXEL) {
+                    pPixelRow[x] = RED_PIXEL;
+                    fChangePixel = true;
+                }
+                if ((options & CELL_GEOMETRY_DRAW_SHAPE_INTERIORS)
+                        && !(SHAPE_EXTERIOR_PIXEL & pixelFlags)
+                        && !(SHAPE_BOUNDARY_PIXEL & pixelFlags)) {
+                    pPixelRow[x] = m_ShapeInteriorColor;
+                    fChangePixel = true;
+                }
             }
-            if ((options & CELL_GEOMETRY_DRAW_SHAPE_INTERIORS) 
-                    && !(SHAPE_EXTERIOR_PIXEL & pixelFlags)
-                    && !(SHAPE_BOUNDARY_PIXEL & pixelFlags)) {
-                (void) m_pSourceFile->SetPixel(x, y, g_ShapeInteriorColor);
+
+            if (fChangePixel) {
+                if (runStartX < 0) {
+                    runStartX = x;
+                }
+            } else if (runStartX >= 0) {
+                (void) m_pSourceFile->WriteRow(y, runStartX, x - runStartX, &(pPixelRow[runStartX]));
+                runStartX = -1;
             }
-        }
-    }
+        } // for (x = 0; x <= m_ImageWidth; x++)
+    } // for (y = 0; y < m_ImageHeight; y++)
 
 
 //////////////////////////////////////////
@@ -1917,6 +1927,7 @@ C2DImageImpl::DrawFeatures(int32 options) {
 //////////////////////////////////////////
 
 abort:
+    memFree(pPixelRow);
     return;
 } // DrawFeatures
 
@@ -2122,8 +2133,9 @@ C2DImageImpl::DrawEdges(int32 options) {
     ErrVal err = ENoErr;
     CImageFile *pEdgeDetectionImage = NULL;
     char *pEdgeImageFileName = NULL;
-    uint32 blackGrayScalePixel = 0; 
-    uint32 whiteGrayScalePixel = 0; 
+    uint32 blackGrayScalePixel = 0;
+    uint32 whiteGrayScalePixel = 0;
+    uint32 *pPixelRow = NULL;
     int32 x;
     int32 y;
 
@@ -2149,36 +2161,39 @@ C2DImageImpl::DrawEdges(int32 options) {
     // Erase the image, so we only draw pixels we consider to be part of shapes,
     // and not random background luminence or image noise.
     if (options & CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES) {
-        for (x = 0; x < m_ImageWidth; x++) {
-            for (y = 0; y < m_ImageHeight; y++) {
-                err = m_pSourceFile->SetPixel(x, y, WHITE_PIXEL);
-                if (err) {
-                    gotoErr(err);
-                }
-            }
+        err = FillImage(m_pSourceFile, WHITE_PIXEL);
+        if (err) {
+            gotoErr(err);
         }
     } // if (options & CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES)
 
     // Draw any special pixels.
-    for (x = 0; x < m_ImageWidth; x++) {
-        for (y = 0; y < m_ImageHeight; y++) {
+    pPixelRow = (uint32 *) memAlloc(sizeof(uint32) * m_ImageWidth);
+    if (NULL == pPixelRow) {
+        gotoErr(EFail);
+    }
+    for (y = 0; y < m_ImageHeight; y++) {
+        for (x = 0; x < m_ImageWidth; x++) {
             int32 pixelFlags = GetPixelFlags(x, y);
 
             if (pixelFlags & DEBUG_HIGHLIGHT_PIXEL) {
-                err = pEdgeDetectionImage->SetPixel(x, y, blackGrayScalePixel);
+                pPixelRow[x] = blackGrayScalePixel;
             } else {
-                err = pEdgeDetectionImage->SetPixel(x, y, whiteGrayScalePixel);
-            }
-            if (err) {
-                gotoErr(err);
+                pPixelRow[x] = whiteGrayScalePixel;
             }
         }
+
+        err = pEdgeDetectionImage->WriteRow(y, 0, m_ImageWidth, pPixelRow);
+        if (err) {
+            gotoErr(err);
+        }
     }
 
     pEdgeDetectionImage->Save(0);
     pEdgeDetectionImage->CloseOnDiskOnly();
 
 abort:
+    memFree(pPixelRow);
     if (pEdgeImageFileName) {
         memFree(pEdgeImageFileName);
     }
@@ -2331,8 +2346,12 @@ C2DImageImpl::CreateInspectRegion(
     ErrVal err = ENoErr;
     CBioCADShape *pShape = NULL;
     CBioCADShape *pBestShape = NULL;
+    CShapeIndexEntry **pEntryList = NULL;
+    int32 numEntries;
+    int32 entryNum;
     int32 currentShapeSize;
     int32 bestShapeSize;
+    int32 bestListPosition;
     float shapeOverlap;
     int32 middleX;
     int32 middleY;
@@ -2354,6 +2373,8 @@ C2DImageImpl::CreateInspectRegion(
         gotoErr(EFail);
     }
     pShape->m_pSourceFile = m_pSourceFile;
+    pShape->m_pPointArena = &m_Arena;
+    pShape->m_pLuminanceTable = &m_LuminanceTable;
     pShape->m_FeatureType = CBioCADShape::FEATURE_TYPE_RECTANGLE;
     pShape->m_ShapeFlags = pShape->m_ShapeFlags | CBioCADShape::SOFTWARE_DISCOVERED;
 
@@ -2380,19 +2401,28 @@ C2DImageImpl::CreateInspectRegion(
         pShape->m_BoundingBoxBottomY = bottomOffset;
     /////////////////////////////////////////////////
     } else if (INSPECTION_REGION_FROM_EDGE_DETECTION == positionType) {
+        // Only the shapes that touch the rectangle can overlap it. If two are
+        // the same size, pick the one nearer the front of the shape list.
+        err = m_ShapeIndex.FindShapesInRect(leftOffset, topOffset, rightOffset, bottomOffset, &pEntryList, &numEntries);
+        if (err) {
+            gotoErr(err);
+        }
         pBestShape = NULL;
-        pShape = m_pShapeList;
-        while (pShape) {
+        for (entryNum = 0; entryNum < numEntries; entryNum++) {
+            pShape = pEntryList[entryNum]->m_pShape;
             shapeOverlap = pShape->ComputeOverlap(topOffset, bottomOffset, leftOffset, rightOffset);
             if (shapeOverlap >= 0.6) {
                 currentShapeSize = pShape->GetAreaInPixels();
-                if ((NULL == pBestShape) || (currentShapeSize > bestShapeSize)) {
+                if ((NULL == pBestShape) 
+                        || (currentShapeSize > bestShapeSize)
+                        || ((currentShapeSize == bestShapeSize) 
+                                && (pEntryList[entryNum]->m_ListPosition < bestListPosition))) {
                     pBestShape = pShape;
                     bestShapeSize = currentShapeSize;
+                    bestListPosition = pEntryList[entryNum]->m_ListPosition;
                 }
             }
-            pShape = pShape->m_pNextShape;
-        } // while (pShape)
+        } // for (entryNum = 0; entryNum < numEntries; entryNum++)
         pShape = pBestShape;
     /////////////////////////////////////////////////
     } else {
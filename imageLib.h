@@ -138,12 +138,28 @@ public:
     virtual void ParsePixel(uint32 value, uint32 *pBlue, uint32 *pGreen, uint32 *pRed) = 0;
     virtual uint32 ConvertGrayScaleToPixel(uint32 grayScaleValue) = 0;
 
+    // Row access. These cost one call per row rather than one per pixel.
+    // ReadRow and WriteRow use the same 32-bit pixel values as GetPixel and
+    // SetPixel. GetRowPointer returns the raw, read-only bytes of a row in
+    // the file's own format. If HasColorTable is true, then those bytes are
+    // indexes into the color table, not colors.
+    virtual ErrVal GetRowPointer(int32 yPos, const char **ppPixelRow, int32 *pBitsPerPixel) = 0;
+    virtual ErrVal ReadRow(int32 yPos, int32 startX, int32 numPixels, uint32 *pPixels) = 0;
+    virtual ErrVal WriteRow(int32 yPos, int32 startX, int32 numPixels, const uint32 *pPixels) = 0;
+
     virtual bool RowOperationsAreFast() = 0;
+    virtual bool HasColorTable() = 0;
+
+    // This changes every time any pixel does, so anything that is computed
+    // from the pixels can tell when it is out of date.
+    virtual uint32 GetChangeNumber() = 0;
+
     virtual ErrVal CopyPixelRow(int32 srcX, int32 srcY, int32 destX, int32 destY, int32 numPixels) = 0;
     virtual ErrVal CropImage(int32 newWidth, int32 newHeight) = 0;
 }; // CImageFile
 
 CImageFile *OpenBMPFile(const char *pFilePath);
+CImageFile *OpenMappedBMPFile(const char *pFilePath);
 CImageFile *OpenBitmapImage(
                 char *pSrcBitMap, 
                 const char *pBitmapFormat, 
@@ -185,12 +201,53 @@ double GetDistanceBetweenPoints(CBioCADPoint *pPointA, CBioCADPoint *pPointB);
 
 
 
+////////////////////////////////////////////////
+// One pixel of a line. This is much smaller than a CBioCADPoint, since
+// a line may have thousands of them.
+class CBioCADPixel {
+public:
+    int32           m_X;
+    int32           m_Y;
+}; // CBioCADPixel
+
+
+
+////////////////////////////////////////////////
+// This holds the points, lines and pixels that belong to one owner, like
+// an image or a line set. Objects are taken from the end of a large block,
+// and they are never freed one at a time. Instead, all of them are freed
+// at once when the owner discards the arena. An arena is not locked, so
+// only the thread that is working on its owner may use it.
+class CBioCADArenaBlock;
+class CBioCADLine;
+class CLuminanceTable;
+
+class CBioCADArena {
+public:
+    CBioCADArena();
+    ~CBioCADArena();
+    NEWEX_IMPL();
+
+    void *Alloc(int32 numBytes);
+    void ReleaseUnused(void *pBuffer, int32 numAllocatedBytes, int32 numUsedBytes);
+    CBioCADPoint *NewPoint();
+    CBioCADLine *NewLine();
+    void TakeAll(CBioCADArena *pSrcArena);
+    void DiscardAll();
+
+private:
+    CBioCADArenaBlock   *m_pBlockList;
+}; // CBioCADArena
+
+
+
 ////////////////////////////////////////////////
 // This is a line in 2D or 3D space
 class CBioCADLine {
 public:
     enum {
         LINE_TEMP_PRUNED    = 0x08,
+        LINE_IN_ARENA       = 0x10,
     };
 
     CBioCADLine();
@@ -215,9 +272,10 @@ public:
     double              m_AngleWithHorizontal;
     //////////////////
     // This is the actual pixels contained in a line.
-    // This is only used by the line detection code.
+    // This is only used by the line detection code. The array belongs to
+    // the arena of the line set, so it is not freed with the line.
     int32               m_NumPixels;
-    CBioCADPoint        *m_PixelList;
+    CBioCADPixel        *m_pPixels;
     
     double              m_Length;
 
@@ -253,6 +311,9 @@ public:
 
     CBioCADLine     *m_pRemovedLines;
 
+    // The lines with LINE_IN_ARENA, and the pixels of all the lines.
+    CBioCADArena    m_Arena;
+
     CBioCADLineSet  *m_pNextGraph;
 }; // CBioCADLineSet
 
@@ -270,6 +331,7 @@ public:
     NEWEX_IMPL()
     
     CBioCADPoint *AddPoint(int32 x, int32 y, int32 z);
+    void DiscardPoint(CBioCADPoint *pPoint);
     void FindBoundingBox();
     
     ErrVal DrawShape(int32 color, int32 options);
@@ -282,12 +344,18 @@ public:
                     uint32 *pMaxLuminence,
                     uint32 *pNumPixelsChecked);
 
+    ErrVal GetLuminenceDeviation(
+                    float *pAverageLuminence,
+                    float *pStandardDeviation,
+                    uint32 *pNumPixelsChecked);
+
     ErrVal CountPixelsInLuminenceRange(
                     uint32 minLuminence,
                     uint32 maxLuminence,
                     uint32 *pNumPixels,
                     float *pFractionOfRegion,
                     uint32 *pNumPixelsChecked);
+    void DiscardLuminenceHistogram();
 
     int32 GetAreaInPixels();
 
@@ -317,8 +385,11 @@ public:
     int32               m_BoundingBoxBottomY;
 
     // These are the boundary points.
+    // If there is an arena, then the points belong to it, and they are
+    // freed with the arena rather than with the shape.
     CBioCADPoint        *m_pPointList;
     int32               m_NumPoints;
+    CBioCADArena        *m_pPointArena;
 
     // A Cross Section is one line across a shape, along a horizontal dimension 
     // It may not correspond to the orientation of the shape; for example a 
@@ -328,8 +399,28 @@ public:
     CBioCADCrossSection *m_pCrossSectionList;
     int32               m_NumCrossSections;
 
+    // The area of a region is counted once, from its cross sections, and
+    // saved here. It is -1 until then.
+    int32               m_AreaInPixels;
+
+    // If there is a luminance table, then the totals of the pixels come
+    // from it instead of reading every pixel.
+    CLuminanceTable     *m_pLuminanceTable;
+
+    // This is built the first time pixels are counted in a luminance range,
+    // and rebuilt after the pixels of the image change. Entry n is the
+    // number of pixels in the shape with a luminance below n. Anything that
+    // changes the bounding box or cross sections has to discard it.
+    uint32              *m_pLuminenceHistogram;
+    int32               m_NumHistogramPixels;
+    uint32              m_HistogramChangeNumber;
+
     C2DImage            *m_pOwnerImage;
     CBioCADShape        *m_pNextShape;
+
+private:
+    ErrVal GetLuminenceTotals(uint64 *pTotal, uint64 *pTotalSquares, int32 *pNumPixels);
+    ErrVal UpdateLuminenceHistogram();
 }; // CBioCADShape
 
 
@@ -416,6 +507,24 @@ ErrVal Open2DImageFromBitMap(
                 CStatsFile *pStatFile,
                 C2DImage **ppResult);
 
+// This is called once for each file of a batch, on one of the threads of
+// the batch, so it may be running for several files at once. It owns
+// pImage, which is NULL if openErr says the file could not be opened.
+// Returning an error stops the batch from starting any more files.
+typedef ErrVal (*C2DImageBatchProc)(
+                void *pContext,
+                int32 fileNum,
+                ErrVal openErr,
+                C2DImage *pImage);
+
+ErrVal Open2DImagesFromFiles(
+                const char **pImageFileNameList,
+                int32 numFiles,
+                int32 numWorkers,
+                int32 options,
+                C2DImageBatchProc pProc,
+                void *pContext);
+
 void DeleteImageObject(C2DImage *pGenericImage);
 
 // Options for shape and line detection
@@ -430,6 +539,8 @@ enum {
     CELL_GEOMETRY_DRAW_INTERIOR_AS_GRAY                 = 0x0080,
     CELL_GEOMETRY_REDRAW_WITH_JUST_SHAPE_OUTLINES       = 0x0100,
     CELL_GEOMETRY_DRAW_SHAPE_SCANLINES                  = 0x0200,
+    CELL_GEOMETRY_LINE_DETECTION_PROGRESSIVE            = 0x0400,
+    CELL_GEOMETRY_LINE_DETECTION_PYRAMID                = 0x0800,
 };
 
 
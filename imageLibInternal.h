@@ -50,6 +50,23 @@ public:
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Parallel Row Bands
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_ROW_BANDS       32
+
+// This processes rows [startRow, stopRow) of one band. See parallelRows.cpp.
+typedef ErrVal (*CRowBandProc)(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+
+int32 GetNumRowBands(int32 numRows, int32 minRowsPerBand);
+void GetRowBandRange(int32 numRows, int32 numBands, int32 bandNum, int32 *pStartRow, int32 *pStopRow);
+ErrVal RunRowBands(int32 numRows, int32 numBands, CRowBandProc pProc, void *pContext);
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // EDGE DETECTION
@@ -67,16 +84,6 @@ public:
 #define PIXELS_BRIGHTER_SE_TO_NW         8
 
 
-///////////////////////////////////////////////////////
-class CEdgeDetectionEntry {
-public:
-    uint8           m_IsEdge;
-    uint8           m_GrayScaleValue;
-    uint8           m_GradientDirection;
-    int32           m_Gradient;
-}; // CEdgeDetectionEntry
-
-
 ///////////////////////////////////////////////////////
 class CEdgeDetectionTable {
 public:
@@ -95,10 +102,21 @@ public:
 
     int32               m_MaxXPos;
     int32               m_MaxYPos;
-    CEdgeDetectionEntry *m_pInfoTable;
+
+    // Each property is a separate plane, stored a row at a time, so a pass
+    // that only needs one of them does not load the others.
+    // The edge flags are packed 32 to a word, and each row starts on a new
+    // word, so bands of rows never share a word.
+    // Pixels that are not edges have direction 0 and keep their gradient.
+    uint8               *m_pGrayScalePlane;
+    uint32              *m_pEdgeMask;
+    int32               m_EdgeMaskWordsPerRow;
+    uint8               *m_pDirectionPlane;
+    uint8               *m_pGradientPlane;
 
 private:
-    uint32 GetPixelLuminance(CImageFile *pSrcImage, uint32 pixel);
+    static ErrVal ComputeLuminanceBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+    static ErrVal ComputeGradientBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
 }; // CEdgeDetectionTable
 
 
@@ -109,6 +127,200 @@ ErrVal AllocateEdgeDetectionTable(
                 CEdgeDetectionTable **ppResult);
 
 
+// These convert a row of pixels into one luminance value per pixel.
+// The grayscale is (0.30 * red) + (0.59 * green) + (0.11 * blue), and
+// ranges 0-255. The color sum is (red + green + blue), and ranges 0-765.
+#define MAX_COLOR_SUM_LUMINANCE     765
+
+ErrVal ReadGrayScaleRow(
+                CImageFile *pImage,
+                int32 yPos,
+                int32 startX,
+                int32 numPixels,
+                uint32 *pPixelRow,
+                uint8 *pGrayScaleRow);
+ErrVal ReadColorSumRow(
+                CImageFile *pImage,
+                int32 yPos,
+                int32 startX,
+                int32 numPixels,
+                uint32 *pColorSumRow);
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Connected Components
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// The size and bounding box of one 8-connected group of edge pixels.
+class CEdgeComponent {
+public:
+    int32               m_NumPixels;
+    int32               m_LeftX;
+    int32               m_RightX;
+    int32               m_TopY;
+    int32               m_BottomY;
+}; // CEdgeComponent
+
+
+///////////////////////////////////////////////////////
+class CEdgeComponentTable {
+public:
+    CEdgeComponentTable();
+    virtual ~CEdgeComponentTable();
+    NEWEX_IMPL();
+
+    ErrVal Initialize(CEdgeDetectionTable *pEdgeTable);
+
+    int32 GetLabel(int32 x, int32 y);
+    CEdgeComponent *GetComponent(int32 label);
+    int32 CountEdgeNeighbors(int32 x, int32 y);
+
+    int32               m_MaxXPos;
+    int32               m_MaxYPos;
+
+    // There is one label for each pixel, stored a row at a time. Pixels
+    // that are not edges are 0. The components are labeled 1 to
+    // m_NumComponents, in the raster order of their first pixel.
+    int32               *m_pLabelPlane;
+    int32               m_NumComponents;
+    CEdgeComponent      *m_pComponentList;
+
+private:
+    static ErrVal LabelBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+    static ErrVal RelabelBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+}; // CEdgeComponentTable
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Luminance Tables
+//
+////////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////
+class CLuminanceTable {
+public:
+    CLuminanceTable();
+    virtual ~CLuminanceTable();
+    NEWEX_IMPL();
+
+    ErrVal Update(CImageFile *pImage);
+    void Discard();
+
+    void GetRectTotals(
+                int32 leftX,
+                int32 topY,
+                int32 stopX,
+                int32 stopY,
+                uint64 *pTotal,
+                uint64 *pTotalSquares);
+
+    int32               m_MaxXPos;
+    int32               m_MaxYPos;
+
+    // These are the integral images of the luminance and the square of the
+    // luminance. Entry (x, y) is the total of all pixels above and to the
+    // left of pixel (x, y), so there is one more row and one more column
+    // than in the image, and the first row and column are all 0.
+    uint64              *m_pTotalPlane;
+    uint64              *m_pSquaresPlane;
+
+private:
+    static ErrVal SumRowsBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+
+    // The planes are only valid while the image has this change number.
+    CImageFile          *m_pImage;
+    uint32              m_ChangeNumber;
+}; // CLuminanceTable
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Shape Index
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class CShapeIndexEntry;
+class CShapeIndexCellNode;
+
+///////////////////////////////////////////////////////
+class CShapeIndex {
+public:
+    CShapeIndex();
+    virtual ~CShapeIndex();
+    NEWEX_IMPL();
+
+    ErrVal Initialize(int32 imageWidth, int32 imageHeight);
+    void Discard();
+
+    ErrVal AddShape(CBioCADShape *pShape, bool fFrontOfList);
+    void RemoveShape(CBioCADShape *pShape);
+    CBioCADShape *FindShape(int32 featureID);
+
+    ErrVal FindShapesInRect(
+                int32 leftX,
+                int32 topY,
+                int32 rightX,
+                int32 bottomY,
+                CShapeIndexEntry ***ppEntryList,
+                int32 *pNumEntries);
+
+private:
+    CShapeIndexEntry *FindEntry(int32 featureID);
+    int32 GetColumn(int32 x);
+    int32 GetRow(int32 y);
+
+    // The image is split into square cells, and each cell has a list of
+    // the shapes whose bounding box touches it.
+    int32               m_NumColumns;
+    int32               m_NumRows;
+    int32               m_MaxXPos;
+    int32               m_MaxYPos;
+    CShapeIndexCellNode **m_pCellList;
+
+    // Every shape is also in a hash table of feature IDs.
+    CShapeIndexEntry    **m_pIDBucketList;
+    int32               m_NumShapes;
+
+    // These are the positions of the first and last shapes in the list.
+    int32               m_FrontPosition;
+    int32               m_BackPosition;
+
+    // The result of the last FindShapesInRect.
+    CShapeIndexEntry    **m_pResultList;
+    int32               m_MaxResults;
+}; // CShapeIndex
+
+
+// This is one shape in the index.
+class CShapeIndexEntry {
+public:
+    CBioCADShape        *m_pShape;
+
+    // Shapes nearer the front of the shape list have a lower position.
+    int32               m_ListPosition;
+
+    // These are the cells the shape was added to.
+    int32               m_LeftColumn;
+    int32               m_RightColumn;
+    int32               m_TopRow;
+    int32               m_BottomRow;
+
+    CShapeIndexEntry    *m_pNextInBucket;
+}; // CShapeIndexEntry
+
+
 
 
 
@@ -38,7 +38,7 @@
 #
 CC = g++
 CFLAGS = -c -Wall -W -g \
-   -fno-strength-reduce -static \
+   -fno-strength-reduce -static -pthread \
    -D"LINUX" \
    -DLINUX \
    -D"_DEBUG" \
@@ -70,7 +70,12 @@ SOURCES = lineDetection.cpp \
    plyFileFormat.cpp \
    bmpParser.cpp \
    excelFile.cpp \
-   perfMetrics.cpp
+   perfMetrics.cpp \
+   parallelRows.cpp \
+   connectedComponents.cpp \
+   luminanceTable.cpp \
+   shapeIndex.cpp \
+   imageBatch.cpp
 
 OBJECTS = \
       $(OUTPUT_DIR)/lineDetection.o \
@@ -80,7 +85,12 @@ OBJECTS = \
       $(OUTPUT_DIR)/plyFileFormat.o \
       $(OUTPUT_DIR)/bmpParser.o \
       $(OUTPUT_DIR)/excelFile.o \
-      $(OUTPUT_DIR)/perfMetrics.o
+      $(OUTPUT_DIR)/perfMetrics.o \
+      $(OUTPUT_DIR)/parallelRows.o \
+      $(OUTPUT_DIR)/connectedComponents.o \
+      $(OUTPUT_DIR)/luminanceTable.o \
+      $(OUTPUT_DIR)/shapeIndex.o \
+      $(OUTPUT_DIR)/imageBatch.o
 
 
 TARGET = $(OUTPUT_DIR)/libImageLib.a
@@ -119,3 +129,8 @@ $(OUTPUT_DIR)/plyFileFormat.o: plyFileFormat.cpp
 $(OUTPUT_DIR)/bmpParser.o: bmpParser.cpp
 $(OUTPUT_DIR)/excelFile.o: excelFile.cpp
 $(OUTPUT_DIR)/perfMetrics.o: perfMetrics.cpp
+$(OUTPUT_DIR)/parallelRows.o: parallelRows.cpp
+$(OUTPUT_DIR)/connectedComponents.o: connectedComponents.cpp
+$(OUTPUT_DIR)/luminanceTable.o: luminanceTable.cpp
+$(OUTPUT_DIR)/shapeIndex.o: shapeIndex.cpp
+$(OUTPUT_DIR)/imageBatch.o: imageBatch.cpp
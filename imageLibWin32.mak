@@ -49,6 +49,11 @@ LIB32_OBJS= \
       "$(OUTDIR)\plyFileFormat.obj" \
       "$(OUTDIR)\bmpParser.obj" \
       "$(OUTDIR)\perfMetrics.obj" \
+      "$(OUTDIR)\parallelRows.obj" \
+      "$(OUTDIR)\connectedComponents.obj" \
+      "$(OUTDIR)\luminanceTable.obj" \
+      "$(OUTDIR)\shapeIndex.obj" \
+      "$(OUTDIR)\imageBatch.obj" \
       "..\basicServer\Debug\basicServer.lib" \
       "..\BuildingBlocks\Debug\buildingBlocks.lib"
 
@@ -78,6 +83,11 @@ LIB32_OBJS= \
 "$(OUTDIR)\plyFileFormat.obj" : .\*.cpp
 "$(OUTDIR)\bmpParser.obj" : .\*.cpp
 "$(OUTDIR)\perfMetrics.obj" : .\*.cpp
+"$(OUTDIR)\parallelRows.obj" : .\*.cpp
+"$(OUTDIR)\connectedComponents.obj" : .\*.cpp
+"$(OUTDIR)\luminanceTable.obj" : .\*.cpp
+"$(OUTDIR)\shapeIndex.obj" : .\*.cpp
+"$(OUTDIR)\imageBatch.obj" : .\*.cpp
 
 
 ## WARNING! Do NOT put a blank line above here. It will be interpreted as
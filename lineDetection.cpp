@@ -359,18 +359,63 @@ CPerfValueAPI *g_MergeLinesTime = NULL;
 
 
 //////////////////////////////////////////////////
+// One cell of the accumulator, unpacked so it can be recorded as a line.
 class CPossibleLine {
 public:
     int32           m_NumVotes;
 
     CBioCADPoint    m_PointA;
     CBioCADPoint    m_PointB;
-    
-    bool            m_fRecorded;
 }; // CPossibleLine
 
 
 
+//////////////////////////////////////////////////
+// The votes, split into planes that are all indexed by GetVoteIndex.
+// m_pVoteCounts is the only plane that is cleared or scanned. The endpoints
+// of a cell are only written once it has a vote, and are only read for
+// cells that become lines, so those planes are never cleared.
+// An endpoint is packed as (x << 16) | y, so comparing two packed points
+// is the same as comparing x and then y.
+class CHoughAccumulator {
+public:
+    uint32          *m_pVoteCounts;
+    uint32          *m_pFirstPoints;
+    uint32          *m_pLastPoints;
+}; // CHoughAccumulator
+
+// The packed endpoints limit the size of the image.
+#define MAX_HOUGH_IMAGE_DIMENSION           65536
+
+
+
+//////////////////////////////////////////////////
+// The lines that have been recorded, hashed by their slope and intercept,
+// so a new line is only compared with lines that are nearly the same.
+// DoubleValuesAreClose compares absolute values, so a cell is a range of
+// absolute values that is as wide as the resolution. Any line that is
+// close enough is in the same cell as the new line, or in a cell next to it.
+class CLineIndexEntry {
+public:
+    CBioCADLine         *m_pLine;
+    int64               m_SlopeCell;
+    int64               m_InterceptCell;
+    CLineIndexEntry     *m_pNextEntry;
+}; // CLineIndexEntry
+
+class CLineIndex {
+public:
+    CLineIndexEntry     **m_pBuckets;
+    int32               m_NumBuckets;
+    int32               m_NumEntries;
+}; // CLineIndex
+
+// The number of buckets is always a power of 2.
+#define LINE_INDEX_INITIAL_BUCKETS          256
+#define LINE_INDEX_MAX_ENTRIES_PER_BUCKET   2
+
+
+
 //////////////////////////////////////////////////
 class CLineDetectorState {
 public:
@@ -393,14 +438,35 @@ public:
     int32               m_MaxGapBetweenDashesInLine;
     int32               m_MinUsefulLineLength;
 
+    // A cell is only a possible line if it has more votes than every other
+    // cell within m_PeakThetaRadius theta bins and m_PeakRhoRadius rho bins.
+    // If m_MaxPeaks is not 0, then only that many of the peaks with the most
+    // votes are kept.
+    int32               m_PeakThetaRadius;
+    int32               m_PeakRhoRadius;
+    int32               m_MaxPeaks;
+
+    // This bounds the work of the progressive mode. It stops after this many
+    // edge pixels have voted, or when every pixel is used up if this is 0.
+    int32               m_MaxProgressiveSamples;
+
+    // The pyramid mode first looks for lines in an image that is this many
+    // times smaller in each dimension.
+    int32               m_PyramidScale;
+
     // Voting statistics
     int32               m_NumPossibleLines;
     int32               m_NumLinesWithMinVotes;
+    int32               m_NumPeaks;
+    int32               m_NumProgressiveSamples;
+    int32               m_NumRefinedLines;
     int32               m_NumDuplicateLines;
  
     // The lines we actually find
     CBioCADLine         *m_pLineList;
     int32               m_NumLines;
+    CLineIndex          m_LineIndex;
+    CBioCADArena        m_Arena;
 
     // The range of possible values for theta and rho
     // These are for theta
@@ -409,6 +475,14 @@ public:
     double              m_PerpendicularLineAngleModulo;
     double              m_AngleIncrement;
     int32               m_NumPossibleAngleValues;
+    // Theta is voted on as an integer bin. Bin t is the angle
+    // (m_MinPerpendicularLineAngle + (t * m_AngleIncrement)), and these
+    // tables hold its cos and sin.
+    int32               m_NumAngleBins;
+    int32               m_AngleRangeAroundGradientInBins;
+    double              *m_pCosTable;
+    double              *m_pSinTable;
+    double              m_RhoBias;
     // These are for rho
     double              m_MinPerpendicularLength;
     double              m_MaxPerpendicularLength;
@@ -416,12 +490,76 @@ public:
     // Used for all angles.
     double              m_AngleRangeAroundGradientInRadians;
 
-    CPossibleLine       *m_pVoteArray;
+    CHoughAccumulator   m_Accumulator;
     int32               m_NumEntriesInVoteArray;
 }; // CLineDetectorState
 
 
 
+//////////////////////////////////////////////////
+// This is everything the voting bands share. Each band has its own
+// accumulator and its own row of the edges image.
+class CHoughVotingPass {
+public:
+    CLineDetectorState  *m_pDetectorState;
+    CEdgeDetectionTable *m_pLuminanceMap;
+
+    int32               m_NumBands;
+    CHoughAccumulator   m_BandAccumulators[MAX_ROW_BANDS];
+    uint32              *m_pEdgeRows;
+}; // CHoughVotingPass
+
+// Each voting thread does at least this many rows.
+#define HOUGH_MIN_ROWS_PER_BAND             32
+
+// The most memory to use for the accumulators of bands other than band 0.
+#define MAX_HOUGH_BAND_VOTE_ARRAY_BYTES     ((int64) 256 * 1024 * 1024)
+#define HOUGH_BYTES_PER_CELL                (3 * sizeof(uint32))
+
+
+
+//////////////////////////////////////////////////
+// The state of the progressive mode. There is one state byte for every
+// pixel in the bounding box, and a list of every edge pixel, which is
+// packed as (x << 16) | y and shuffled into the order they vote.
+class CProgressiveHoughPass {
+public:
+    CLineDetectorState  *m_pDetectorState;
+    CEdgeDetectionTable *m_pLuminanceMap;
+
+    uint8               *m_pPixelStates;
+    uint32              *m_pEdgePixels;
+    int32               m_NumEdgePixels;
+}; // CProgressiveHoughPass
+
+// These are the states of a pixel in the progressive mode.
+#define PROGRESSIVE_PIXEL_UNUSED            0
+#define PROGRESSIVE_PIXEL_WAITING           1
+#define PROGRESSIVE_PIXEL_VOTED             2
+
+#define PROGRESSIVE_HOUGH_RANDOM_SEED       2463534242U
+
+
+
+//////////////////////////////////////////////////
+// The pyramid mode refines each coarse line with a small accumulator that
+// only covers theta bins [m_MinThetaBin, m_StopThetaBin), and all rho bins.
+class CPyramidWindow {
+public:
+    CHoughAccumulator   m_Accumulator;
+    int32               m_MinThetaBin;
+    int32               m_StopThetaBin;
+}; // CPyramidWindow
+
+// A coarse block with no edge pixels.
+#define PYRAMID_NO_PIXEL                    0xFFFFFFFF
+
+// A coarse line is refined with the pixels within this many blocks of it,
+// and the angles within this many coarse theta bins of it.
+#define PYRAMID_BAND_BLOCKS                 2
+
+
+
 static ErrVal RecordOneLine(
                     CPossibleLine *pPossibleLine,
                     CLineDetectorState *pDetectorState);
@@ -434,40 +572,212 @@ static bool OverlapNewLineWithExistingLines(
 
 static ErrVal DrawLines(CImageFile *pDestImage, CBioCADLine *pLineList);
 
+static ErrVal InitHoughSpace(CLineDetectorState *pDetectorState, int32 width, int32 height);
+static ErrVal BuildTrigTables(CLineDetectorState *pDetectorState);
+static ErrVal AllocateHoughAccumulator(CHoughAccumulator *pAccumulator, int32 numEntries);
+static void FreeHoughAccumulator(CHoughAccumulator *pAccumulator);
+static ErrVal DetectLinesFromAllVotes(CLineDetectorState *pDetectorState, CEdgeDetectionTable *pLuminanceMap);
+static ErrVal DetectLinesProgressively(CLineDetectorState *pDetectorState, CEdgeDetectionTable *pLuminanceMap);
+static ErrVal ExtractProgressiveSegment(
+                    CProgressiveHoughPass *pPass,
+                    int32 x,
+                    int32 y,
+                    int32 thetaBin,
+                    uint32 numVotes);
+static void RemoveProgressivePixel(CProgressiveHoughPass *pPass, int32 x, int32 y, bool fRemoveVotes);
+static ErrVal DetectLinesWithPyramid(CLineDetectorState *pDetectorState, CEdgeDetectionTable *pLuminanceMap);
+static ErrVal RefinePyramidLine(
+                    CLineDetectorState *pDetectorState,
+                    CEdgeDetectionTable *pLuminanceMap,
+                    uint8 *pEdgeMask,
+                    int32 scale,
+                    int32 centerThetaBin,
+                    double rho);
+static void VoteInPyramidWindow(
+                    CLineDetectorState *pDetectorState,
+                    CEdgeDetectionTable *pLuminanceMap,
+                    uint8 *pEdgeMask,
+                    CPyramidWindow *pWindow,
+                    int32 x,
+                    int32 y);
+static ErrVal ReadEdgePixelMask(
+                    CLineDetectorState *pDetectorState,
+                    uint8 edgeValue,
+                    uint8 *pMask,
+                    int32 *pNumEdgePixels);
+static void GetThetaBinsForPixel(
+                    CLineDetectorState *pDetectorState,
+                    CEdgeDetectionTable *pLuminanceMap,
+                    int32 x,
+                    int32 y,
+                    int32 *pStartThetaBin,
+                    int32 *pStopThetaBin);
+static ErrVal VoteForLinesInBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+static ErrVal MergeBandVotes(void *pContext, int32 bandNum, int32 startRow, int32 stopRow);
+static ErrVal FindHoughPeaks(CLineDetectorState *pDetectorState, int32 **ppPeakList, int32 *pNumPeaks);
+static bool IsHoughPeak(CLineDetectorState *pDetectorState, int32 thetaBin, int32 rhoBin);
+static ErrVal KeepStrongestPeaks(CLineDetectorState *pDetectorState, int32 *pPeakList, int32 *pNumPeaks);
+static bool MergeIfLinesOverlap(
+                    CPossibleLine *pPossibleLine,
+                    double slope,
+                    double yIntercept,
+                    CBioCADLine *pExistingLine,
+                    CLineDetectorState *pDetectorState);
+static ErrVal InitLineIndex(CLineIndex *pIndex);
+static void FreeLineIndex(CLineIndex *pIndex);
+static ErrVal AddLineToIndex(CLineDetectorState *pDetectorState, CBioCADLine *pLine);
+static void InsertLineIndexEntry(CLineDetectorState *pDetectorState, CLineIndexEntry *pEntry);
+static void GrowLineIndex(CLineIndex *pIndex);
+
 
 
 
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Votes are stored in a 2D-array that is indexed by angle and theta.
+// Votes are stored in a 2D-array that is indexed by rho and theta.
+// Both are already offsets from the smallest value, so they range
+// 0...m_NumPossibleLengthValues and 0...m_NumAngleBins-1.
 /////////////////////////////////////////////////////////////////////////////
-static inline CPossibleLine *
-GetPossibleLine(CLineDetectorState *pDetectorState, double theta, double rho) {
-    CPossibleLine *pResult = NULL;
-    double thetaOffset;
-    double rhoOffset;
-    double numThetaIncrements;
-    int32 intThetaOffset;
-    int32 intRhoOffset;
+static inline int32
+GetVoteIndex(CLineDetectorState *pDetectorState, int32 thetaBin, int32 rhoBin) {
     int32 index;
 
-    // These are numbers that range from -n, -n+1, ...-1, 0, 1, .....n-1, n
-    // Convert them into positive offsets.
-    thetaOffset = theta - pDetectorState->m_MinPerpendicularLineAngle;
-    rhoOffset = rho - pDetectorState->m_MinPerpendicularLength;
+    index = (rhoBin * pDetectorState->m_NumAngleBins) + thetaBin;
+    ASSERT((index >= 0) && (index < pDetectorState->m_NumEntriesInVoteArray));
+    return(index);
+} // GetVoteIndex
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Compute the length of the perpendicular from a pixel to the line at
+// thetaBin, and round it to a bin.
+/////////////////////////////////////////////////////////////////////////////
+static inline int32
+GetRhoBin(CLineDetectorState *pDetectorState, int32 thetaBin, int32 x, int32 y) {
+    int32 rhoBin;
+
+    rhoBin = (int32) ((((double) x) * pDetectorState->m_pCosTable[thetaBin])
+                        - (((double) y) * pDetectorState->m_pSinTable[thetaBin])
+                        + pDetectorState->m_RhoBias);
+    if (rhoBin < 0) {
+        rhoBin = 0;
+    }
+    if (rhoBin > pDetectorState->m_NumPossibleLengthValues) {
+        rhoBin = pDetectorState->m_NumPossibleLengthValues;
+    }
+    return(rhoBin);
+} // GetRhoBin
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Get the progressive-mode state of a pixel in the bounding box.
+/////////////////////////////////////////////////////////////////////////////
+static inline uint8 *
+GetProgressivePixelState(CProgressiveHoughPass *pPass, int32 x, int32 y) {
+    CLineDetectorState *pDetectorState = pPass->m_pDetectorState;
+
+    return(pPass->m_pPixelStates
+            + ((y - pDetectorState->m_MinYPos) * pDetectorState->m_Width)
+            + (x - pDetectorState->m_MinXPos));
+} // GetProgressivePixelState
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Add one vote for a line from a pixel, which is packed as (x << 16) | y.
+// Remember, this uses the real (x,y) which ranges from x=minX....maxX,
+// and y=minY....maxY.
+/////////////////////////////////////////////////////////////////////////////
+static inline void
+AddVote(CHoughAccumulator *pAccumulator, int32 index, uint32 packedPoint) {
+    if (0 == pAccumulator->m_pVoteCounts[index]) {
+        pAccumulator->m_pFirstPoints[index] = packedPoint;
+        pAccumulator->m_pLastPoints[index] = packedPoint;
+    } else {
+        if (packedPoint < pAccumulator->m_pFirstPoints[index]) {
+            pAccumulator->m_pFirstPoints[index] = packedPoint;
+        }
+        if (packedPoint > pAccumulator->m_pLastPoints[index]) {
+            pAccumulator->m_pLastPoints[index] = packedPoint;
+        }
+    }
+    pAccumulator->m_pVoteCounts[index] += 1;
+} // AddVote
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Find the cell of the line index for a slope or intercept.
+/////////////////////////////////////////////////////////////////////////////
+static inline int64
+GetLineIndexCell(double value, double resolution) {
+    if (value < 0) {
+        value = -value;
+    }
+    if (resolution <= 0) {
+        resolution = 1;
+    }
+    return((int64) (value / resolution));
+} // GetLineIndexCell
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Hash a cell of the line index to one of its buckets.
+/////////////////////////////////////////////////////////////////////////////
+static inline int32
+GetLineIndexBucket(CLineIndex *pIndex, int64 slopeCell, int64 interceptCell) {
+    uint64 hash;
+
+    hash = ((uint64) slopeCell * 0x9E3779B97F4A7C15ULL) ^ ((uint64) interceptCell * 0xC2B2AE3D27D4EB4FULL);
+    hash = hash ^ (hash >> 29);
+    return((int32) (hash & (uint64) (pIndex->m_NumBuckets - 1)));
+} // GetLineIndexBucket
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// If (x, y) is an edge pixel, then add it to the pixels of a line.
+// The caller allocated enough space for every pixel it checks.
+/////////////////////////////////////////////////////////////////////////////
+static inline void
+AddLinePixelIfEdge(CLineDetectorState *pDetectorState, CBioCADLine *pLine, int32 x, int32 y) {
+    ErrVal err = ENoErr;
+    uint32 pixelValue;
+
+    err = pDetectorState->m_pEdgesImage->GetPixel(x, y, &pixelValue);
+    if ((err) || (pixelValue != pDetectorState->m_BlackPixel)) {
+        return;
+    }
+
+    pLine->m_pPixels[pLine->m_NumPixels].m_X = x;
+    pLine->m_pPixels[pLine->m_NumPixels].m_Y = y;
+    pLine->m_NumPixels += 1;
+
+    //<><>
+    pDetectorState->m_pFullImage->SetPixel(x, y, 0x0000FF);
+    //<><>
+} // AddLinePixelIfEdge
 
-    // The angle has limited precision. So convert it into a multiple of precision units.
-    numThetaIncrements = (thetaOffset / pDetectorState->m_AngleIncrement);
 
-    intThetaOffset = RoundDoubleToInt(numThetaIncrements);
-    intRhoOffset = RoundDoubleToInt(rhoOffset);
 
-    index = (intRhoOffset * pDetectorState->m_NumPossibleAngleValues) + intThetaOffset;
-    ASSERT(index < pDetectorState->m_NumEntriesInVoteArray);
-    pResult = &((pDetectorState->m_pVoteArray)[index]);
+/////////////////////////////////////////////////////////////////////////////
+// Unpack one cell of the accumulator.
+/////////////////////////////////////////////////////////////////////////////
+static inline void
+GetPossibleLine(CHoughAccumulator *pAccumulator, int32 index, CPossibleLine *pResult) {
+    pResult->m_NumVotes = (int32) (pAccumulator->m_pVoteCounts[index]);
 
-    return(pResult);
+    pResult->m_PointA.m_X = (int32) (pAccumulator->m_pFirstPoints[index] >> 16);
+    pResult->m_PointA.m_Y = (int32) (pAccumulator->m_pFirstPoints[index] & 0xFFFF);
+    pResult->m_PointA.m_Z = 0;
+
+    pResult->m_PointB.m_X = (int32) (pAccumulator->m_pLastPoints[index] >> 16);
+    pResult->m_PointB.m_Y = (int32) (pAccumulator->m_pLastPoints[index] & 0xFFFF);
+    pResult->m_PointB.m_Z = 0;
 } // GetPossibleLine
 
 
@@ -499,15 +809,6 @@ DetectLines(
         CImageFile *pRebuiltLineImage,
         CBioCADLineSet *pLineList) {
     ErrVal err = ENoErr;
-    double theta;
-    double rho;
-    double startTheta;
-    double endTheta;
-    int32 lineArraySize;
-    CPossibleLine *pPossibleLine;
-    int32 x;
-    int32 y;
-    uint32 pixelValue;
     CLineDetectorState detectorState;
     
     ProfilerDeclareGroup(g_LineDetectionPerf, "LineDetection");
@@ -516,8 +817,15 @@ DetectLines(
 
 
     detectorState.m_pLineList = NULL;
-    detectorState.m_pVoteArray = NULL;
+    detectorState.m_Accumulator.m_pVoteCounts = NULL;
+    detectorState.m_LineIndex.m_pBuckets = NULL;
+    detectorState.m_LineIndex.m_NumBuckets = 0;
+    detectorState.m_LineIndex.m_NumEntries = 0;
+    detectorState.m_Accumulator.m_pFirstPoints = NULL;
+    detectorState.m_Accumulator.m_pLastPoints = NULL;
     detectorState.m_NumEntriesInVoteArray = 0;
+    detectorState.m_pCosTable = NULL;
+    detectorState.m_pSinTable = NULL;
     
     if ((NULL == pFullImage) || (NULL == pEdgesImage)) {
         gotoErr(EFail);
@@ -526,6 +834,9 @@ DetectLines(
     // Statistics.
     detectorState.m_NumPossibleLines = 0;
     detectorState.m_NumLinesWithMinVotes = 0;
+    detectorState.m_NumPeaks = 0;
+    detectorState.m_NumProgressiveSamples = 0;
+    detectorState.m_NumRefinedLines = 0;
     detectorState.m_NumDuplicateLines = 0;    
     detectorState.m_NumLines = 0;
     detectorState.m_NumDuplicateLines = 0;
@@ -558,10 +869,6 @@ DetectLines(
     // sensitive to get good results.
     detectorState.m_AngleIncrement = 0.01;
 
-    detectorState.m_NumPossibleAngleValues = (uint32) (double) ((detectorState.m_MaxPerpendicularLineAngle 
-                                                                    - detectorState.m_MinPerpendicularLineAngle)
-                                                                / detectorState.m_AngleIncrement);
-
     // These values are just a wild guess. Basically, I am trying to ignore the tiny lines, 
     // or lines that intersect random unrelated points. This defines the sensitivity of
     // the algorithm.
@@ -573,6 +880,11 @@ DetectLines(
         detectorState.m_AngleResolutionInRadians = 0.4;
         detectorState.m_MaxGapBetweenDashesInLine = 10;
         detectorState.m_MinUsefulLineLength = 5;   //<> Last-Working-Value = 20
+        detectorState.m_PeakThetaRadius = 2;
+        detectorState.m_PeakRhoRadius = 2;
+        detectorState.m_MaxPeaks = 0;
+        detectorState.m_MaxProgressiveSamples = 0;
+        detectorState.m_PyramidScale = 4;
     } else {
         detectorState.m_MinVotesForRealLine = 90; // <>Last-Working-Value = 50; Tried 10(great but slow), 20(great but slow)
         // At least 1 pixel for every N spaces.
@@ -581,6 +893,11 @@ DetectLines(
         detectorState.m_AngleResolutionInRadians = 0.4;
         detectorState.m_MaxGapBetweenDashesInLine = 10;
         detectorState.m_MinUsefulLineLength = 50;   //<> Last-Working-Value = 20
+        detectorState.m_PeakThetaRadius = 2;
+        detectorState.m_PeakRhoRadius = 2;
+        detectorState.m_MaxPeaks = 0;
+        detectorState.m_MaxProgressiveSamples = 0;
+        detectorState.m_PyramidScale = 4;
     }
     
 
@@ -605,217 +922,52 @@ DetectLines(
             gotoErr(err);
         }
     }
+    if ((detectorState.m_MaxXPos > MAX_HOUGH_IMAGE_DIMENSION)
+            || (detectorState.m_MaxYPos > MAX_HOUGH_IMAGE_DIMENSION)) {
+        gotoErr(EFail);
+    }
     detectorState.m_Width = detectorState.m_MaxXPos - detectorState.m_MinXPos;
     detectorState.m_Height = detectorState.m_MaxYPos - detectorState.m_MinYPos;
+    if (detectorState.m_Width < 0) {
+        detectorState.m_Width = 0;
+    }
+    if (detectorState.m_Height < 0) {
+        detectorState.m_Height = 0;
+    }
     
 
-    // Compute the maximum size of a line. This is the length of the 
-    // main diagonal across the rectangular image.
-    detectorState.m_MaxPerpendicularLength
-        = (uint32) (sqrt((double) (detectorState.m_Width * detectorState.m_Width) 
-                         + (double) (detectorState.m_Height * detectorState.m_Height)));
-    detectorState.m_MinPerpendicularLength = -(detectorState.m_MaxPerpendicularLength);
-    detectorState.m_NumPossibleLengthValues = (int32) (2 * detectorState.m_MaxPerpendicularLength);
-
-
-    detectorState.m_NumEntriesInVoteArray = (detectorState.m_NumPossibleLengthValues + 1) 
-                                            * (detectorState.m_NumPossibleAngleValues + 1);
-    lineArraySize = detectorState.m_NumEntriesInVoteArray * sizeof(CPossibleLine);
-    // Make sure it is initalized to all 0's.
-    detectorState.m_pVoteArray = (CPossibleLine *) memCalloc(lineArraySize);
-    if (NULL == detectorState.m_pVoteArray) {
-        gotoErr(EFail);
+    err = InitHoughSpace(&detectorState, detectorState.m_Width, detectorState.m_Height);
+    if (err) {
+        gotoErr(err);
     }
 
-    ProfilerStartTimer(g_ReadBitmapTime);
-
-    // Examine every pixel in the image to find all lines.
-    // NOTE: I index the voting arrays with a 0-based index, and that ranges x=0...Width, y=0...height.
-    // But, the image itself is indexed with x=minX....maxX, and y=minY....maxY.
-    for (x = detectorState.m_MinXPos; x < detectorState.m_MaxXPos; x++) {
-        for (y = detectorState.m_MinYPos; y < detectorState.m_MaxYPos; y++) {
-            bool fPixelMayBePartOfLine = false;
-
-            err = pEdgesImage->GetPixel(x, y, &pixelValue);
-            if (err)  {
-                gotoErr(err);
-            }
-            fPixelMayBePartOfLine = (pixelValue == detectorState.m_BlackPixel);
-
-            // If this is a black pixel, then use it to vote for every line that
-            // can pass through this pixel.
-            if (fPixelMayBePartOfLine) {
-                double perpendicularLineLength;
-                double perpendicularLineAngleInRadians;
-                double cosAngle;
-                double sinAngle;
-                // Leave all these as signed. The grayscale values ate unsigned 0-255 
-                // values, but we want to convert this into changes in luminance, 
-                // which can be positive or negative.
-                int32 pixelAbove;
-                int32 pixelBelow;
-                int32 pixelLeft;
-                int32 pixelRight;
-                int32 pixelAboveLeft;
-                int32 pixelAboveRight;
-                int32 pixelBelowLeft;
-                int32 pixelBelowRight;
-                int32 rowGradient;
-                int32 colGradient;
-
-
-                // Get the luminance of all surrounding pixels
-                pixelAbove = pLuminanceMap->GetLuminance(x, y-1);
-                pixelBelow = pLuminanceMap->GetLuminance(x, y+1); 
-                pixelLeft = pLuminanceMap->GetLuminance(x-1, y);
-                pixelRight = pLuminanceMap->GetLuminance(x+1, y);
-                pixelAboveLeft = pLuminanceMap->GetLuminance(x-1, y-1);
-                pixelAboveRight = pLuminanceMap->GetLuminance(x+1, y-1);
-                pixelBelowLeft = pLuminanceMap->GetLuminance(x-1, y+1);
-                pixelBelowRight = pLuminanceMap->GetLuminance(x+1, y+1);
-
-                // Use the convolution matrices to get the change in the 
-                // X and Y dimensions. These are basis vectors for the net change
-                // in luminence at this point. The net change in luminence is
-                // the same as the direction the dark-pixels are in. Those dark
-                // pixels may be part of a line we are looking for.
-                rowGradient = ((2*pixelBelow) + pixelBelowLeft + pixelBelowRight) 
-                            - ((2*pixelAbove) + pixelAboveLeft + pixelAboveRight);
-
-                colGradient = ((2*pixelLeft) + pixelAboveLeft + pixelBelowLeft)
-                            - ((2*pixelRight) + pixelAboveRight + pixelBelowRight);
-
-
-                // Now, use the lengths of the 2 basis vectors to get the angle of the line.
-                // Remember, the rowGradient is the difference between rows,
-                // so it is the change in the Y direction. The colGradient is the difference
-                // between columns, so it is the change in the X direction.
-                perpendicularLineAngleInRadians = atan2((double) rowGradient, (double) colGradient);
-
-                // Lines are non-directional. This means 2 lines with angles theta and theta+Pi are 
-                // the same. One is just the other rotated by pi radians (180 degrees) so it is just
-                // reversed direction.
-                if (perpendicularLineAngleInRadians < detectorState.m_MinPerpendicularLineAngle) {
-                    perpendicularLineAngleInRadians = perpendicularLineAngleInRadians 
-                                    + detectorState.m_PerpendicularLineAngleModulo;
-                }
-
-                if (perpendicularLineAngleInRadians >= detectorState.m_MaxPerpendicularLineAngle) {
-                    perpendicularLineAngleInRadians = perpendicularLineAngleInRadians 
-                                    - detectorState.m_PerpendicularLineAngleModulo;
-                }
-
-                // Round the angle. This is important because we want pixels that are on the
-                // same pixelated line to derive the same abstract line. So, don't get too precise,
-                // or very nearly colinear points will think they are totally different.
-                perpendicularLineAngleInRadians = LimitDoubleToFixedPrecision(
-                                                            perpendicularLineAngleInRadians, 
-                                                            detectorState.m_AngleIncrement);
-
-
-                // If the gradient function were perfect, then we would use it as the perpendicular
-                // angle and be done. However, the image may not be perfect. There may be noise pixels
-                // around, which change the gradient. Moreover, all lines are pixelated, so a local
-                // gradient is different than the line's true gradient. So, instead consider all
-                // possible angles around the grandient angle and vote for them all.
-                startTheta = perpendicularLineAngleInRadians - detectorState.m_AngleRangeAroundGradientInRadians;
-                if (startTheta < detectorState.m_MinPerpendicularLineAngle) {
-                    startTheta = detectorState.m_MinPerpendicularLineAngle;
-                }
-                if (startTheta >= detectorState.m_MaxPerpendicularLineAngle) {
-                    startTheta = detectorState.m_MaxPerpendicularLineAngle;
-                }
-                endTheta = perpendicularLineAngleInRadians + detectorState.m_AngleRangeAroundGradientInRadians;
-                if (endTheta < detectorState.m_MinPerpendicularLineAngle) {
-                    endTheta = detectorState.m_MinPerpendicularLineAngle;
-                }
-                if (endTheta >= detectorState.m_MaxPerpendicularLineAngle) {
-                    endTheta = detectorState.m_MaxPerpendicularLineAngle;
-                }
-                // Sweep through all possible angles and vote for every line in that range.
-                for (theta = startTheta; theta < endTheta; theta += detectorState.m_AngleIncrement) {
-                    // Compute the length of the perpendicular.
-                    cosAngle = cos(theta);
-                    sinAngle = sin(theta);
-                    perpendicularLineLength = (((double) x) * cosAngle) - (((double) y) * sinAngle);
-                    if (perpendicularLineLength < detectorState.m_MinPerpendicularLength) {
-                        perpendicularLineLength = detectorState.m_MinPerpendicularLength;
-                    }
-                    if (perpendicularLineLength > detectorState.m_MaxPerpendicularLength) {
-                        perpendicularLineLength = detectorState.m_MaxPerpendicularLength;
-                    }
-
-                    pPossibleLine = GetPossibleLine(
-                                        &detectorState,
-                                        theta, 
-                                        perpendicularLineLength);
-
-                    // Record the endpoints for each line. Remember, this uses the real (x,y) which
-                    // ranges from x=minX....maxX, and y=minY....maxY.
-                    if (0 == pPossibleLine->m_NumVotes) {
-                        pPossibleLine->m_PointA.m_X = x;
-                        pPossibleLine->m_PointA.m_Y = y;
-                        pPossibleLine->m_PointA.m_Z = 0;
-
-                        pPossibleLine->m_PointB.m_X = x;
-                        pPossibleLine->m_PointB.m_Y = y;
-                        pPossibleLine->m_PointB.m_Z = 0;
-                    } else {
-                        if ((x < pPossibleLine->m_PointA.m_X)
-                            || ((x == pPossibleLine->m_PointA.m_X) && (y < pPossibleLine->m_PointA.m_Y))) {
-                            pPossibleLine->m_PointA.m_X = x;
-                            pPossibleLine->m_PointA.m_Y = y;
-                            pPossibleLine->m_PointA.m_Z = 0;
-                        }
-                        if ((x > pPossibleLine->m_PointB.m_X)
-                            || ((x == pPossibleLine->m_PointB.m_X) && (y > pPossibleLine->m_PointB.m_Y))) {
-                            pPossibleLine->m_PointB.m_X = x;
-                            pPossibleLine->m_PointB.m_Y = y;
-                            pPossibleLine->m_PointB.m_Z = 0;
-                        }
-                    }
-                    pPossibleLine->m_NumVotes += 1;
-                } // for (rho = startTheta; rho < endTheta; rho += detectorState.m_AngleIncrement)
-            } // if (pixelValue == detectorState.m_BlackPixel)
-        } // for (y = 0; y < detectorState.m_MaxYPos; y++)
-    } // for (x = 0; x < detectorState.m_MaxXPos; x++)
-
-    ProfilerStopTimer(g_ReadBitmapTime);
-    ProfilerStartTimer(g_MergeLinesTime);
-
-    // Put all possible lines with a minimum number of votes on a linked list.
-    detectorState.m_NumPossibleLines = 0;
-    detectorState.m_NumLinesWithMinVotes = 0;
-    for (theta = detectorState.m_MinPerpendicularLineAngle; 
-        theta < detectorState.m_MaxPerpendicularLineAngle; 
-        theta += detectorState.m_AngleIncrement) {
-        for (rho = detectorState.m_MinPerpendicularLength; 
-            rho < detectorState.m_MaxPerpendicularLength; 
-            rho++) {
-            detectorState.m_NumPossibleLines += 1;
-            pPossibleLine = GetPossibleLine(&detectorState, theta, rho);
-            // Be careful here. theta and rho may round and so the
-            // same entry can be returned for different values. This can
-            // cause unnecessary duplicated lines.
-            if ((pPossibleLine->m_NumVotes >= detectorState.m_MinVotesForRealLine)
-                && !(pPossibleLine->m_fRecorded)) {
-                pPossibleLine->m_fRecorded = true;
-                detectorState.m_NumLinesWithMinVotes += 1;
-
-                err = RecordOneLine(pPossibleLine, &detectorState);
-                if (err) {
-                    gotoErr(err);
-                }
-            } // if (pPossibleLine->m_NumVotes >= detectorState.m_MinVotesForRealLine)
-        } // for (rho = 0; rho < detectorState.m_MaxPerpendicularLength; rho++)
-    } // for (theta = 0; theta < detectorState.m_MaxPerpendicularLineAngle; theta += detectorState.m_AngleIncrement)
+    // The pyramid mode only needs small accumulators of its own.
+    if (!(options & CELL_GEOMETRY_LINE_DETECTION_PYRAMID)) {
+        err = AllocateHoughAccumulator(&(detectorState.m_Accumulator), detectorState.m_NumEntriesInVoteArray);
+        if (err) {
+            gotoErr(err);
+        }
+    }
 
+    err = InitLineIndex(&(detectorState.m_LineIndex));
+    if (err) {
+        gotoErr(err);
+    }
 
-    ProfilerStopTimer(g_MergeLinesTime);
+    if (options & CELL_GEOMETRY_LINE_DETECTION_PYRAMID) {
+        err = DetectLinesWithPyramid(&detectorState, pLuminanceMap);
+    } else if (options & CELL_GEOMETRY_LINE_DETECTION_PROGRESSIVE) {
+        err = DetectLinesProgressively(&detectorState, pLuminanceMap);
+    } else {
+        err = DetectLinesFromAllVotes(&detectorState, pLuminanceMap);
+    }
+    if (err) {
+        gotoErr(err);
+    }
 
     // The vote array is huge, so delete it before we do anything else.
-    memFree(detectorState.m_pVoteArray);
-    detectorState.m_pVoteArray = NULL;
+    FreeLineIndex(&(detectorState.m_LineIndex));
+    FreeHoughAccumulator(&(detectorState.m_Accumulator));
     // Ahhh, see? Main memory feels much better now.
 
 
@@ -823,6 +975,9 @@ DetectLines(
     printf("\nLine Detection:\n");
     printf("NumPossibleLines = %d\n", detectorState.m_NumPossibleLines);
     printf("NumLinesWithMinVotes = %d\n", detectorState.m_NumLinesWithMinVotes);
+    printf("NumPeaks = %d\n", detectorState.m_NumPeaks);
+    printf("NumProgressiveSamples = %d\n", detectorState.m_NumProgressiveSamples);
+    printf("NumRefinedLines = %d\n", detectorState.m_NumRefinedLines);
     printf("NumDuplicateLines = %d\n", detectorState.m_NumDuplicateLines);
     printf("NumLines = %d\n", detectorState.m_NumLines);
     printf("\n\n");
@@ -833,6 +988,8 @@ DetectLines(
     if (pLineList) {
         ((CBioCADLineSet *) pLineList)->SetLineList(detectorState.m_pLineList);
         detectorState.m_pLineList = NULL;
+        // The line set owns the lines and their pixels.
+        pLineList->m_Arena.TakeAll(&(detectorState.m_Arena));
 
         pLineList->FilterLines(CBioCADLineSet::FILTER_BY_MIN_LENGTH, detectorState.m_MinUsefulLineLength);
         // <> Don't do this yet. I don't yet combine the pixel lists when I combine 2 lines 
@@ -859,8 +1016,10 @@ DetectLines(
 
 
 abort:
-    memFree(detectorState.m_pVoteArray);
-    detectorState.m_pVoteArray = NULL;
+    FreeLineIndex(&(detectorState.m_LineIndex));
+    FreeHoughAccumulator(&(detectorState.m_Accumulator));
+    memFree(detectorState.m_pCosTable);
+    memFree(detectorState.m_pSinTable);
 
     returnErr(err);
 } // DetectLines
@@ -870,179 +1029,115 @@ abort:
 
 
 
-
-
 /////////////////////////////////////////////////////////////////////////////
 //
-// [RecordOneLine]
+// [DetectLinesFromAllVotes]
 //
+// This is the standard Hough algorithm. Every edge pixel votes, and then
+// the peaks of the votes are recorded as lines.
 /////////////////////////////////////////////////////////////////////////////
-ErrVal
-RecordOneLine(CPossibleLine *pPossibleLine, CLineDetectorState *pDetectorState) {
+static ErrVal
+DetectLinesFromAllVotes(CLineDetectorState *pDetectorState, CEdgeDetectionTable *pLuminanceMap) {
     ErrVal err = ENoErr;
-    CBioCADLine *pLine;
-    CBioCADPoint *pPixel;
-    int32 deltaY = 0;
-    int32 deltaX = 0;
-    bool fUsefulLine = false;
-    double slope;
-    double yIntercept;
-    int32 x;
-    int32 y;
-    double theoreticalY;
-    uint32 pixelValue;
-    double density;
-    bool fPixelMayBePartOfLine = false;
-
-
-    if ((NULL == pPossibleLine) || (NULL == pDetectorState))
-    {
-        gotoErr(EFail);
-    }
-    fUsefulLine = true;
-
-    deltaX = pPossibleLine->m_PointB.m_X - pPossibleLine->m_PointA.m_X;
-    deltaY = pPossibleLine->m_PointB.m_Y - pPossibleLine->m_PointA.m_Y;
-
-    // Treat vertical lines as "almost" vertical so the slope can be calculated
-    if (0 == deltaX)
-    {
-        deltaX = 1;
+    int32 lineArraySize;
+    int32 *pPeakList = NULL;
+    int32 numPeaks = 0;
+    int32 peakNum;
+    CPossibleLine possibleLine;
+    CHoughVotingPass votingPass;
+    int32 maxExtraBands;
+    int32 bandNum;
+
+    votingPass.m_NumBands = 0;
+    votingPass.m_pEdgeRows = NULL;
+
+    // Band 0 votes directly into the main accumulator, and every other band
+    // gets its own. Those can be big, so use fewer bands rather than a lot
+    // of memory.
+    lineArraySize = pDetectorState->m_NumEntriesInVoteArray * HOUGH_BYTES_PER_CELL;
+    votingPass.m_pDetectorState = pDetectorState;
+    votingPass.m_pLuminanceMap = pLuminanceMap;
+    votingPass.m_NumBands = GetNumRowBands(pDetectorState->m_Height, HOUGH_MIN_ROWS_PER_BAND);
+    if (lineArraySize > 0) {
+        maxExtraBands = (int32) (MAX_HOUGH_BAND_VOTE_ARRAY_BYTES / ((int64) lineArraySize));
+        if (votingPass.m_NumBands > (maxExtraBands + 1)) {
+            votingPass.m_NumBands = maxExtraBands + 1;
+        }
     }
-
-    slope = ((double) deltaY) / ((double) deltaX);
-    // y = mx + b so, after some algebra  b = y - mx
-    yIntercept = ((double) pPossibleLine->m_PointA.m_Y) - (slope * ((double) pPossibleLine->m_PointA.m_X));
-
-
-    fUsefulLine = OverlapNewLineWithExistingLines(pPossibleLine, slope, yIntercept, pDetectorState);
-    if (!fUsefulLine)
-    {
-        pDetectorState->m_NumDuplicateLines += 1;
-        goto abort;
+    votingPass.m_BandAccumulators[0] = pDetectorState->m_Accumulator;
+    for (bandNum = 1; bandNum < votingPass.m_NumBands; bandNum++) {
+        err = AllocateHoughAccumulator(
+                    &(votingPass.m_BandAccumulators[bandNum]),
+                    pDetectorState->m_NumEntriesInVoteArray);
+        if (err) {
+            // Just run with the bands we could allocate.
+            votingPass.m_NumBands = bandNum;
+            err = ENoErr;
+            break;
+        }
     }
 
-    pLine = newex CBioCADLine;
-    if (NULL == pLine)
-    {
+    votingPass.m_pEdgeRows = (uint32 *) memAlloc(sizeof(uint32) * (pDetectorState->m_Width + 1) * votingPass.m_NumBands);
+    if (NULL == votingPass.m_pEdgeRows) {
         gotoErr(EFail);
     }
 
-    pLine->m_PointA = pPossibleLine->m_PointA;
-    pLine->m_PointB = pPossibleLine->m_PointB;
-    pLine->m_Slope = slope;
-    pLine->m_YIntercept = yIntercept;
-
-    // Each line forms an angle with this horizontal line, and those angles
-    // are a function of the slopes of each line. Use atan(x,y) to compute
-    // the angle between each line and the horizontal line.
-    //   slope = deltaY / deltaX. 
-    //   If deltaX = 1, then deltaY = slope.
-    pLine->m_AngleWithHorizontal = atan2((double) 1.0, (double) slope);        
-
-
-    // Possibly extend the line.
-    for (x = pLine->m_PointA.m_X; x <= pLine->m_PointB.m_X; x++)
-    {
-        theoreticalY = (((double) x) * pLine->m_Slope) + yIntercept;
-            
-        // First truncate the floating point number. This finds the
-        // pixel with y rounded down, which is just below the point.
-        y = (int32) (theoreticalY);        
-
-        fPixelMayBePartOfLine = false;
-        err = pDetectorState->m_pEdgesImage->GetPixel(x, y, &pixelValue);
-        if ((!err) && (pixelValue == pDetectorState->m_BlackPixel)) {
-            fPixelMayBePartOfLine = true;
-        }
-        if (fPixelMayBePartOfLine)
-        {
-            pPixel = newex CBioCADPoint;
-            if (NULL == pPixel)
-            {
-                gotoErr(EFail);
-            }
-            pPixel->m_X = x;
-            pPixel->m_Y = y;
-
-            pPixel->m_pNextPoint = pLine->m_PixelList;
-            pLine->m_PixelList = pPixel;
-
-            //<><>
-            pDetectorState->m_pFullImage->SetPixel(x, y, 0x0000FF);
-            //<><>
-        }
-
-        // Now add to the truncated number. This finds the pixel just above the point
-        y += 1;
-        fPixelMayBePartOfLine = false;
-        err = pDetectorState->m_pEdgesImage->GetPixel(x, y, &pixelValue);
-        if ((!err) && (pixelValue == pDetectorState->m_BlackPixel)) {
-            fPixelMayBePartOfLine = true;
-        }
-        if (fPixelMayBePartOfLine)
-        {
-            pPixel = newex CBioCADPoint;
-            if (NULL == pPixel)
-            {
-                gotoErr(EFail);
-            }
-            pPixel->m_X = x;
-            pPixel->m_Y = y;
-
-            pPixel->m_pNextPoint = pLine->m_PixelList;
-            pLine->m_PixelList = pPixel;
+    ProfilerStartTimer(g_ReadBitmapTime);
 
-            //<><>
-            pDetectorState->m_pFullImage->SetPixel(x, y, 0x0000FF);
-            //<><>
+    // Examine every pixel in the image to find all lines.
+    // NOTE: I index the voting arrays with a 0-based index, and that ranges x=0...Width, y=0...height.
+    // But, the image itself is indexed with x=minX....maxX, and y=minY....maxY.
+    // The votes and endpoints do not depend on the order we visit pixels, so
+    // each band of rows votes into its own accumulator, and then they are all added up.
+    err = RunRowBands(pDetectorState->m_Height, votingPass.m_NumBands, VoteForLinesInBand, &votingPass);
+    if (err) {
+        gotoErr(err);
+    }
+    if (votingPass.m_NumBands > 1) {
+        err = RunRowBands(
+                    pDetectorState->m_NumPossibleLengthValues + 1,
+                    GetNumRowBands(pDetectorState->m_NumPossibleLengthValues + 1, HOUGH_MIN_ROWS_PER_BAND),
+                    MergeBandVotes,
+                    &votingPass);
+        if (err) {
+            gotoErr(err);
         }
-        
+    }
 
+    ProfilerStopTimer(g_ReadBitmapTime);
 
-        // Look at the pixel just below.
-        y = y - 1;
-        fPixelMayBePartOfLine = false;
-        err = pDetectorState->m_pEdgesImage->GetPixel(x, y, &pixelValue);
-        if ((!err) && (pixelValue == pDetectorState->m_BlackPixel)) {
-            fPixelMayBePartOfLine = true;
-        }
-        if (fPixelMayBePartOfLine)
-        {
-            pPixel = newex CBioCADPoint;
-            if (NULL == pPixel)
-            {
-                gotoErr(EFail);
-            }
-            pPixel->m_X = x;
-            pPixel->m_Y = y;
+    for (bandNum = 1; bandNum < votingPass.m_NumBands; bandNum++) {
+        FreeHoughAccumulator(&(votingPass.m_BandAccumulators[bandNum]));
+    }
+    votingPass.m_NumBands = 0;
 
-            pPixel->m_pNextPoint = pLine->m_PixelList;
-            pLine->m_PixelList = pPixel;
+    ProfilerStartTimer(g_MergeLinesTime);
 
-            //<><>
-            pDetectorState->m_pFullImage->SetPixel(x, y, 0x0000FF);
-            //<><>
+    // Put all possible lines with a minimum number of votes on a linked list.
+    // Only the peaks are recorded. A line also gets votes in the cells
+    // around it, and those would only be merged back into it.
+    err = FindHoughPeaks(pDetectorState, &pPeakList, &numPeaks);
+    if (err) {
+        gotoErr(err);
+    }
+    for (peakNum = 0; peakNum < numPeaks; peakNum++) {
+        GetPossibleLine(&(pDetectorState->m_Accumulator), pPeakList[peakNum], &possibleLine);
+        err = RecordOneLine(&possibleLine, pDetectorState);
+        if (err) {
+            gotoErr(err);
         }
-    } // for (x = pLine->m_PointA.m_X; x < pLine->m_PointB.m_X; x++)
-
-    // Check the pixel density
-    density = pLine->m_NumPixels / pLine->GetLength();
-    if (density < pDetectorState->m_MinPixelDensityForRealLine)
-    {
-        delete pLine;
-        goto abort;
     }
 
-    // Add it to the list of useful lines.
-    pLine->m_pNextLine = pDetectorState->m_pLineList;
-    pDetectorState->m_pLineList = pLine;
-    pDetectorState->m_NumLines += 1;
+    ProfilerStopTimer(g_MergeLinesTime);
 
 abort:
+    for (bandNum = 1; bandNum < votingPass.m_NumBands; bandNum++) {
+        FreeHoughAccumulator(&(votingPass.m_BandAccumulators[bandNum]));
+    }
+    memFree(votingPass.m_pEdgeRows);
+    memFree(pPeakList);
     returnErr(err);
-} // RecordOneLine
-
+} // DetectLinesFromAllVotes
 
 
 
@@ -1051,115 +1146,1801 @@ abort:
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// [OverlapNewLineWithExistingLines]
+// [DetectLinesProgressively]
 //
+// This is the progressive probabilistic Hough algorithm. Edge pixels vote
+// one at a time, in a random order. As soon as a pixel makes some line
+// reach m_MinVotesForRealLine, that line is followed through the image
+// to find the segment, and the pixels of the segment are taken out of the
+// vote. Their votes are removed, and the ones that have not voted yet never
+// will. So, most pixels of a line do not vote at all, and the votes of one
+// line do not spill over into the lines near it.
+//
+// This is sequential, since each vote depends on the segments found before
+// it. The random order is always the same, so the result is repeatable.
 /////////////////////////////////////////////////////////////////////////////
-bool
+static ErrVal
+DetectLinesProgressively(CLineDetectorState *pDetectorState, CEdgeDetectionTable *pLuminanceMap) {
+    ErrVal err = ENoErr;
+    CProgressiveHoughPass pass;
+    uint32 *pVoteCounts = pDetectorState->m_Accumulator.m_pVoteCounts;
+    uint8 *pPixelState;
+    uint32 randomState;
+    uint32 packedPoint;
+    uint32 numVotes;
+    uint32 bestNumVotes;
+    int32 bestThetaBin;
+    int32 startThetaBin;
+    int32 stopThetaBin;
+    int32 thetaBin;
+    int32 index;
+    int32 pixelNum;
+    int32 swapPixelNum;
+    int32 x;
+    int32 y;
+
+    pass.m_pDetectorState = pDetectorState;
+    pass.m_pLuminanceMap = pLuminanceMap;
+    pass.m_pPixelStates = NULL;
+    pass.m_pEdgePixels = NULL;
+    pass.m_NumEdgePixels = 0;
+
+    if ((pDetectorState->m_Width <= 0) || (pDetectorState->m_Height <= 0)) {
+        gotoErr(ENoErr);
+    }
+
+    ProfilerStartTimer(g_ReadBitmapTime);
+
+    // Find every edge pixel.
+    pass.m_pPixelStates = (uint8 *) memAlloc(pDetectorState->m_Width * pDetectorState->m_Height);
+    if (NULL == pass.m_pPixelStates) {
+        gotoErr(EFail);
+    }
+    err = ReadEdgePixelMask(
+                pDetectorState,
+                PROGRESSIVE_PIXEL_WAITING,
+                pass.m_pPixelStates,
+                &(pass.m_NumEdgePixels));
+    if (err) {
+        gotoErr(err);
+    }
+
+    if (pass.m_NumEdgePixels <= 0) {
+        gotoErr(ENoErr);
+    }
+    pass.m_pEdgePixels = (uint32 *) memAlloc(sizeof(uint32) * pass.m_NumEdgePixels);
+    if (NULL == pass.m_pEdgePixels) {
+        gotoErr(EFail);
+    }
+    pPixelState = pass.m_pPixelStates;
+    pixelNum = 0;
+    for (y = pDetectorState->m_MinYPos; y < pDetectorState->m_MaxYPos; y++) {
+        for (x = pDetectorState->m_MinXPos; x < pDetectorState->m_MaxXPos; x++) {
+            if (PROGRESSIVE_PIXEL_WAITING == *pPixelState) {
+                pass.m_pEdgePixels[pixelNum] = (((uint32) x) << 16) | ((uint32) y);
+                pixelNum += 1;
+            }
+            pPixelState++;
+        }
+    }
+
+    // Shuffle the pixels. This is a Fisher-Yates shuffle with a fixed
+    // xorshift generator, so every run visits them in the same order.
+    randomState = PROGRESSIVE_HOUGH_RANDOM_SEED;
+    for (pixelNum = pass.m_NumEdgePixels - 1; pixelNum > 0; pixelNum--) {
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 17;
+        randomState ^= randomState << 5;
+        swapPixelNum = (int32) (randomState % (uint32) (pixelNum + 1));
+
+        packedPoint = pass.m_pEdgePixels[pixelNum];
+        pass.m_pEdgePixels[pixelNum] = pass.m_pEdgePixels[swapPixelNum];
+        pass.m_pEdgePixels[swapPixelNum] = packedPoint;
+    }
+
+    ProfilerStopTimer(g_ReadBitmapTime);
+    ProfilerStartTimer(g_MergeLinesTime);
+
+    for (pixelNum = 0; pixelNum < pass.m_NumEdgePixels; pixelNum++) {
+        if ((pDetectorState->m_MaxProgressiveSamples > 0)
+                && (pDetectorState->m_NumProgressiveSamples >= pDetectorState->m_MaxProgressiveSamples)) {
+            break;
+        }
+
+        // Skip pixels that are already part of a segment.
+        x = (int32) (pass.m_pEdgePixels[pixelNum] >> 16);
+        y = (int32) (pass.m_pEdgePixels[pixelNum] & 0xFFFF);
+        pPixelState = GetProgressivePixelState(&pass, x, y);
+        if (PROGRESSIVE_PIXEL_WAITING != *pPixelState) {
+            continue;
+        }
+        *pPixelState = PROGRESSIVE_PIXEL_VOTED;
+        pDetectorState->m_NumProgressiveSamples += 1;
+
+        // Vote, and remember the line that got the most votes.
+        GetThetaBinsForPixel(pDetectorState, pLuminanceMap, x, y, &startThetaBin, &stopThetaBin);
+        bestNumVotes = 0;
+        bestThetaBin = startThetaBin;
+        for (thetaBin = startThetaBin; thetaBin < stopThetaBin; thetaBin++) {
+            index = GetVoteIndex(pDetectorState, thetaBin, GetRhoBin(pDetectorState, thetaBin, x, y));
+            pVoteCounts[index] += 1;
+            numVotes = pVoteCounts[index];
+            if (numVotes > bestNumVotes) {
+                bestNumVotes = numVotes;
+                bestThetaBin = thetaBin;
+            }
+        }
+
+        if (bestNumVotes >= (uint32) pDetectorState->m_MinVotesForRealLine) {
+            pDetectorState->m_NumLinesWithMinVotes += 1;
+            err = ExtractProgressiveSegment(&pass, x, y, bestThetaBin, bestNumVotes);
+            if (err) {
+                gotoErr(err);
+            }
+        }
+    } // for (pixelNum = 0; pixelNum < pass.m_NumEdgePixels; pixelNum++)
+
+    ProfilerStopTimer(g_MergeLinesTime);
+
+abort:
+    memFree(pass.m_pPixelStates);
+    memFree(pass.m_pEdgePixels);
+    returnErr(err);
+} // DetectLinesProgressively
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [ExtractProgressiveSegment]
+//
+// A pixel at (x, y) just made the line at thetaBin reach the minimum number
+// of votes. Walk along that line in both directions from the pixel, and
+// stop at a gap of more than m_MaxGapBetweenDashesInLine pixels. Every edge
+// pixel on the way is taken out of the vote. If the segment is long enough,
+// then the votes of its pixels are removed, and it is recorded as a line.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+ExtractProgressiveSegment(
+                CProgressiveHoughPass *pPass,
+                int32 x,
+                int32 y,
+                int32 thetaBin,
+                uint32 numVotes) {
+    ErrVal err = ENoErr;
+    CLineDetectorState *pDetectorState = pPass->m_pDetectorState;
+    CPossibleLine possibleLine;
+    uint32 packedPoint;
+    uint32 firstPoint;
+    uint32 lastPoint;
+    double stepX;
+    double stepY;
+    double posX;
+    double posY;
+    int32 direction;
+    int32 numSteps[2];
+    int32 endX[2];
+    int32 endY[2];
+    int32 stepNum;
+    int32 gap;
+    int32 pixelX;
+    int32 pixelY;
+    int32 deltaX;
+    int32 deltaY;
+    bool fGoodLine;
+
+    // rho = (x * cos) - (y * sin), so the line itself runs along (sin, cos).
+    // Step one pixel at a time along whichever of x or y changes more.
+    stepX = pDetectorState->m_pSinTable[thetaBin];
+    stepY = pDetectorState->m_pCosTable[thetaBin];
+    if (fabs(stepX) >= fabs(stepY)) {
+        stepY = stepY / fabs(stepX);
+        stepX = (stepX > 0) ? 1.0 : -1.0;
+    } else {
+        stepX = stepX / fabs(stepY);
+        stepY = (stepY > 0) ? 1.0 : -1.0;
+    }
+
+    // Find the ends of the segment.
+    for (direction = 0; direction < 2; direction++) {
+        numSteps[direction] = 0;
+        endX[direction] = x;
+        endY[direction] = y;
+        gap = 0;
+        posX = (double) x;
+        posY = (double) y;
+        for (stepNum = 1; ; stepNum++) {
+            if (0 == direction) {
+                posX += stepX;
+                posY += stepY;
+            } else {
+                posX -= stepX;
+                posY -= stepY;
+            }
+            pixelX = (int32) floor(posX + 0.5);
+            pixelY = (int32) floor(posY + 0.5);
+            if ((pixelX < pDetectorState->m_MinXPos) || (pixelX >= pDetectorState->m_MaxXPos)
+                    || (pixelY < pDetectorState->m_MinYPos) || (pixelY >= pDetectorState->m_MaxYPos)) {
+                break;
+            }
+
+            if (PROGRESSIVE_PIXEL_UNUSED != *(GetProgressivePixelState(pPass, pixelX, pixelY))) {
+                numSteps[direction] = stepNum;
+                endX[direction] = pixelX;
+                endY[direction] = pixelY;
+                gap = 0;
+            } else {
+                gap += 1;
+                if (gap > pDetectorState->m_MaxGapBetweenDashesInLine) {
+                    break;
+                }
+            }
+        } // for (stepNum = 1; ; stepNum++)
+    } // for (direction = 0; direction < 2; direction++)
+
+    deltaX = endX[1] - endX[0];
+    deltaY = endY[1] - endY[0];
+    fGoodLine = (((deltaX * deltaX) + (deltaY * deltaY))
+                    >= (pDetectorState->m_MinUsefulLineLength * pDetectorState->m_MinUsefulLineLength));
+
+    // Take the pixels of the segment out of the vote. This includes the
+    // pixel that started it, which has already voted.
+    RemoveProgressivePixel(pPass, x, y, fGoodLine);
+    for (direction = 0; direction < 2; direction++) {
+        posX = (double) x;
+        posY = (double) y;
+        for (stepNum = 1; stepNum <= numSteps[direction]; stepNum++) {
+            if (0 == direction) {
+                posX += stepX;
+                posY += stepY;
+            } else {
+                posX -= stepX;
+                posY -= stepY;
+            }
+            RemoveProgressivePixel(pPass, (int32) floor(posX + 0.5), (int32) floor(posY + 0.5), fGoodLine);
+        }
+    } // for (direction = 0; direction < 2; direction++)
+
+    if (!fGoodLine) {
+        gotoErr(ENoErr);
+    }
+
+    // The endpoints are in (x, y) order, like the cells of the accumulator.
+    firstPoint = (((uint32) endX[0]) << 16) | ((uint32) endY[0]);
+    lastPoint = (((uint32) endX[1]) << 16) | ((uint32) endY[1]);
+    if (lastPoint < firstPoint) {
+        packedPoint = firstPoint;
+        firstPoint = lastPoint;
+        lastPoint = packedPoint;
+    }
+    possibleLine.m_NumVotes = (int32) numVotes;
+    possibleLine.m_PointA.m_X = (int32) (firstPoint >> 16);
+    possibleLine.m_PointA.m_Y = (int32) (firstPoint & 0xFFFF);
+    possibleLine.m_PointA.m_Z = 0;
+    possibleLine.m_PointB.m_X = (int32) (lastPoint >> 16);
+    possibleLine.m_PointB.m_Y = (int32) (lastPoint & 0xFFFF);
+    possibleLine.m_PointB.m_Z = 0;
+
+    err = RecordOneLine(&possibleLine, pDetectorState);
+    if (err) {
+        gotoErr(err);
+    }
+
+abort:
+    returnErr(err);
+} // ExtractProgressiveSegment
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RemoveProgressivePixel]
+//
+// Take one pixel of a segment out of the vote. If the segment is a real
+// line and the pixel has voted, then its votes are removed too.
+/////////////////////////////////////////////////////////////////////////////
+static void
+RemoveProgressivePixel(CProgressiveHoughPass *pPass, int32 x, int32 y, bool fRemoveVotes) {
+    CLineDetectorState *pDetectorState = pPass->m_pDetectorState;
+    uint32 *pVoteCounts = pDetectorState->m_Accumulator.m_pVoteCounts;
+    uint8 *pPixelState;
+    int32 startThetaBin;
+    int32 stopThetaBin;
+    int32 thetaBin;
+
+    pPixelState = GetProgressivePixelState(pPass, x, y);
+    if ((fRemoveVotes) && (PROGRESSIVE_PIXEL_VOTED == *pPixelState)) {
+        GetThetaBinsForPixel(pDetectorState, pPass->m_pLuminanceMap, x, y, &startThetaBin, &stopThetaBin);
+        for (thetaBin = startThetaBin; thetaBin < stopThetaBin; thetaBin++) {
+            pVoteCounts[GetVoteIndex(pDetectorState, thetaBin, GetRhoBin(pDetectorState, thetaBin, x, y))] -= 1;
+        }
+    }
+    *pPixelState = PROGRESSIVE_PIXEL_UNUSED;
+} // RemoveProgressivePixel
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [DetectLinesWithPyramid]
+//
+// This finds lines coarse-to-fine. First, each block of m_PyramidScale by
+// m_PyramidScale pixels becomes one pixel of a small image, and that votes
+// into an accumulator with theta bins that are m_PyramidScale times wider.
+// Each peak of that is then refined with a small accumulator at the full
+// resolution, which only covers the angles around the peak and only gets
+// votes from the pixels near the coarse line.
+//
+// The coarse accumulator is about m_PyramidScale squared times smaller
+// than the full one, so an image with a few long lines takes much less
+// memory and voting. Lines that are too short to show up in the small
+// image are missed.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+DetectLinesWithPyramid(CLineDetectorState *pDetectorState, CEdgeDetectionTable *pLuminanceMap) {
+    ErrVal err = ENoErr;
+    CLineDetectorState coarseState;
+    uint8 *pEdgeMask = NULL;
+    uint8 *pMask;
+    uint32 *pBlockPixels = NULL;
+    uint32 packedPoint;
+    int32 scale;
+    int32 coarseWidth;
+    int32 coarseHeight;
+    int32 numEdgePixels;
+    int32 *pPeakList = NULL;
+    int32 numPeaks = 0;
+    int32 peakNum;
+    int32 blockNum;
+    int32 thetaBin;
+    int32 startThetaBin;
+    int32 stopThetaBin;
+    int32 x;
+    int32 y;
+
+    coarseState.m_Accumulator.m_pVoteCounts = NULL;
+    coarseState.m_Accumulator.m_pFirstPoints = NULL;
+    coarseState.m_Accumulator.m_pLastPoints = NULL;
+    coarseState.m_pCosTable = NULL;
+    coarseState.m_pSinTable = NULL;
+
+    if ((pDetectorState->m_Width <= 0) || (pDetectorState->m_Height <= 0)) {
+        gotoErr(ENoErr);
+    }
+    scale = pDetectorState->m_PyramidScale;
+    if (scale < 1) {
+        scale = 1;
+    }
+
+    ProfilerStartTimer(g_ReadBitmapTime);
+
+    pEdgeMask = (uint8 *) memAlloc(pDetectorState->m_Width * pDetectorState->m_Height);
+    if (NULL == pEdgeMask) {
+        gotoErr(EFail);
+    }
+    err = ReadEdgePixelMask(pDetectorState, 1, pEdgeMask, &numEdgePixels);
+    if (err) {
+        gotoErr(err);
+    }
+
+    // A block is an edge if any of its pixels is an edge. It votes from the
+    // first edge pixel in it, which has a real gradient and position.
+    coarseWidth = (pDetectorState->m_Width + scale - 1) / scale;
+    coarseHeight = (pDetectorState->m_Height + scale - 1) / scale;
+    pBlockPixels = (uint32 *) memAlloc(sizeof(uint32) * coarseWidth * coarseHeight);
+    if (NULL == pBlockPixels) {
+        gotoErr(EFail);
+    }
+    for (blockNum = 0; blockNum < (coarseWidth * coarseHeight); blockNum++) {
+        pBlockPixels[blockNum] = PYRAMID_NO_PIXEL;
+    }
+    pMask = pEdgeMask;
+    for (y = pDetectorState->m_MinYPos; y < pDetectorState->m_MaxYPos; y++) {
+        for (x = pDetectorState->m_MinXPos; x < pDetectorState->m_MaxXPos; x++) {
+            if (*pMask) {
+                blockNum = (((y - pDetectorState->m_MinYPos) / scale) * coarseWidth)
+                                + ((x - pDetectorState->m_MinXPos) / scale);
+                if (PYRAMID_NO_PIXEL == pBlockPixels[blockNum]) {
+                    pBlockPixels[blockNum] = (((uint32) x) << 16) | ((uint32) y);
+                }
+            }
+            pMask++;
+        }
+    }
+
+    // The coarse image has fewer pixels on each line, so it needs fewer votes.
+    coarseState.m_MinPerpendicularLineAngle = pDetectorState->m_MinPerpendicularLineAngle;
+    coarseState.m_MaxPerpendicularLineAngle = pDetectorState->m_MaxPerpendicularLineAngle;
+    coarseState.m_PerpendicularLineAngleModulo = pDetectorState->m_PerpendicularLineAngleModulo;
+    coarseState.m_AngleRangeAroundGradientInRadians = pDetectorState->m_AngleRangeAroundGradientInRadians;
+    coarseState.m_AngleIncrement = pDetectorState->m_AngleIncrement * scale;
+    coarseState.m_MinVotesForRealLine = pDetectorState->m_MinVotesForRealLine / scale;
+    if (coarseState.m_MinVotesForRealLine < 1) {
+        coarseState.m_MinVotesForRealLine = 1;
+    }
+    coarseState.m_PeakThetaRadius = pDetectorState->m_PeakThetaRadius;
+    coarseState.m_PeakRhoRadius = pDetectorState->m_PeakRhoRadius;
+    coarseState.m_MaxPeaks = pDetectorState->m_MaxPeaks;
+    err = InitHoughSpace(&coarseState, coarseWidth, coarseHeight);
+    if (err) {
+        gotoErr(err);
+    }
+    err = AllocateHoughAccumulator(&(coarseState.m_Accumulator), coarseState.m_NumEntriesInVoteArray);
+    if (err) {
+        gotoErr(err);
+    }
+
+    for (blockNum = 0; blockNum < (coarseWidth * coarseHeight); blockNum++) {
+        packedPoint = pBlockPixels[blockNum];
+        if (PYRAMID_NO_PIXEL == packedPoint) {
+            continue;
+        }
+        x = (int32) (packedPoint >> 16);
+        y = (int32) (packedPoint & 0xFFFF);
+
+        GetThetaBinsForPixel(&coarseState, pLuminanceMap, x, y, &startThetaBin, &stopThetaBin);
+        for (thetaBin = startThetaBin; thetaBin < stopThetaBin; thetaBin++) {
+            AddVote(
+                &(coarseState.m_Accumulator),
+                GetVoteIndex(&coarseState, thetaBin, GetRhoBin(&coarseState, thetaBin, x / scale, y / scale)),
+                packedPoint);
+        }
+    } // for (blockNum = 0; blockNum < (coarseWidth * coarseHeight); blockNum++)
+
+    err = FindHoughPeaks(&coarseState, &pPeakList, &numPeaks);
+    if (err) {
+        gotoErr(err);
+    }
+    pDetectorState->m_NumPossibleLines = coarseState.m_NumPossibleLines;
+    pDetectorState->m_NumLinesWithMinVotes = coarseState.m_NumLinesWithMinVotes;
+    pDetectorState->m_NumPeaks = coarseState.m_NumPeaks;
+
+    ProfilerStopTimer(g_ReadBitmapTime);
+    ProfilerStartTimer(g_MergeLinesTime);
+
+    // Coarse theta bin t is the same angle as full theta bin (t * scale),
+    // and a coarse rho is scale times smaller than the full rho.
+    for (peakNum = 0; peakNum < numPeaks; peakNum++) {
+        err = RefinePyramidLine(
+                    pDetectorState,
+                    pLuminanceMap,
+                    pEdgeMask,
+                    scale,
+                    (pPeakList[peakNum] % coarseState.m_NumAngleBins) * scale,
+                    ((double) ((pPeakList[peakNum] / coarseState.m_NumAngleBins)
+                                    + coarseState.m_MinPerpendicularLength)) * scale);
+        if (err) {
+            gotoErr(err);
+        }
+    }
+
+    ProfilerStopTimer(g_MergeLinesTime);
+
+abort:
+    FreeHoughAccumulator(&(coarseState.m_Accumulator));
+    memFree(coarseState.m_pCosTable);
+    memFree(coarseState.m_pSinTable);
+    memFree(pPeakList);
+    memFree(pBlockPixels);
+    memFree(pEdgeMask);
+    returnErr(err);
+} // DetectLinesWithPyramid
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RefinePyramidLine]
+//
+// Find the full resolution line for one peak of the coarse accumulator.
+// The window of the accumulator only covers the theta bins within
+// PYRAMID_BAND_BLOCKS coarse bins of centerThetaBin. Only the edge pixels
+// within PYRAMID_BAND_BLOCKS blocks of the coarse line vote, and the cell
+// of the window with the most votes is recorded.
+//
+// This walks the whole coarse line across the bounding box, rather than
+// just between the endpoints of the coarse peak. A block only votes from
+// one of its pixels, so those endpoints may be much closer together than
+// the ends of the real line.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+RefinePyramidLine(
+            CLineDetectorState *pDetectorState,
+            CEdgeDetectionTable *pLuminanceMap,
+            uint8 *pEdgeMask,
+            int32 scale,
+            int32 centerThetaBin,
+            double rho) {
+    ErrVal err = ENoErr;
+    CPyramidWindow window;
+    CPossibleLine possibleLine;
+    double cosTheta;
+    double sinTheta;
+    int32 bandWidth;
+    int32 centerPos;
+    int32 x;
+    int32 y;
+    int32 numCells;
+    int32 index;
+    int32 bestIndex;
+
+    window.m_Accumulator.m_pVoteCounts = NULL;
+    window.m_Accumulator.m_pFirstPoints = NULL;
+    window.m_Accumulator.m_pLastPoints = NULL;
+
+    window.m_MinThetaBin = centerThetaBin - (PYRAMID_BAND_BLOCKS * scale);
+    if (window.m_MinThetaBin < 0) {
+        window.m_MinThetaBin = 0;
+    }
+    window.m_StopThetaBin = centerThetaBin + (PYRAMID_BAND_BLOCKS * scale) + 1;
+    if (window.m_StopThetaBin > pDetectorState->m_NumAngleBins) {
+        window.m_StopThetaBin = pDetectorState->m_NumAngleBins;
+    }
+
+    numCells = (window.m_StopThetaBin - window.m_MinThetaBin) * (pDetectorState->m_NumPossibleLengthValues + 1);
+    err = AllocateHoughAccumulator(&(window.m_Accumulator), numCells);
+    if (err) {
+        gotoErr(err);
+    }
+
+    // The line is (x * cos) - (y * sin) = rho. Step along whichever of
+    // x or y changes more, and visit the pixels across the line at each step.
+    bandWidth = PYRAMID_BAND_BLOCKS * scale;
+    cosTheta = pDetectorState->m_pCosTable[centerThetaBin];
+    sinTheta = pDetectorState->m_pSinTable[centerThetaBin];
+    if (fabs(cosTheta) >= fabs(sinTheta)) {
+        for (y = pDetectorState->m_MinYPos; y < pDetectorState->m_MaxYPos; y++) {
+            centerPos = RoundDoubleToInt((rho + (((double) y) * sinTheta)) / cosTheta);
+            for (x = centerPos - bandWidth; x <= centerPos + bandWidth; x++) {
+                VoteInPyramidWindow(pDetectorState, pLuminanceMap, pEdgeMask, &window, x, y);
+            }
+        }
+    } else {
+        for (x = pDetectorState->m_MinXPos; x < pDetectorState->m_MaxXPos; x++) {
+            centerPos = RoundDoubleToInt(((((double) x) * cosTheta) - rho) / sinTheta);
+            for (y = centerPos - bandWidth; y <= centerPos + bandWidth; y++) {
+                VoteInPyramidWindow(pDetectorState, pLuminanceMap, pEdgeMask, &window, x, y);
+            }
+        }
+    }
+
+    bestIndex = 0;
+    for (index = 1; index < numCells; index++) {
+        if (window.m_Accumulator.m_pVoteCounts[index] > window.m_Accumulator.m_pVoteCounts[bestIndex]) {
+            bestIndex = index;
+        }
+    }
+    if ((0 == window.m_Accumulator.m_pVoteCounts[bestIndex])
+            || (window.m_Accumulator.m_pVoteCounts[bestIndex] < (uint32) pDetectorState->m_MinVotesForRealLine)) {
+        gotoErr(ENoErr);
+    }
+    pDetectorState->m_NumRefinedLines += 1;
+
+    GetPossibleLine(&(window.m_Accumulator), bestIndex, &possibleLine);
+    err = RecordOneLine(&possibleLine, pDetectorState);
+    if (err) {
+        gotoErr(err);
+    }
+
+abort:
+    FreeHoughAccumulator(&(window.m_Accumulator));
+    returnErr(err);
+} // RefinePyramidLine
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [VoteInPyramidWindow]
+//
+// If (x, y) is an edge pixel, then vote for the lines through it that are
+// in the window.
+/////////////////////////////////////////////////////////////////////////////
+static void
+VoteInPyramidWindow(
+            CLineDetectorState *pDetectorState,
+            CEdgeDetectionTable *pLuminanceMap,
+            uint8 *pEdgeMask,
+            CPyramidWindow *pWindow,
+            int32 x,
+            int32 y) {
+    int32 numThetaBins = pWindow->m_StopThetaBin - pWindow->m_MinThetaBin;
+    uint32 packedPoint;
+    int32 startThetaBin;
+    int32 stopThetaBin;
+    int32 thetaBin;
+
+    if ((x < pDetectorState->m_MinXPos) || (x >= pDetectorState->m_MaxXPos)
+            || (y < pDetectorState->m_MinYPos) || (y >= pDetectorState->m_MaxYPos)) {
+        return;
+    }
+    if (!(pEdgeMask[((y - pDetectorState->m_MinYPos) * pDetectorState->m_Width) + (x - pDetectorState->m_MinXPos)])) {
+        return;
+    }
+
+    GetThetaBinsForPixel(pDetectorState, pLuminanceMap, x, y, &startThetaBin, &stopThetaBin);
+    if (startThetaBin < pWindow->m_MinThetaBin) {
+        startThetaBin = pWindow->m_MinThetaBin;
+    }
+    if (stopThetaBin > pWindow->m_StopThetaBin) {
+        stopThetaBin = pWindow->m_StopThetaBin;
+    }
+
+    packedPoint = (((uint32) x) << 16) | ((uint32) y);
+    for (thetaBin = startThetaBin; thetaBin < stopThetaBin; thetaBin++) {
+        AddVote(
+            &(pWindow->m_Accumulator),
+            (GetRhoBin(pDetectorState, thetaBin, x, y) * numThetaBins) + (thetaBin - pWindow->m_MinThetaBin),
+            packedPoint);
+    }
+} // VoteInPyramidWindow
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [ReadEdgePixelMask]
+//
+// Make a map of the edge pixels in the bounding box, with one byte per
+// pixel. Edge pixels are set to edgeValue, and all others to 0.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+ReadEdgePixelMask(
+            CLineDetectorState *pDetectorState,
+            uint8 edgeValue,
+            uint8 *pMask,
+            int32 *pNumEdgePixels) {
+    ErrVal err = ENoErr;
+    uint32 *pEdgeRow = NULL;
+    int32 x;
+    int32 y;
+
+    *pNumEdgePixels = 0;
+
+    pEdgeRow = (uint32 *) memAlloc(sizeof(uint32) * (pDetectorState->m_Width + 1));
+    if (NULL == pEdgeRow) {
+        gotoErr(EFail);
+    }
+
+    for (y = pDetectorState->m_MinYPos; y < pDetectorState->m_MaxYPos; y++) {
+        err = pDetectorState->m_pEdgesImage->ReadRow(y, pDetectorState->m_MinXPos, pDetectorState->m_Width, pEdgeRow);
+        if (err)  {
+            gotoErr(err);
+        }
+
+        for (x = 0; x < pDetectorState->m_Width; x++) {
+            if (pEdgeRow[x] == pDetectorState->m_BlackPixel) {
+                *pMask = edgeValue;
+                *pNumEdgePixels += 1;
+            } else {
+                *pMask = 0;
+            }
+            pMask++;
+        }
+    } // for (y = pDetectorState->m_MinYPos; y < pDetectorState->m_MaxYPos; y++)
+
+abort:
+    memFree(pEdgeRow);
+    returnErr(err);
+} // ReadEdgePixelMask
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [InitHoughSpace]
+//
+// Compute the theta and rho bins for an image of width x height pixels,
+// from the angle range and increment that are already in the state.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+InitHoughSpace(CLineDetectorState *pDetectorState, int32 width, int32 height) {
+    ErrVal err = ENoErr;
+
+    pDetectorState->m_NumPossibleAngleValues = (uint32) (double) ((pDetectorState->m_MaxPerpendicularLineAngle 
+                                                                    - pDetectorState->m_MinPerpendicularLineAngle)
+                                                                / pDetectorState->m_AngleIncrement);
+    pDetectorState->m_NumAngleBins = pDetectorState->m_NumPossibleAngleValues + 1;
+    pDetectorState->m_AngleRangeAroundGradientInBins = RoundDoubleToInt(
+                                                        pDetectorState->m_AngleRangeAroundGradientInRadians
+                                                            / pDetectorState->m_AngleIncrement);
+    err = BuildTrigTables(pDetectorState);
+    if (err) {
+        gotoErr(err);
+    }
+
+    // Compute the maximum size of a line. This is the length of the 
+    // main diagonal across the rectangular image.
+    pDetectorState->m_MaxPerpendicularLength
+        = (uint32) (sqrt((double) (width * width) + (double) (height * height)));
+    pDetectorState->m_MinPerpendicularLength = -(pDetectorState->m_MaxPerpendicularLength);
+    pDetectorState->m_NumPossibleLengthValues = (int32) (2 * pDetectorState->m_MaxPerpendicularLength);
+
+    pDetectorState->m_NumEntriesInVoteArray = (pDetectorState->m_NumPossibleLengthValues + 1) 
+                                            * pDetectorState->m_NumAngleBins;
+
+    // Adding this before truncating rounds rho to the nearest bin.
+    pDetectorState->m_RhoBias = 0.5 - pDetectorState->m_MinPerpendicularLength;
+
+abort:
+    returnErr(err);
+} // InitHoughSpace
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [BuildTrigTables]
+//
+// Compute cos and sin once for each theta bin, rather than for every vote.
+// The bins are computed from the bin number, not by adding up increments,
+// so the angles do not drift.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+BuildTrigTables(CLineDetectorState *pDetectorState) {
+    ErrVal err = ENoErr;
+    double theta;
+    int32 thetaBin;
+
+    pDetectorState->m_pCosTable = (double *) memAlloc(sizeof(double) * pDetectorState->m_NumAngleBins);
+    pDetectorState->m_pSinTable = (double *) memAlloc(sizeof(double) * pDetectorState->m_NumAngleBins);
+    if ((NULL == pDetectorState->m_pCosTable) || (NULL == pDetectorState->m_pSinTable)) {
+        gotoErr(EFail);
+    }
+
+    for (thetaBin = 0; thetaBin < pDetectorState->m_NumAngleBins; thetaBin++) {
+        theta = pDetectorState->m_MinPerpendicularLineAngle
+                    + (((double) thetaBin) * pDetectorState->m_AngleIncrement);
+        pDetectorState->m_pCosTable[thetaBin] = cos(theta);
+        pDetectorState->m_pSinTable[thetaBin] = sin(theta);
+    }
+
+abort:
+    returnErr(err);
+} // BuildTrigTables
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [VoteForLinesInBand]
+//
+// Every black pixel in one band of rows votes for every line that could
+// pass through it. startRow and stopRow are relative to m_MinYPos.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+VoteForLinesInBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow) {
+    ErrVal err = ENoErr;
+    CHoughVotingPass *pPass = (CHoughVotingPass *) pContext;
+    CLineDetectorState *pDetectorState = pPass->m_pDetectorState;
+    CEdgeDetectionTable *pLuminanceMap = pPass->m_pLuminanceMap;
+    CHoughAccumulator *pAccumulator = &(pPass->m_BandAccumulators[bandNum]);
+    uint32 *pEdgeRow = pPass->m_pEdgeRows + (bandNum * (pDetectorState->m_Width + 1));
+    int32 thetaBin;
+    int32 startThetaBin;
+    int32 stopThetaBin;
+    int32 x;
+    int32 y;
+    uint32 pixelValue;
+    uint32 packedPoint;
+
+    if (pDetectorState->m_Width <= 0) {
+        gotoErr(ENoErr);
+    }
+
+    for (y = pDetectorState->m_MinYPos + startRow; y < pDetectorState->m_MinYPos + stopRow; y++) {
+        err = pDetectorState->m_pEdgesImage->ReadRow(y, pDetectorState->m_MinXPos, pDetectorState->m_Width, pEdgeRow);
+        if (err)  {
+            gotoErr(err);
+        }
+
+        for (x = pDetectorState->m_MinXPos; x < pDetectorState->m_MaxXPos; x++) {
+            pixelValue = pEdgeRow[x - pDetectorState->m_MinXPos];
+
+            // If this is a black pixel, then use it to vote for every line that
+            // can pass through this pixel.
+            if (pixelValue == pDetectorState->m_BlackPixel) {
+                packedPoint = (((uint32) x) << 16) | ((uint32) y);
+
+                // Sweep through all possible angles and vote for every line in that range.
+                GetThetaBinsForPixel(pDetectorState, pLuminanceMap, x, y, &startThetaBin, &stopThetaBin);
+                for (thetaBin = startThetaBin; thetaBin < stopThetaBin; thetaBin++) {
+                    AddVote(
+                        pAccumulator,
+                        GetVoteIndex(pDetectorState, thetaBin, GetRhoBin(pDetectorState, thetaBin, x, y)),
+                        packedPoint);
+                } // for (thetaBin = startThetaBin; thetaBin < stopThetaBin; thetaBin++)
+            } // if (pixelValue == pDetectorState->m_BlackPixel)
+        } // for (x = pDetectorState->m_MinXPos; x < pDetectorState->m_MaxXPos; x++)
+    } // for (y = pDetectorState->m_MinYPos + startRow; y < pDetectorState->m_MinYPos + stopRow; y++)
+
+abort:
+    returnErr(err);
+} // VoteForLinesInBand
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetThetaBinsForPixel]
+//
+// Find the range of theta bins [*pStartThetaBin, *pStopThetaBin) that an
+// edge pixel votes for. These are the angles around the local gradient.
+/////////////////////////////////////////////////////////////////////////////
+static void
+GetThetaBinsForPixel(
+                CLineDetectorState *pDetectorState,
+                CEdgeDetectionTable *pLuminanceMap,
+                int32 x,
+                int32 y,
+                int32 *pStartThetaBin,
+                int32 *pStopThetaBin) {
+    double perpendicularLineAngleInRadians;
+    int32 centerThetaBin;
+    // Leave all these as signed. The grayscale values ate unsigned 0-255 
+    // values, but we want to convert this into changes in luminance, 
+    // which can be positive or negative.
+    int32 pixelAbove;
+    int32 pixelBelow;
+    int32 pixelLeft;
+    int32 pixelRight;
+    int32 pixelAboveLeft;
+    int32 pixelAboveRight;
+    int32 pixelBelowLeft;
+    int32 pixelBelowRight;
+    int32 rowGradient;
+    int32 colGradient;
+
+
+    // Get the luminance of all surrounding pixels
+    pixelAbove = pLuminanceMap->GetLuminance(x, y-1);
+    pixelBelow = pLuminanceMap->GetLuminance(x, y+1); 
+    pixelLeft = pLuminanceMap->GetLuminance(x-1, y);
+    pixelRight = pLuminanceMap->GetLuminance(x+1, y);
+    pixelAboveLeft = pLuminanceMap->GetLuminance(x-1, y-1);
+    pixelAboveRight = pLuminanceMap->GetLuminance(x+1, y-1);
+    pixelBelowLeft = pLuminanceMap->GetLuminance(x-1, y+1);
+    pixelBelowRight = pLuminanceMap->GetLuminance(x+1, y+1);
+
+    // Use the convolution matrices to get the change in the 
+    // X and Y dimensions. These are basis vectors for the net change
+    // in luminence at this point. The net change in luminence is
+    // the same as the direction the dark-pixels are in. Those dark
+    // pixels may be part of a line we are looking for.
+    rowGradient = ((2*pixelBelow) + pixelBelowLeft + pixelBelowRight) 
+                - ((2*pixelAbove) + pixelAboveLeft + pixelAboveRight);
+
+    colGradient = ((2*pixelLeft) + pixelAboveLeft + pixelBelowLeft)
+                - ((2*pixelRight) + pixelAboveRight + pixelBelowRight);
+
+
+    // Now, use the lengths of the 2 basis vectors to get the angle of the line.
+    // Remember, the rowGradient is the difference between rows,
+    // so it is the change in the Y direction. The colGradient is the difference
+    // between columns, so it is the change in the X direction.
+    perpendicularLineAngleInRadians = atan2((double) rowGradient, (double) colGradient);
+
+    // Lines are non-directional. This means 2 lines with angles theta and theta+Pi are 
+    // the same. One is just the other rotated by pi radians (180 degrees) so it is just
+    // reversed direction.
+    if (perpendicularLineAngleInRadians < pDetectorState->m_MinPerpendicularLineAngle) {
+        perpendicularLineAngleInRadians = perpendicularLineAngleInRadians 
+                        + pDetectorState->m_PerpendicularLineAngleModulo;
+    }
+
+    if (perpendicularLineAngleInRadians >= pDetectorState->m_MaxPerpendicularLineAngle) {
+        perpendicularLineAngleInRadians = perpendicularLineAngleInRadians 
+                        - pDetectorState->m_PerpendicularLineAngleModulo;
+    }
+
+    // Round the angle. This is important because we want pixels that are on the
+    // same pixelated line to derive the same abstract line. So, don't get too precise,
+    // or very nearly colinear points will think they are totally different.
+    perpendicularLineAngleInRadians = LimitDoubleToFixedPrecision(
+                                                perpendicularLineAngleInRadians, 
+                                                pDetectorState->m_AngleIncrement);
+
+
+    // If the gradient function were perfect, then we would use it as the perpendicular
+    // angle and be done. However, the image may not be perfect. There may be noise pixels
+    // around, which change the gradient. Moreover, all lines are pixelated, so a local
+    // gradient is different than the line's true gradient. So, instead consider all
+    // possible angles around the grandient angle and vote for them all.
+    centerThetaBin = RoundDoubleToInt(
+                        (perpendicularLineAngleInRadians - pDetectorState->m_MinPerpendicularLineAngle)
+                            / pDetectorState->m_AngleIncrement);
+    *pStartThetaBin = centerThetaBin - pDetectorState->m_AngleRangeAroundGradientInBins;
+    if (*pStartThetaBin < 0) {
+        *pStartThetaBin = 0;
+    }
+    *pStopThetaBin = centerThetaBin + pDetectorState->m_AngleRangeAroundGradientInBins + 1;
+    if (*pStopThetaBin > pDetectorState->m_NumAngleBins) {
+        *pStopThetaBin = pDetectorState->m_NumAngleBins;
+    }
+} // GetThetaBinsForPixel
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [MergeBandVotes]
+//
+// Add the votes of every band into the main accumulator. The "rows" here are
+// rho values, so each thread merges every theta for its own range of rho.
+// The endpoints are the smallest and largest points in (x, y) order, so
+// they come out the same no matter which band saw them first.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+MergeBandVotes(void *pContext, int32 bandNum, int32 startRow, int32 stopRow) {
+    CHoughVotingPass *pPass = (CHoughVotingPass *) pContext;
+    CLineDetectorState *pDetectorState = pPass->m_pDetectorState;
+    CHoughAccumulator *pDest = &(pDetectorState->m_Accumulator);
+    CHoughAccumulator *pSrc;
+    int32 startIndex;
+    int32 stopIndex;
+    int32 index;
+    int32 srcBandNum;
+    UNUSED_PARAM(bandNum);
+
+    startIndex = startRow * pDetectorState->m_NumAngleBins;
+    stopIndex = stopRow * pDetectorState->m_NumAngleBins;
+    for (srcBandNum = 1; srcBandNum < pPass->m_NumBands; srcBandNum++) {
+        pSrc = &(pPass->m_BandAccumulators[srcBandNum]);
+        for (index = startIndex; index < stopIndex; index++) {
+            if (0 == pSrc->m_pVoteCounts[index]) {
+                continue;
+            }
+
+            if (0 == pDest->m_pVoteCounts[index]) {
+                pDest->m_pFirstPoints[index] = pSrc->m_pFirstPoints[index];
+                pDest->m_pLastPoints[index] = pSrc->m_pLastPoints[index];
+            } else {
+                if (pSrc->m_pFirstPoints[index] < pDest->m_pFirstPoints[index]) {
+                    pDest->m_pFirstPoints[index] = pSrc->m_pFirstPoints[index];
+                }
+                if (pSrc->m_pLastPoints[index] > pDest->m_pLastPoints[index]) {
+                    pDest->m_pLastPoints[index] = pSrc->m_pLastPoints[index];
+                }
+            }
+            pDest->m_pVoteCounts[index] += pSrc->m_pVoteCounts[index];
+        } // for (index = startIndex; index < stopIndex; index++)
+    } // for (srcBandNum = 1; srcBandNum < pPass->m_NumBands; srcBandNum++)
+
+    return(ENoErr);
+} // MergeBandVotes
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FindHoughPeaks]
+//
+// Make a list of the cells that have enough votes and are also local
+// maxima. The list is in the same order the cells used to be scanned,
+// theta and then rho, so lines are recorded in the same order as before.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+FindHoughPeaks(CLineDetectorState *pDetectorState, int32 **ppPeakList, int32 *pNumPeaks) {
+    ErrVal err = ENoErr;
+    uint32 *pVoteCounts = pDetectorState->m_Accumulator.m_pVoteCounts;
+    uint32 minVotes = (uint32) pDetectorState->m_MinVotesForRealLine;
+    int32 *pPeakList = NULL;
+    int32 numPeaks = 0;
+    int32 thetaBin;
+    int32 rhoBin;
+    int32 index;
+
+    // A cell with no votes has no endpoints.
+    if (minVotes < 1) {
+        minVotes = 1;
+    }
+
+    // Count the cells with enough votes. This is the most peaks there can be.
+    pDetectorState->m_NumPossibleLines = 0;
+    pDetectorState->m_NumLinesWithMinVotes = 0;
+    for (thetaBin = 0; thetaBin < pDetectorState->m_NumAngleBins; thetaBin++) {
+        for (rhoBin = 0; rhoBin < pDetectorState->m_NumPossibleLengthValues; rhoBin++) {
+            pDetectorState->m_NumPossibleLines += 1;
+            index = GetVoteIndex(pDetectorState, thetaBin, rhoBin);
+            if (pVoteCounts[index] >= minVotes) {
+                pDetectorState->m_NumLinesWithMinVotes += 1;
+            }
+        }
+    }
+
+    if (pDetectorState->m_NumLinesWithMinVotes > 0) {
+        pPeakList = (int32 *) memAlloc(sizeof(int32) * pDetectorState->m_NumLinesWithMinVotes);
+        if (NULL == pPeakList) {
+            gotoErr(EFail);
+        }
+
+        for (thetaBin = 0; thetaBin < pDetectorState->m_NumAngleBins; thetaBin++) {
+            for (rhoBin = 0; rhoBin < pDetectorState->m_NumPossibleLengthValues; rhoBin++) {
+                index = GetVoteIndex(pDetectorState, thetaBin, rhoBin);
+                if ((pVoteCounts[index] >= minVotes)
+                        && (IsHoughPeak(pDetectorState, thetaBin, rhoBin))) {
+                    pPeakList[numPeaks] = index;
+                    numPeaks += 1;
+                }
+            }
+        }
+
+        err = KeepStrongestPeaks(pDetectorState, pPeakList, &numPeaks);
+        if (err) {
+            gotoErr(err);
+        }
+    } // if (pDetectorState->m_NumLinesWithMinVotes > 0)
+
+    pDetectorState->m_NumPeaks = numPeaks;
+    *ppPeakList = pPeakList;
+    pPeakList = NULL;
+    *pNumPeaks = numPeaks;
+
+abort:
+    memFree(pPeakList);
+    returnErr(err);
+} // FindHoughPeaks
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [IsHoughPeak]
+//
+// A cell is a peak if no cell in the window around it has more votes.
+// If several cells in the window tie, then only the first one in scan
+// order is a peak, so a flat run of votes still produces one line.
+// The window stops at the edges of the accumulator. Theta does not wrap
+// around, so a line near -PI/2 is not compared with one near +PI/2.
+/////////////////////////////////////////////////////////////////////////////
+static bool
+IsHoughPeak(CLineDetectorState *pDetectorState, int32 thetaBin, int32 rhoBin) {
+    uint32 *pVoteCounts = pDetectorState->m_Accumulator.m_pVoteCounts;
+    uint32 numVotes;
+    uint32 neighborVotes;
+    int32 minThetaBin;
+    int32 maxThetaBin;
+    int32 minRhoBin;
+    int32 maxRhoBin;
+    int32 neighborThetaBin;
+    int32 neighborRhoBin;
+
+    numVotes = pVoteCounts[GetVoteIndex(pDetectorState, thetaBin, rhoBin)];
+
+    minThetaBin = thetaBin - pDetectorState->m_PeakThetaRadius;
+    if (minThetaBin < 0) {
+        minThetaBin = 0;
+    }
+    maxThetaBin = thetaBin + pDetectorState->m_PeakThetaRadius;
+    if (maxThetaBin > (pDetectorState->m_NumAngleBins - 1)) {
+        maxThetaBin = pDetectorState->m_NumAngleBins - 1;
+    }
+    minRhoBin = rhoBin - pDetectorState->m_PeakRhoRadius;
+    if (minRhoBin < 0) {
+        minRhoBin = 0;
+    }
+    maxRhoBin = rhoBin + pDetectorState->m_PeakRhoRadius;
+    if (maxRhoBin > pDetectorState->m_NumPossibleLengthValues) {
+        maxRhoBin = pDetectorState->m_NumPossibleLengthValues;
+    }
+
+    for (neighborThetaBin = minThetaBin; neighborThetaBin <= maxThetaBin; neighborThetaBin++) {
+        for (neighborRhoBin = minRhoBin; neighborRhoBin <= maxRhoBin; neighborRhoBin++) {
+            neighborVotes = pVoteCounts[GetVoteIndex(pDetectorState, neighborThetaBin, neighborRhoBin)];
+            if (neighborVotes > numVotes) {
+                return(false);
+            }
+            if ((neighborVotes == numVotes)
+                    && ((neighborThetaBin < thetaBin)
+                        || ((neighborThetaBin == thetaBin) && (neighborRhoBin < rhoBin)))) {
+                return(false);
+            }
+        } // for (neighborRhoBin = minRhoBin; neighborRhoBin <= maxRhoBin; neighborRhoBin++)
+    } // for (neighborThetaBin = minThetaBin; neighborThetaBin <= maxThetaBin; neighborThetaBin++)
+
+    return(true);
+} // IsHoughPeak
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [KeepStrongestPeaks]
+//
+// If there are more than m_MaxPeaks peaks, then only keep the ones with
+// the most votes. A min-heap of the largest vote counts finds the count of
+// the weakest peak that is kept. Every peak with more votes than that is
+// kept, and peaks with exactly that many are kept in scan order until
+// there are m_MaxPeaks. The list stays in scan order.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+KeepStrongestPeaks(CLineDetectorState *pDetectorState, int32 *pPeakList, int32 *pNumPeaks) {
+    ErrVal err = ENoErr;
+    uint32 *pVoteCounts = pDetectorState->m_Accumulator.m_pVoteCounts;
+    int32 maxPeaks = pDetectorState->m_MaxPeaks;
+    int32 numPeaks = *pNumPeaks;
+    uint32 *pHeap = NULL;
+    int32 heapSize = 0;
+    int32 heapPos;
+    int32 childPos;
+    uint32 numVotes;
+    uint32 minKeptVotes;
+    int32 numTiesToKeep;
+    int32 numKept;
+    int32 peakNum;
+
+    if ((maxPeaks <= 0) || (numPeaks <= maxPeaks)) {
+        goto abort;
+    }
+
+    pHeap = (uint32 *) memAlloc(sizeof(uint32) * maxPeaks);
+    if (NULL == pHeap) {
+        gotoErr(EFail);
+    }
+
+    for (peakNum = 0; peakNum < numPeaks; peakNum++) {
+        numVotes = pVoteCounts[pPeakList[peakNum]];
+        if (heapSize < maxPeaks) {
+            // Add it to the bottom, and move it up past any larger parents.
+            heapPos = heapSize;
+            heapSize += 1;
+            while ((heapPos > 0) && (pHeap[(heapPos - 1) / 2] > numVotes)) {
+                pHeap[heapPos] = pHeap[(heapPos - 1) / 2];
+                heapPos = (heapPos - 1) / 2;
+            }
+            pHeap[heapPos] = numVotes;
+        } else if (numVotes > pHeap[0]) {
+            // Replace the smallest, and move it down past any smaller children.
+            heapPos = 0;
+            childPos = 1;
+            while (childPos < heapSize) {
+                if (((childPos + 1) < heapSize) && (pHeap[childPos + 1] < pHeap[childPos])) {
+                    childPos += 1;
+                }
+                if (pHeap[childPos] >= numVotes) {
+                    break;
+                }
+                pHeap[heapPos] = pHeap[childPos];
+                heapPos = childPos;
+                childPos = (2 * heapPos) + 1;
+            }
+            pHeap[heapPos] = numVotes;
+        }
+    } // for (peakNum = 0; peakNum < numPeaks; peakNum++)
+    minKeptVotes = pHeap[0];
+
+    numTiesToKeep = maxPeaks;
+    for (peakNum = 0; peakNum < numPeaks; peakNum++) {
+        if (pVoteCounts[pPeakList[peakNum]] > minKeptVotes) {
+            numTiesToKeep -= 1;
+        }
+    }
+
+    numKept = 0;
+    for (peakNum = 0; peakNum < numPeaks; peakNum++) {
+        numVotes = pVoteCounts[pPeakList[peakNum]];
+        if (numVotes < minKeptVotes) {
+            continue;
+        }
+        if (numVotes == minKeptVotes) {
+            if (numTiesToKeep <= 0) {
+                continue;
+            }
+            numTiesToKeep -= 1;
+        }
+        pPeakList[numKept] = pPeakList[peakNum];
+        numKept += 1;
+    }
+    *pNumPeaks = numKept;
+
+abort:
+    memFree(pHeap);
+    returnErr(err);
+} // KeepStrongestPeaks
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [AllocateHoughAccumulator]
+//
+// Only the vote counts are cleared. The endpoint planes are not, so the
+// pages of cells that never get a vote are never touched.
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+AllocateHoughAccumulator(CHoughAccumulator *pAccumulator, int32 numEntries) {
+    ErrVal err = ENoErr;
+
+    pAccumulator->m_pVoteCounts = (uint32 *) memCalloc(sizeof(uint32) * numEntries);
+    pAccumulator->m_pFirstPoints = (uint32 *) memAlloc(sizeof(uint32) * numEntries);
+    pAccumulator->m_pLastPoints = (uint32 *) memAlloc(sizeof(uint32) * numEntries);
+    if ((NULL == pAccumulator->m_pVoteCounts)
+            || (NULL == pAccumulator->m_pFirstPoints)
+            || (NULL == pAccumulator->m_pLastPoints)) {
+        FreeHoughAccumulator(pAccumulator);
+        gotoErr(EFail);
+    }
+
+abort:
+    returnErr(err);
+} // AllocateHoughAccumulator
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FreeHoughAccumulator]
+//
+/////////////////////////////////////////////////////////////////////////////
+static void
+FreeHoughAccumulator(CHoughAccumulator *pAccumulator) {
+    memFree(pAccumulator->m_pVoteCounts);
+    pAccumulator->m_pVoteCounts = NULL;
+    memFree(pAccumulator->m_pFirstPoints);
+    pAccumulator->m_pFirstPoints = NULL;
+    memFree(pAccumulator->m_pLastPoints);
+    pAccumulator->m_pLastPoints = NULL;
+} // FreeHoughAccumulator
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RecordOneLine]
+//
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+RecordOneLine(CPossibleLine *pPossibleLine, CLineDetectorState *pDetectorState) {
+    ErrVal err = ENoErr;
+    CBioCADLine *pLine;
+    int32 deltaY = 0;
+    int32 deltaX = 0;
+    int32 absDeltaX;
+    int32 absDeltaY;
+    int32 maxPixels;
+    int32 stepY;
+    bool fUsefulLine = false;
+    double slope;
+    double yIntercept;
+    int32 x;
+    int32 y;
+    double theoreticalX;
+    double theoreticalY;
+    double density;
+
+
+    if ((NULL == pPossibleLine) || (NULL == pDetectorState))
+    {
+        gotoErr(EFail);
+    }
+    fUsefulLine = true;
+
+    deltaX = pPossibleLine->m_PointB.m_X - pPossibleLine->m_PointA.m_X;
+    deltaY = pPossibleLine->m_PointB.m_Y - pPossibleLine->m_PointA.m_Y;
+
+    // Treat vertical lines as "almost" vertical so the slope can be calculated
+    if (0 == deltaX)
+    {
+        deltaX = 1;
+    }
+
+    slope = ((double) deltaY) / ((double) deltaX);
+    // y = mx + b so, after some algebra  b = y - mx
+    yIntercept = ((double) pPossibleLine->m_PointA.m_Y) - (slope * ((double) pPossibleLine->m_PointA.m_X));
+
+
+    fUsefulLine = OverlapNewLineWithExistingLines(pPossibleLine, slope, yIntercept, pDetectorState);
+    if (!fUsefulLine)
+    {
+        pDetectorState->m_NumDuplicateLines += 1;
+        goto abort;
+    }
+
+    pLine = pDetectorState->m_Arena.NewLine();
+    if (NULL == pLine)
+    {
+        gotoErr(EFail);
+    }
+
+    pLine->m_PointA = pPossibleLine->m_PointA;
+    pLine->m_PointB = pPossibleLine->m_PointB;
+    pLine->m_Slope = slope;
+    pLine->m_YIntercept = yIntercept;
+
+    // Each line forms an angle with this horizontal line, and those angles
+    // are a function of the slopes of each line. Use atan(x,y) to compute
+    // the angle between each line and the horizontal line.
+    //   slope = deltaY / deltaX. 
+    //   If deltaX = 1, then deltaY = slope.
+    pLine->m_AngleWithHorizontal = atan2((double) 1.0, (double) slope);        
+
+
+    // Find the edge pixels along the line. This steps one pixel at a time
+    // along whichever of x or y changes more, so a steep line is checked as
+    // closely as a flat one. Each step checks the two pixels on either side
+    // of the exact line. The pixels go in one array from the arena,
+    // which is then trimmed to the pixels that were found.
+    absDeltaX = pLine->m_PointB.m_X - pLine->m_PointA.m_X;
+    if (absDeltaX < 0) {
+        absDeltaX = -absDeltaX;
+    }
+    absDeltaY = pLine->m_PointB.m_Y - pLine->m_PointA.m_Y;
+    if (absDeltaY < 0) {
+        absDeltaY = -absDeltaY;
+    }
+    maxPixels = 2 * (((absDeltaX > absDeltaY) ? absDeltaX : absDeltaY) + 1);
+    pLine->m_pPixels = (CBioCADPixel *) pDetectorState->m_Arena.Alloc(sizeof(CBioCADPixel) * maxPixels);
+    if (NULL == pLine->m_pPixels)
+    {
+        pDetectorState->m_Arena.ReleaseUnused(pLine, sizeof(CBioCADLine), 0);
+        gotoErr(EFail);
+    }
+
+    if (absDeltaX >= absDeltaY)
+    {
+        for (x = pLine->m_PointA.m_X; x <= pLine->m_PointB.m_X; x++)
+        {
+            theoreticalY = (((double) x) * pLine->m_Slope) + yIntercept;
+
+            // Truncate the floating point number. This finds the pixel with
+            // y rounded down, which is just below the point, and the pixel
+            // above it is just above the point.
+            y = (int32) (theoreticalY);
+            AddLinePixelIfEdge(pDetectorState, pLine, x, y);
+            AddLinePixelIfEdge(pDetectorState, pLine, x, y + 1);
+        } // for (x = pLine->m_PointA.m_X; x <= pLine->m_PointB.m_X; x++)
+    }
+    else
+    {
+        // The slope is no use for a line that is nearly vertical, so step
+        // along y and find x from the endpoints.
+        stepY = (pLine->m_PointB.m_Y > pLine->m_PointA.m_Y) ? 1 : -1;
+        for (y = pLine->m_PointA.m_Y; y != (pLine->m_PointB.m_Y + stepY); y += stepY)
+        {
+            theoreticalX = ((double) pLine->m_PointA.m_X)
+                + ((((double) (y - pLine->m_PointA.m_Y)) * ((double) (pLine->m_PointB.m_X - pLine->m_PointA.m_X)))
+                    / ((double) (pLine->m_PointB.m_Y - pLine->m_PointA.m_Y)));
+
+            x = (int32) (theoreticalX);
+            AddLinePixelIfEdge(pDetectorState, pLine, x, y);
+            AddLinePixelIfEdge(pDetectorState, pLine, x + 1, y);
+        } // for (y = pLine->m_PointA.m_Y; y != (pLine->m_PointB.m_Y + stepY); y += stepY)
+    }
+    pDetectorState->m_Arena.ReleaseUnused(
+                                pLine->m_pPixels,
+                                sizeof(CBioCADPixel) * maxPixels,
+                                sizeof(CBioCADPixel) * pLine->m_NumPixels);
+
+    // Check the pixel density
+    density = pLine->m_NumPixels / pLine->GetLength();
+    if (density < pDetectorState->m_MinPixelDensityForRealLine)
+    {
+        // The pixels were the last allocation. If they fit in the same block
+        // as the line, then the line is just before them and goes back too.
+        pDetectorState->m_Arena.ReleaseUnused(pLine->m_pPixels, sizeof(CBioCADPixel) * pLine->m_NumPixels, 0);
+        pDetectorState->m_Arena.ReleaseUnused(pLine, sizeof(CBioCADLine), 0);
+        goto abort;
+    }
+
+    // Add it to the list of useful lines.
+    pLine->m_pNextLine = pDetectorState->m_pLineList;
+    pDetectorState->m_pLineList = pLine;
+    pDetectorState->m_NumLines += 1;
+
+    err = AddLineToIndex(pDetectorState, pLine);
+    if (err) {
+        gotoErr(err);
+    }
+
+abort:
+    returnErr(err);
+} // RecordOneLine
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [OverlapNewLineWithExistingLines]
+//
+// Only the lines in the cells of the line index around the new line can be
+// close enough to overlap it, so those are the only ones that are checked.
+// A line that is merged with the new line gets a new slope and intercept,
+// so it is taken out of its cell, and is put back in the right cell once
+// every cell has been checked. That way, no line is checked twice.
+/////////////////////////////////////////////////////////////////////////////
+bool
 OverlapNewLineWithExistingLines(
                     CPossibleLine *pPossibleLine,
                     double slope,
                     double yIntercept,
                     CLineDetectorState *pDetectorState)
 {
-    CBioCADLine *pExistingLine = NULL;
-    int32 deltaY = 0;
-    int32 deltaX = 0;
-    double startPointDifference;
-    //double endPointDifference;
-    bool fOverlappingLines = false;
+    CLineIndex *pIndex = &(pDetectorState->m_LineIndex);
+    CLineIndexEntry **ppPrevEntry;
+    CLineIndexEntry *pEntry;
+    CLineIndexEntry *pMovedEntryList = NULL;
+    int64 slopeCell;
+    int64 interceptCell;
+    int64 neighborSlopeCell;
+    int64 neighborInterceptCell;
+    int32 bucketNum;
     bool fUsefulLine = false;
 
 
     fUsefulLine = true;
 
+    if (NULL == pIndex->m_pBuckets) {
+        return(fUsefulLine);
+    }
 
     // Look if this line overlaps an alternate line.
-    pExistingLine = pDetectorState->m_pLineList;
-    while (pExistingLine)
-    {        
-        fOverlappingLines = false;
+    slopeCell = GetLineIndexCell(slope, pDetectorState->m_AngleResolutionInRadians);
+    interceptCell = GetLineIndexCell(yIntercept, pDetectorState->m_MinPointResolution);
+    for (neighborSlopeCell = slopeCell - 1; neighborSlopeCell <= slopeCell + 1; neighborSlopeCell++) {
+        for (neighborInterceptCell = interceptCell - 1; neighborInterceptCell <= interceptCell + 1; neighborInterceptCell++) {
+            bucketNum = GetLineIndexBucket(pIndex, neighborSlopeCell, neighborInterceptCell);
+            ppPrevEntry = &(pIndex->m_pBuckets[bucketNum]);
+            while (*ppPrevEntry) {
+                pEntry = *ppPrevEntry;
+                // Different cells can hash to the same bucket.
+                if ((pEntry->m_SlopeCell != neighborSlopeCell)
+                        || (pEntry->m_InterceptCell != neighborInterceptCell)) {
+                    ppPrevEntry = &(pEntry->m_pNextEntry);
+                    continue;
+                }
+
+                if (MergeIfLinesOverlap(pPossibleLine, slope, yIntercept, pEntry->m_pLine, pDetectorState)) {
+                    fUsefulLine = false;
+
+                    *ppPrevEntry = pEntry->m_pNextEntry;
+                    pEntry->m_pNextEntry = pMovedEntryList;
+                    pMovedEntryList = pEntry;
+                    pIndex->m_NumEntries -= 1;
+                } else {
+                    ppPrevEntry = &(pEntry->m_pNextEntry);
+                }
+            } // while (*ppPrevEntry)
+        } // for (neighborInterceptCell = interceptCell - 1; ...)
+    } // for (neighborSlopeCell = slopeCell - 1; ...)
+
+    // Put the lines that changed back into the index.
+    while (pMovedEntryList) {
+        pEntry = pMovedEntryList;
+        pMovedEntryList = pEntry->m_pNextEntry;
+        InsertLineIndexEntry(pDetectorState, pEntry);
+    }
+
+    return(fUsefulLine);
+} // OverlapNewLineWithExistingLines
+
+
+
+
 
-        // Check if the lines are roughly the same slope.
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [MergeIfLinesOverlap]
+//
+// If a new line overlaps an existing line, then extend the existing line
+// to include the new one, and return true.
+/////////////////////////////////////////////////////////////////////////////
+static bool
+MergeIfLinesOverlap(
+                CPossibleLine *pPossibleLine,
+                double slope,
+                double yIntercept,
+                CBioCADLine *pExistingLine,
+                CLineDetectorState *pDetectorState)
+{
+    int32 deltaY = 0;
+    int32 deltaX = 0;
+    double startPointDifference;
+    //double endPointDifference;
+    bool fOverlappingLines = false;
+    bool fMerged = false;
+
+    // Check if the lines are roughly the same slope.
+    if (DoubleValuesAreClose(
+                    slope, 
+                    pExistingLine->m_Slope, 
+                    pDetectorState->m_AngleResolutionInRadians))
+    {
+        // Check if they are roughly the same intercept. If so, then they may overlap.
         if (DoubleValuesAreClose(
-                        slope, 
-                        pExistingLine->m_Slope, 
-                        pDetectorState->m_AngleResolutionInRadians))
+                    yIntercept, 
+                    pExistingLine->m_YIntercept, 
+                    pDetectorState->m_MinPointResolution))
         {
-            // Check if they are roughly the same intercept. If so, then they may overlap.
-            if (DoubleValuesAreClose(
-                        yIntercept, 
-                        pExistingLine->m_YIntercept, 
-                        pDetectorState->m_MinPointResolution))
+            // If the endpoints really do overlap, then the lines overlap.
+            if ((pExistingLine->m_PointA.m_X >= pPossibleLine->m_PointA.m_X) 
+                && (pExistingLine->m_PointA.m_X <= pPossibleLine->m_PointB.m_X))
             {
-                // If the endpoints really do overlap, then the lines overlap.
-                if ((pExistingLine->m_PointA.m_X >= pPossibleLine->m_PointA.m_X) 
-                    && (pExistingLine->m_PointA.m_X <= pPossibleLine->m_PointB.m_X))
-                {
-                    fOverlappingLines = true;
-                }
-                else if ((pExistingLine->m_PointB.m_X >= pPossibleLine->m_PointA.m_X) 
-                    && (pExistingLine->m_PointB.m_X <= pPossibleLine->m_PointB.m_X))
-                {
+                fOverlappingLines = true;
+            }
+            else if ((pExistingLine->m_PointB.m_X >= pPossibleLine->m_PointA.m_X) 
+                && (pExistingLine->m_PointB.m_X <= pPossibleLine->m_PointB.m_X))
+            {
+                fOverlappingLines = true;
+            }
+
+            // If the two lines are actually just two adjacent dashes in a larger 
+            // dashed line, then combine them. This may be an artifact in the original image
+            // that breaks up a line.
+            if ((IntValuesAreClose(
+                        pExistingLine->m_PointA.m_X,
+                        pPossibleLine->m_PointB.m_X, 
+                        pDetectorState->m_MaxGapBetweenDashesInLine))
+                || (IntValuesAreClose(
+                        pExistingLine->m_PointB.m_X, 
+                        pPossibleLine->m_PointA.m_X, 
+                        pDetectorState->m_MaxGapBetweenDashesInLine)))
+            {
+                fOverlappingLines = true;
+            }
+
+            if (!fOverlappingLines) {
+                startPointDifference = GetDistanceBetweenPoints(
+                                                &(pExistingLine->m_PointA), 
+                                                &(pPossibleLine->m_PointA));
+                //endPointDifference = GetDistanceBetweenPoints(&(pExistingLine->m_PointB), &(pPossibleLine->m_PointB));                    
+                if ((startPointDifference <= pDetectorState->m_MinPointResolution)
+                    && (startPointDifference <= pDetectorState->m_MinPointResolution)) {
                     fOverlappingLines = true;
                 }
+            }
 
-                // If the two lines are actually just two adjacent dashes in a larger 
-                // dashed line, then combine them. This may be an artifact in the original image
-                // that breaks up a line.
-                if ((IntValuesAreClose(
-                            pExistingLine->m_PointA.m_X,
-                            pPossibleLine->m_PointB.m_X, 
-                            pDetectorState->m_MaxGapBetweenDashesInLine))
-                    || (IntValuesAreClose(
-                            pExistingLine->m_PointB.m_X, 
-                            pPossibleLine->m_PointA.m_X, 
-                            pDetectorState->m_MaxGapBetweenDashesInLine)))
-                {
-                    fOverlappingLines = true;
+
+            if (fOverlappingLines) {
+
+                fMerged = true;
+                // Extend the endpoints of the first line to include the second line.
+                if (pPossibleLine->m_PointA.m_X < pExistingLine->m_PointA.m_X) {
+                    pExistingLine->m_PointA = pPossibleLine->m_PointA;
+                }
+                if (pPossibleLine->m_PointB.m_X > pExistingLine->m_PointB.m_X) {
+                    pExistingLine->m_PointB = pPossibleLine->m_PointB;
                 }
 
-                if (!fOverlappingLines) {
-                    startPointDifference = GetDistanceBetweenPoints(
-                                                    &(pExistingLine->m_PointA), 
-                                                    &(pPossibleLine->m_PointA));
-                    //endPointDifference = GetDistanceBetweenPoints(&(pExistingLine->m_PointB), &(pPossibleLine->m_PointB));                    
-                    if ((startPointDifference <= pDetectorState->m_MinPointResolution)
-                        && (startPointDifference <= pDetectorState->m_MinPointResolution)) {
-                        fOverlappingLines = true;
-                    }
+                // Now we have extended the line, we may want to update its slope and intercept
+                deltaX = pExistingLine->m_PointB.m_X - pExistingLine->m_PointA.m_X;
+                if (0 == deltaX) {
+                    deltaX = 1;
                 }
+                deltaY = pExistingLine->m_PointB.m_Y - pExistingLine->m_PointA.m_Y;
+                pExistingLine->m_Slope = ((double) deltaY) / ((double) deltaX);
+                // y = mx + b so, after some algebra  b = y - mx
+                pExistingLine->m_YIntercept = ((double) pExistingLine->m_PointA.m_Y) - (slope * ((double) pExistingLine->m_PointA.m_X));
+            }
+        } // Same Y-Intercept
+    } // Same slope
 
+    return(fMerged);
+} // MergeIfLinesOverlap
 
-                if (fOverlappingLines) {
 
-                    fUsefulLine = false;
-                    // Extend the endpoints of the first line to include the second line.
-                    if (pPossibleLine->m_PointA.m_X < pExistingLine->m_PointA.m_X) {
-                        pExistingLine->m_PointA = pPossibleLine->m_PointA;
-                    }
-                    if (pPossibleLine->m_PointB.m_X > pExistingLine->m_PointB.m_X) {
-                        pExistingLine->m_PointB = pPossibleLine->m_PointB;
-                    }
-
-                    // Now we have extended the line, we may want to update its slope and intercept
-                    deltaX = pExistingLine->m_PointB.m_X - pExistingLine->m_PointA.m_X;
-                    if (0 == deltaX) {
-                        deltaX = 1;
-                    }
-                    deltaY = pExistingLine->m_PointB.m_Y - pExistingLine->m_PointA.m_Y;
-                    pExistingLine->m_Slope = ((double) deltaY) / ((double) deltaX);
-                    // y = mx + b so, after some algebra  b = y - mx
-                    pExistingLine->m_YIntercept = ((double) pExistingLine->m_PointA.m_Y) - (slope * ((double) pExistingLine->m_PointA.m_X));
-                }
-            } // Same Y-Intercept
-        } // Same slope
 
-        pExistingLine = pExistingLine->m_pNextLine;
-    } // while (pExistingLine)
-    
 
-    return(fUsefulLine);
-} // OverlapNewLineWithExistingLines
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [InitLineIndex]
+//
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+InitLineIndex(CLineIndex *pIndex) {
+    ErrVal err = ENoErr;
+
+    pIndex->m_NumEntries = 0;
+    pIndex->m_NumBuckets = LINE_INDEX_INITIAL_BUCKETS;
+    pIndex->m_pBuckets = (CLineIndexEntry **) memCalloc(sizeof(CLineIndexEntry *) * pIndex->m_NumBuckets);
+    if (NULL == pIndex->m_pBuckets) {
+        pIndex->m_NumBuckets = 0;
+        gotoErr(EFail);
+    }
+
+abort:
+    returnErr(err);
+} // InitLineIndex
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FreeLineIndex]
+//
+// This only frees the index. The lines are still on m_pLineList.
+/////////////////////////////////////////////////////////////////////////////
+static void
+FreeLineIndex(CLineIndex *pIndex) {
+    CLineIndexEntry *pEntry;
+    int32 bucketNum;
+
+    if (NULL == pIndex->m_pBuckets) {
+        return;
+    }
+
+    for (bucketNum = 0; bucketNum < pIndex->m_NumBuckets; bucketNum++) {
+        while (pIndex->m_pBuckets[bucketNum]) {
+            pEntry = pIndex->m_pBuckets[bucketNum];
+            pIndex->m_pBuckets[bucketNum] = pEntry->m_pNextEntry;
+            memFree(pEntry);
+        }
+    }
+
+    memFree(pIndex->m_pBuckets);
+    pIndex->m_pBuckets = NULL;
+    pIndex->m_NumBuckets = 0;
+    pIndex->m_NumEntries = 0;
+} // FreeLineIndex
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [AddLineToIndex]
+//
+/////////////////////////////////////////////////////////////////////////////
+static ErrVal
+AddLineToIndex(CLineDetectorState *pDetectorState, CBioCADLine *pLine) {
+    ErrVal err = ENoErr;
+    CLineIndexEntry *pEntry;
+
+    if (NULL == pDetectorState->m_LineIndex.m_pBuckets) {
+        gotoErr(EFail);
+    }
+
+    pEntry = (CLineIndexEntry *) memAlloc(sizeof(CLineIndexEntry));
+    if (NULL == pEntry) {
+        gotoErr(EFail);
+    }
+    pEntry->m_pLine = pLine;
+    InsertLineIndexEntry(pDetectorState, pEntry);
+
+    if (pDetectorState->m_LineIndex.m_NumEntries 
+            > (pDetectorState->m_LineIndex.m_NumBuckets * LINE_INDEX_MAX_ENTRIES_PER_BUCKET)) {
+        GrowLineIndex(&(pDetectorState->m_LineIndex));
+    }
+
+abort:
+    returnErr(err);
+} // AddLineToIndex
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [InsertLineIndexEntry]
+//
+// Put an entry in the cell for the current slope and intercept of its line.
+/////////////////////////////////////////////////////////////////////////////
+static void
+InsertLineIndexEntry(CLineDetectorState *pDetectorState, CLineIndexEntry *pEntry) {
+    CLineIndex *pIndex = &(pDetectorState->m_LineIndex);
+    int32 bucketNum;
+
+    pEntry->m_SlopeCell = GetLineIndexCell(
+                                pEntry->m_pLine->m_Slope,
+                                pDetectorState->m_AngleResolutionInRadians);
+    pEntry->m_InterceptCell = GetLineIndexCell(
+                                pEntry->m_pLine->m_YIntercept,
+                                pDetectorState->m_MinPointResolution);
+
+    bucketNum = GetLineIndexBucket(pIndex, pEntry->m_SlopeCell, pEntry->m_InterceptCell);
+    pEntry->m_pNextEntry = pIndex->m_pBuckets[bucketNum];
+    pIndex->m_pBuckets[bucketNum] = pEntry;
+    pIndex->m_NumEntries += 1;
+} // InsertLineIndexEntry
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GrowLineIndex]
+//
+// Rehash every entry into 4 times as many buckets. If there is not enough
+// memory, then just keep the old buckets. The chains get longer, but the
+// index still works.
+/////////////////////////////////////////////////////////////////////////////
+static void
+GrowLineIndex(CLineIndex *pIndex) {
+    CLineIndexEntry **pOldBuckets = pIndex->m_pBuckets;
+    int32 numOldBuckets = pIndex->m_NumBuckets;
+    CLineIndexEntry *pEntry;
+    int32 bucketNum;
+    int32 newBucketNum;
+
+    pIndex->m_pBuckets = (CLineIndexEntry **) memCalloc(sizeof(CLineIndexEntry *) * numOldBuckets * 4);
+    if (NULL == pIndex->m_pBuckets) {
+        pIndex->m_pBuckets = pOldBuckets;
+        return;
+    }
+    pIndex->m_NumBuckets = numOldBuckets * 4;
+
+    for (bucketNum = 0; bucketNum < numOldBuckets; bucketNum++) {
+        while (pOldBuckets[bucketNum]) {
+            pEntry = pOldBuckets[bucketNum];
+            pOldBuckets[bucketNum] = pEntry->m_pNextEntry;
+
+            newBucketNum = GetLineIndexBucket(pIndex, pEntry->m_SlopeCell, pEntry->m_InterceptCell);
+            pEntry->m_pNextEntry = pIndex->m_pBuckets[newBucketNum];
+            pIndex->m_pBuckets[newBucketNum] = pEntry;
+        }
+    }
+
+    memFree(pOldBuckets);
+} // GrowLineIndex
 
 
 
@@ -0,0 +1,331 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2010-2018 Dawson Dean
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Luminance Tables
+// ================
+//
+// This keeps the integral images (summed-area tables) of the luminance of
+// an image, and of the square of the luminance. With them, the total of
+// any rectangle takes 4 reads, no matter how big it is, and the total of
+// a shape is one rectangle for each of its cross sections. That makes it
+// cheap to ask about many overlapping inspect regions in the same image.
+//
+// Here, luminance is (red + green + blue), 0-765, the same value that
+// GetPixelStats has always used.
+//
+// The table is built the first time it is used. It is rebuilt whenever
+// the change number of the image moves, which happens whenever any pixel
+// is written, so it never returns totals for pixels that were drawn over.
+//
+// The tables are built in two passes. The first pass is split into
+// horizontal bands that run in parallel, and it reads each row and
+// finds the running total along that row. The second pass adds each row
+// to the row below it, so it runs in order from the top.
+/////////////////////////////////////////////////////////////////////////////
+
+#if WASM
+#include "portableBuildingBlocks.h"
+#else
+#include "buildingBlocks.h"
+#endif
+
+#include "imageLib.h"
+#include "imageLibInternal.h"
+
+FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
+
+// Small images are not worth the cost of starting a thread.
+#define LUMINANCE_TABLE_MIN_ROWS_PER_BAND       64
+
+// This is the state shared by all bands of one build.
+class CLuminanceTablePass {
+public:
+    CLuminanceTable     *m_pTable;
+    CImageFile          *m_pImage;
+
+    // One row buffer for each band.
+    uint32              *m_pPixelRows;
+}; // CLuminanceTablePass
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [CLuminanceTable]
+//
+/////////////////////////////////////////////////////////////////////////////
+CLuminanceTable::CLuminanceTable() {
+    m_MaxXPos = 0;
+    m_MaxYPos = 0;
+    m_pTotalPlane = NULL;
+    m_pSquaresPlane = NULL;
+    m_pImage = NULL;
+    m_ChangeNumber = 0;
+} // CLuminanceTable
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////
+CLuminanceTable::~CLuminanceTable() {
+    Discard();
+} // ~CLuminanceTable
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Discard]
+//
+/////////////////////////////////////////////////////////////////////////////
+void
+CLuminanceTable::Discard() {
+    memFree(m_pTotalPlane);
+    m_pTotalPlane = NULL;
+    memFree(m_pSquaresPlane);
+    m_pSquaresPlane = NULL;
+
+    m_MaxXPos = 0;
+    m_MaxYPos = 0;
+    m_pImage = NULL;
+} // Discard
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Update]
+//
+// Make sure the tables match the current pixels of pImage. This does
+// nothing if they already do.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CLuminanceTable::Update(CImageFile *pImage) {
+    ErrVal err = ENoErr;
+    CLuminanceTablePass pass;
+    int32 imageWidth;
+    int32 imageHeight;
+    int32 numBands;
+    int32 planeWidth;
+    int32 numEntries;
+    uint64 *pTotalRow;
+    uint64 *pSquaresRow;
+    int32 x;
+    int32 y;
+
+    pass.m_pPixelRows = NULL;
+
+    if (NULL == pImage) {
+        gotoErr(EFail);
+    }
+    err = pImage->GetImageInfo(&imageWidth, &imageHeight);
+    if (err) {
+        gotoErr(err);
+    }
+    if ((imageWidth < 0) || (imageHeight < 0)) {
+        gotoErr(EFail);
+    }
+
+    if ((pImage == m_pImage)
+            && (NULL != m_pTotalPlane)
+            && (imageWidth == m_MaxXPos)
+            && (imageHeight == m_MaxYPos)
+            && (pImage->GetChangeNumber() == m_ChangeNumber)) {
+        gotoErr(ENoErr);
+    }
+
+    Discard();
+
+    planeWidth = imageWidth + 1;
+    numEntries = planeWidth * (imageHeight + 1);
+    numBands = GetNumRowBands(imageHeight, LUMINANCE_TABLE_MIN_ROWS_PER_BAND);
+
+    m_pTotalPlane = (uint64 *) memAlloc(sizeof(uint64) * numEntries);
+    m_pSquaresPlane = (uint64 *) memAlloc(sizeof(uint64) * numEntries);
+    pass.m_pPixelRows = (uint32 *) memAlloc(sizeof(uint32) * (imageWidth + 1) * numBands);
+    if ((NULL == m_pTotalPlane) || (NULL == m_pSquaresPlane) || (NULL == pass.m_pPixelRows)) {
+        gotoErr(EFail);
+    }
+    m_MaxXPos = imageWidth;
+    m_MaxYPos = imageHeight;
+
+    // The first row is above the image.
+    for (x = 0; x < planeWidth; x++) {
+        m_pTotalPlane[x] = 0;
+        m_pSquaresPlane[x] = 0;
+    }
+
+    // Find the running total along each row.
+    pass.m_pTable = this;
+    pass.m_pImage = pImage;
+    err = RunRowBands(imageHeight, numBands, SumRowsBand, &pass);
+    if (err) {
+        gotoErr(err);
+    }
+
+    // Add in all the rows above.
+    for (y = 1; y < imageHeight; y++) {
+        pTotalRow = m_pTotalPlane + ((y + 1) * planeWidth);
+        pSquaresRow = m_pSquaresPlane + ((y + 1) * planeWidth);
+        for (x = 1; x < planeWidth; x++) {
+            pTotalRow[x] += pTotalRow[x - planeWidth];
+            pSquaresRow[x] += pSquaresRow[x - planeWidth];
+        }
+    } // for (y = 1; y < imageHeight; y++)
+
+    m_pImage = pImage;
+    m_ChangeNumber = pImage->GetChangeNumber();
+
+abort:
+    memFree(pass.m_pPixelRows);
+    if (err) {
+        Discard();
+    }
+    returnErr(err);
+} // Update
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [SumRowsBand]
+//
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CLuminanceTable::SumRowsBand(void *pContext, int32 bandNum, int32 startRow, int32 stopRow) {
+    ErrVal err = ENoErr;
+    CLuminanceTablePass *pPass = (CLuminanceTablePass *) pContext;
+    CLuminanceTable *pTable = pPass->m_pTable;
+    int32 planeWidth = pTable->m_MaxXPos + 1;
+    uint32 *pPixelRow;
+    uint64 *pTotalRow;
+    uint64 *pSquaresRow;
+    uint64 luminance;
+    uint64 rowTotal;
+    uint64 rowSquares;
+    int32 x;
+    int32 y;
+
+    pPixelRow = pPass->m_pPixelRows + (bandNum * planeWidth);
+    for (y = startRow; y < stopRow; y++) {
+        if (pTable->m_MaxXPos > 0) {
+            err = ReadColorSumRow(pPass->m_pImage, y, 0, pTable->m_MaxXPos, pPixelRow);
+            if (err) {
+                gotoErr(err);
+            }
+        }
+
+        pTotalRow = pTable->m_pTotalPlane + ((y + 1) * planeWidth);
+        pSquaresRow = pTable->m_pSquaresPlane + ((y + 1) * planeWidth);
+        pTotalRow[0] = 0;
+        pSquaresRow[0] = 0;
+        rowTotal = 0;
+        rowSquares = 0;
+        for (x = 0; x < pTable->m_MaxXPos; x++) {
+            luminance = pPixelRow[x];
+            rowTotal += luminance;
+            rowSquares += luminance * luminance;
+            pTotalRow[x + 1] = rowTotal;
+            pSquaresRow[x + 1] = rowSquares;
+        }
+    } // for (y = startRow; y < stopRow; y++)
+
+abort:
+    returnErr(err);
+} // SumRowsBand
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetRectTotals]
+//
+// Get the totals of the pixels from (leftX, topY) up to but not including
+// (stopX, stopY). Pixels outside the image count as 0.
+// Either result may be NULL.
+/////////////////////////////////////////////////////////////////////////////
+void
+CLuminanceTable::GetRectTotals(
+                        int32 leftX,
+                        int32 topY,
+                        int32 stopX,
+                        int32 stopY,
+                        uint64 *pTotal,
+                        uint64 *pTotalSquares) {
+    int32 planeWidth = m_MaxXPos + 1;
+    int32 topRow;
+    int32 bottomRow;
+
+    if (pTotal) {
+        *pTotal = 0;
+    }
+    if (pTotalSquares) {
+        *pTotalSquares = 0;
+    }
+    if (NULL == m_pTotalPlane) {
+        return;
+    }
+
+    if (leftX < 0) {
+        leftX = 0;
+    }
+    if (stopX > m_MaxXPos) {
+        stopX = m_MaxXPos;
+    }
+    if (topY < 0) {
+        topY = 0;
+    }
+    if (stopY > m_MaxYPos) {
+        stopY = m_MaxYPos;
+    }
+    if ((leftX >= stopX) || (topY >= stopY)) {
+        return;
+    }
+
+    topRow = topY * planeWidth;
+    bottomRow = stopY * planeWidth;
+    if (pTotal) {
+        *pTotal = m_pTotalPlane[bottomRow + stopX] - m_pTotalPlane[topRow + stopX]
+                    - m_pTotalPlane[bottomRow + leftX] + m_pTotalPlane[topRow + leftX];
+    }
+    if (pTotalSquares) {
+        *pTotalSquares = m_pSquaresPlane[bottomRow + stopX] - m_pSquaresPlane[topRow + stopX]
+                    - m_pSquaresPlane[bottomRow + leftX] + m_pSquaresPlane[topRow + leftX];
+    }
+} // GetRectTotals
+
@@ -0,0 +1,217 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2010-2018 Dawson Dean
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Parallel Row Bands
+// ==================
+//
+// Most passes over an image do the same work on every row, and each row
+// only writes its own results. This splits the rows of an image into
+// horizontal bands, and runs each band on its own thread.
+//
+// The bands are a fixed partition of the rows, so a caller can allocate
+// any per-band state (row buffers, partial sums) before the threads start,
+// and then merge it in band order afterward. That keeps the results the
+// same no matter how the threads are scheduled.
+//
+// Band procedures must not allocate memory or touch any shared state
+// other than their own rows. The calling thread runs band 0 itself, and
+// waits for all other bands to finish before returning.
+//
+// WASM builds do not have threads, so they run every band in order on
+// the calling thread.
+/////////////////////////////////////////////////////////////////////////////
+
+#if !WASM
+#include <thread>
+#endif
+
+#if WASM
+#include "portableBuildingBlocks.h"
+#else
+#include "buildingBlocks.h"
+#endif
+
+#include "imageLib.h"
+#include "imageLibInternal.h"
+
+FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
+
+
+// This is one band, and everything its thread needs.
+class CRowBandJob {
+public:
+    CRowBandProc    m_pProc;
+    void            *m_pContext;
+    int32           m_BandNum;
+    int32           m_StartRow;
+    int32           m_StopRow;
+    ErrVal          m_Err;
+}; // CRowBandJob
+
+static void RunOneRowBand(CRowBandJob *pJob);
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetNumRowBands]
+//
+// Decide how many bands to split numRows rows into. There is at most
+// one band per processor, and each band has at least minRowsPerBand rows,
+// so small images are not worth the cost of starting a thread.
+/////////////////////////////////////////////////////////////////////////////
+int32
+GetNumRowBands(int32 numRows, int32 minRowsPerBand) {
+    int32 numBands = 1;
+
+#if !WASM
+    numBands = (int32) std::thread::hardware_concurrency();
+#endif
+    if (numBands > MAX_ROW_BANDS) {
+        numBands = MAX_ROW_BANDS;
+    }
+
+    if (minRowsPerBand < 1) {
+        minRowsPerBand = 1;
+    }
+    if (numBands > (numRows / minRowsPerBand)) {
+        numBands = numRows / minRowsPerBand;
+    }
+    if (numBands < 1) {
+        numBands = 1;
+    }
+
+    return(numBands);
+} // GetNumRowBands
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetRowBandRange]
+//
+// Band bandNum covers rows [*pStartRow, *pStopRow). The bands are as
+// close to the same size as possible.
+/////////////////////////////////////////////////////////////////////////////
+void
+GetRowBandRange(int32 numRows, int32 numBands, int32 bandNum, int32 *pStartRow, int32 *pStopRow) {
+    *pStartRow = (int32) ((((int64) numRows) * bandNum) / numBands);
+    *pStopRow = (int32) ((((int64) numRows) * (bandNum + 1)) / numBands);
+} // GetRowBandRange
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RunRowBands]
+//
+// Run pProc once for each of numBands bands, in parallel. This returns
+// the error from the lowest numbered band that failed.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+RunRowBands(int32 numRows, int32 numBands, CRowBandProc pProc, void *pContext) {
+    ErrVal err = ENoErr;
+    CRowBandJob jobList[MAX_ROW_BANDS];
+#if !WASM
+    std::thread threadList[MAX_ROW_BANDS];
+#endif
+    int32 bandNum;
+
+    if ((NULL == pProc) || (numBands < 1) || (numBands > MAX_ROW_BANDS)) {
+        gotoErr(EFail);
+    }
+    if (numRows <= 0) {
+        gotoErr(ENoErr);
+    }
+
+    for (bandNum = 0; bandNum < numBands; bandNum++) {
+        jobList[bandNum].m_pProc = pProc;
+        jobList[bandNum].m_pContext = pContext;
+        jobList[bandNum].m_BandNum = bandNum;
+        GetRowBandRange(numRows, numBands, bandNum, &(jobList[bandNum].m_StartRow), &(jobList[bandNum].m_StopRow));
+        jobList[bandNum].m_Err = ENoErr;
+    }
+
+#if WASM
+    for (bandNum = 0; bandNum < numBands; bandNum++) {
+        RunOneRowBand(&(jobList[bandNum]));
+    }
+#else
+    // Start every band except the first on a new thread. If the system
+    // will not give us another thread, then just run that band here.
+    for (bandNum = 1; bandNum < numBands; bandNum++) {
+        try {
+            threadList[bandNum] = std::thread(RunOneRowBand, &(jobList[bandNum]));
+        } catch (...) {
+            RunOneRowBand(&(jobList[bandNum]));
+        }
+    }
+
+    // The calling thread does the first band.
+    RunOneRowBand(&(jobList[0]));
+
+    for (bandNum = 1; bandNum < numBands; bandNum++) {
+        if (threadList[bandNum].joinable()) {
+            threadList[bandNum].join();
+        }
+    }
+#endif
+
+    for (bandNum = 0; bandNum < numBands; bandNum++) {
+        if (jobList[bandNum].m_Err) {
+            gotoErr(jobList[bandNum].m_Err);
+        }
+    }
+
+abort:
+    returnErr(err);
+} // RunRowBands
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RunOneRowBand]
+//
+/////////////////////////////////////////////////////////////////////////////
+static void
+RunOneRowBand(CRowBandJob *pJob) {
+    pJob->m_Err = pJob->m_pProc(
+                        pJob->m_pContext,
+                        pJob->m_BandNum,
+                        pJob->m_StartRow,
+                        pJob->m_StopRow);
+} // RunOneRowBand
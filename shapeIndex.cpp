@@ -0,0 +1,492 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2010-2018 Dawson Dean
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Shape Index
+// ===========
+//
+// This finds the shapes of an image by their feature ID, or by where they
+// are, without walking the whole shape list.
+//
+// The image is split into square cells, and each shape is added to every
+// cell that its bounding box touches. A search for a rectangle only looks
+// at the cells under the rectangle. A shape that covers several of those
+// cells is only reported from the first one, which is the top-left cell of
+// where the shape and the rectangle overlap, so it is never reported twice.
+//
+// The bounding box of a shape must be final before it is added, and it
+// must not change while the shape is in the index.
+//
+// The index also keeps the position of each shape in the shape list, so a
+// caller that picks one of several shapes can break ties the same way it
+// would by walking the list.
+/////////////////////////////////////////////////////////////////////////////
+
+#if WASM
+#include "portableBuildingBlocks.h"
+#else
+#include "buildingBlocks.h"
+#endif
+
+#include "imageLib.h"
+#include "imageLibInternal.h"
+
+FILE_DEBUGGING_GLOBALS(LOG_LEVEL_DEFAULT, 0);
+
+#define SHAPE_INDEX_CELL_SIZE           64
+
+// This must be a power of 2.
+#define SHAPE_INDEX_NUM_ID_BUCKETS      1024
+
+// This is one cell that one shape is in. The nodes of a shape are
+// allocated with its entry, right after it.
+class CShapeIndexCellNode {
+public:
+    CShapeIndexEntry        *m_pEntry;
+    CShapeIndexCellNode     *m_pNextNode;
+}; // CShapeIndexCellNode
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [CShapeIndex]
+//
+/////////////////////////////////////////////////////////////////////////////
+CShapeIndex::CShapeIndex() {
+    m_NumColumns = 0;
+    m_NumRows = 0;
+    m_MaxXPos = 0;
+    m_MaxYPos = 0;
+    m_pCellList = NULL;
+
+    m_pIDBucketList = NULL;
+    m_NumShapes = 0;
+
+    m_FrontPosition = 0;
+    m_BackPosition = 0;
+
+    m_pResultList = NULL;
+    m_MaxResults = 0;
+} // CShapeIndex
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////
+CShapeIndex::~CShapeIndex() {
+    Discard();
+} // ~CShapeIndex
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Discard]
+//
+// This removes every shape, but it does not delete the shapes.
+/////////////////////////////////////////////////////////////////////////////
+void
+CShapeIndex::Discard() {
+    CShapeIndexEntry *pEntry;
+    int32 bucketNum;
+
+    if (m_pIDBucketList) {
+        for (bucketNum = 0; bucketNum < SHAPE_INDEX_NUM_ID_BUCKETS; bucketNum++) {
+            while (m_pIDBucketList[bucketNum]) {
+                pEntry = m_pIDBucketList[bucketNum];
+                m_pIDBucketList[bucketNum] = pEntry->m_pNextInBucket;
+                memFree(pEntry);
+            }
+        }
+    }
+
+    memFree(m_pCellList);
+    m_pCellList = NULL;
+    memFree(m_pIDBucketList);
+    m_pIDBucketList = NULL;
+    memFree(m_pResultList);
+    m_pResultList = NULL;
+    m_MaxResults = 0;
+
+    m_NumColumns = 0;
+    m_NumRows = 0;
+    m_MaxXPos = 0;
+    m_MaxYPos = 0;
+    m_NumShapes = 0;
+    m_FrontPosition = 0;
+    m_BackPosition = 0;
+} // Discard
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [Initialize]
+//
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CShapeIndex::Initialize(int32 imageWidth, int32 imageHeight) {
+    ErrVal err = ENoErr;
+
+    Discard();
+
+    if ((imageWidth <= 0) || (imageHeight <= 0)) {
+        gotoErr(EFail);
+    }
+    m_MaxXPos = imageWidth - 1;
+    m_MaxYPos = imageHeight - 1;
+    m_NumColumns = (imageWidth + SHAPE_INDEX_CELL_SIZE - 1) / SHAPE_INDEX_CELL_SIZE;
+    m_NumRows = (imageHeight + SHAPE_INDEX_CELL_SIZE - 1) / SHAPE_INDEX_CELL_SIZE;
+
+    m_pCellList = (CShapeIndexCellNode **) memCalloc(sizeof(CShapeIndexCellNode *) * m_NumColumns * m_NumRows);
+    if (NULL == m_pCellList) {
+        gotoErr(EFail);
+    }
+    m_pIDBucketList = (CShapeIndexEntry **) memCalloc(sizeof(CShapeIndexEntry *) * SHAPE_INDEX_NUM_ID_BUCKETS);
+    if (NULL == m_pIDBucketList) {
+        gotoErr(EFail);
+    }
+
+abort:
+    returnErr(err);
+} // Initialize
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetColumn]
+//
+// Positions outside the image are in the nearest cell.
+/////////////////////////////////////////////////////////////////////////////
+int32
+CShapeIndex::GetColumn(int32 x) {
+    if (x < 0) {
+        x = 0;
+    }
+    if (x > m_MaxXPos) {
+        x = m_MaxXPos;
+    }
+    return(x / SHAPE_INDEX_CELL_SIZE);
+} // GetColumn
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [GetRow]
+//
+/////////////////////////////////////////////////////////////////////////////
+int32
+CShapeIndex::GetRow(int32 y) {
+    if (y < 0) {
+        y = 0;
+    }
+    if (y > m_MaxYPos) {
+        y = m_MaxYPos;
+    }
+    return(y / SHAPE_INDEX_CELL_SIZE);
+} // GetRow
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [AddShape]
+//
+// fFrontOfList says whether the shape was added to the front or the back
+// of the shape list.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CShapeIndex::AddShape(CBioCADShape *pShape, bool fFrontOfList) {
+    ErrVal err = ENoErr;
+    CShapeIndexEntry *pEntry;
+    CShapeIndexCellNode *pNode;
+    CShapeIndexCellNode **ppCell;
+    int32 numCells;
+    int32 column;
+    int32 row;
+    int32 bucketNum;
+
+    if ((NULL == pShape) || (NULL == m_pCellList)) {
+        gotoErr(EFail);
+    }
+
+    // If the bounding box is upside down, then the shape covers no pixels.
+    numCells = 0;
+    if ((pShape->m_BoundingBoxLeftX <= pShape->m_BoundingBoxRightX)
+            && (pShape->m_BoundingBoxTopY <= pShape->m_BoundingBoxBottomY)) {
+        numCells = (GetColumn(pShape->m_BoundingBoxRightX) - GetColumn(pShape->m_BoundingBoxLeftX) + 1)
+                        * (GetRow(pShape->m_BoundingBoxBottomY) - GetRow(pShape->m_BoundingBoxTopY) + 1);
+    }
+
+    pEntry = (CShapeIndexEntry *) memAlloc(sizeof(CShapeIndexEntry) + (sizeof(CShapeIndexCellNode) * numCells));
+    if (NULL == pEntry) {
+        gotoErr(EFail);
+    }
+    pEntry->m_pShape = pShape;
+    if (0 == m_NumShapes) {
+        pEntry->m_ListPosition = 0;
+        m_FrontPosition = 0;
+        m_BackPosition = 0;
+    } else if (fFrontOfList) {
+        m_FrontPosition = m_FrontPosition - 1;
+        pEntry->m_ListPosition = m_FrontPosition;
+    } else {
+        m_BackPosition = m_BackPosition + 1;
+        pEntry->m_ListPosition = m_BackPosition;
+    }
+
+    // An empty shape is only in the hash table.
+    if (numCells > 0) {
+        pEntry->m_LeftColumn = GetColumn(pShape->m_BoundingBoxLeftX);
+        pEntry->m_RightColumn = GetColumn(pShape->m_BoundingBoxRightX);
+        pEntry->m_TopRow = GetRow(pShape->m_BoundingBoxTopY);
+        pEntry->m_BottomRow = GetRow(pShape->m_BoundingBoxBottomY);
+    } else {
+        pEntry->m_LeftColumn = 0;
+        pEntry->m_RightColumn = -1;
+        pEntry->m_TopRow = 0;
+        pEntry->m_BottomRow = -1;
+    }
+
+    pNode = (CShapeIndexCellNode *) (pEntry + 1);
+    for (row = pEntry->m_TopRow; row <= pEntry->m_BottomRow; row++) {
+        for (column = pEntry->m_LeftColumn; column <= pEntry->m_RightColumn; column++) {
+            ppCell = &(m_pCellList[(row * m_NumColumns) + column]);
+            pNode->m_pEntry = pEntry;
+            pNode->m_pNextNode = *ppCell;
+            *ppCell = pNode;
+            pNode++;
+        }
+    }
+
+    bucketNum = pShape->m_FeatureID & (SHAPE_INDEX_NUM_ID_BUCKETS - 1);
+    pEntry->m_pNextInBucket = m_pIDBucketList[bucketNum];
+    m_pIDBucketList[bucketNum] = pEntry;
+    m_NumShapes += 1;
+
+abort:
+    returnErr(err);
+} // AddShape
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [RemoveShape]
+//
+// This does nothing if the shape is not in the index.
+/////////////////////////////////////////////////////////////////////////////
+void
+CShapeIndex::RemoveShape(CBioCADShape *pShape) {
+    CShapeIndexEntry *pEntry;
+    CShapeIndexEntry **ppPrevEntry;
+    CShapeIndexCellNode **ppPrevNode;
+    int32 column;
+    int32 row;
+
+    if ((NULL == pShape) || (NULL == m_pIDBucketList)) {
+        return;
+    }
+
+    ppPrevEntry = &(m_pIDBucketList[pShape->m_FeatureID & (SHAPE_INDEX_NUM_ID_BUCKETS - 1)]);
+    while ((*ppPrevEntry) && ((*ppPrevEntry)->m_pShape != pShape)) {
+        ppPrevEntry = &((*ppPrevEntry)->m_pNextInBucket);
+    }
+    pEntry = *ppPrevEntry;
+    if (NULL == pEntry) {
+        return;
+    }
+    *ppPrevEntry = pEntry->m_pNextInBucket;
+
+    for (row = pEntry->m_TopRow; row <= pEntry->m_BottomRow; row++) {
+        for (column = pEntry->m_LeftColumn; column <= pEntry->m_RightColumn; column++) {
+            ppPrevNode = &(m_pCellList[(row * m_NumColumns) + column]);
+            while ((*ppPrevNode) && ((*ppPrevNode)->m_pEntry != pEntry)) {
+                ppPrevNode = &((*ppPrevNode)->m_pNextNode);
+            }
+            if (*ppPrevNode) {
+                *ppPrevNode = (*ppPrevNode)->m_pNextNode;
+            }
+        }
+    }
+
+    memFree(pEntry);
+    m_NumShapes = m_NumShapes - 1;
+} // RemoveShape
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FindEntry]
+//
+/////////////////////////////////////////////////////////////////////////////
+CShapeIndexEntry *
+CShapeIndex::FindEntry(int32 featureID) {
+    CShapeIndexEntry *pEntry;
+
+    if (NULL == m_pIDBucketList) {
+        return(NULL);
+    }
+
+    pEntry = m_pIDBucketList[featureID & (SHAPE_INDEX_NUM_ID_BUCKETS - 1)];
+    while ((pEntry) && (pEntry->m_pShape->m_FeatureID != featureID)) {
+        pEntry = pEntry->m_pNextInBucket;
+    }
+
+    return(pEntry);
+} // FindEntry
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FindShape]
+//
+/////////////////////////////////////////////////////////////////////////////
+CBioCADShape *
+CShapeIndex::FindShape(int32 featureID) {
+    CShapeIndexEntry *pEntry;
+
+    pEntry = FindEntry(featureID);
+    if (NULL == pEntry) {
+        return(NULL);
+    }
+    return(pEntry->m_pShape);
+} // FindShape
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// [FindShapesInRect]
+//
+// This finds every shape whose bounding box overlaps the rectangle. The
+// bounds are inclusive. The list belongs to the index, and it is only
+// valid until the next call.
+/////////////////////////////////////////////////////////////////////////////
+ErrVal
+CShapeIndex::FindShapesInRect(
+                    int32 leftX,
+                    int32 topY,
+                    int32 rightX,
+                    int32 bottomY,
+                    CShapeIndexEntry ***ppEntryList,
+                    int32 *pNumEntries) {
+    ErrVal err = ENoErr;
+    CShapeIndexCellNode *pNode;
+    CShapeIndexEntry *pEntry;
+    CBioCADShape *pShape;
+    int32 leftColumn;
+    int32 rightColumn;
+    int32 topRow;
+    int32 bottomRow;
+    int32 column;
+    int32 row;
+    int32 numEntries = 0;
+
+    if ((NULL == ppEntryList) || (NULL == pNumEntries)) {
+        gotoErr(EFail);
+    }
+    *ppEntryList = NULL;
+    *pNumEntries = 0;
+    if ((NULL == m_pCellList) || (leftX > rightX) || (topY > bottomY)) {
+        gotoErr(ENoErr);
+    }
+
+    // No shape can be found twice, so there are never more results than shapes.
+    if (m_MaxResults < m_NumShapes) {
+        memFree(m_pResultList);
+        m_MaxResults = 0;
+        m_pResultList = (CShapeIndexEntry **) memAlloc(sizeof(CShapeIndexEntry *) * m_NumShapes);
+        if (NULL == m_pResultList) {
+            gotoErr(EFail);
+        }
+        m_MaxResults = m_NumShapes;
+    }
+
+    leftColumn = GetColumn(leftX);
+    rightColumn = GetColumn(rightX);
+    topRow = GetRow(topY);
+    bottomRow = GetRow(bottomY);
+
+    for (row = topRow; row <= bottomRow; row++) {
+        for (column = leftColumn; column <= rightColumn; column++) {
+            pNode = m_pCellList[(row * m_NumColumns) + column];
+            while (pNode) {
+                pEntry = pNode->m_pEntry;
+                pNode = pNode->m_pNextNode;
+
+                // Only report a shape from the first cell it shares with the rectangle.
+                if (((column > leftColumn) && (column > pEntry->m_LeftColumn))
+                        || ((row > topRow) && (row > pEntry->m_TopRow))) {
+                    continue;
+                }
+
+                pShape = pEntry->m_pShape;
+                if ((pShape->m_BoundingBoxLeftX > rightX) || (pShape->m_BoundingBoxRightX < leftX)
+                        || (pShape->m_BoundingBoxTopY > bottomY) || (pShape->m_BoundingBoxBottomY < topY)) {
+                    continue;
+                }
+
+                m_pResultList[numEntries] = pEntry;
+                numEntries += 1;
+            } // while (pNode)
+        } // for (column = leftColumn; column <= rightColumn; column++)
+    } // for (row = topRow; row <= bottomRow; row++)
+
+    *ppEntryList = m_pResultList;
+    *pNumEntries = numEntries;
+
+abort:
+    returnErr(err);
+} // FindShapesInRect
+